@@ -0,0 +1,397 @@
+//batch.c
+//Every worker thread owns a queue of files. The list is sorted by size
+//and dealt out round robin, so each queue holds a similar amount of
+//work with its largest file at the back. A worker takes from the back
+//of its own queue, the large files go first while there is plenty left
+//to balance them, and once it is empty it steals from the front of the
+//other queues, the small files, which fill the gaps at the end.
+//
+//The cores are a budget shared by all the decoders. Before opening its
+//decoder a file asks for as many cores as it gets threads, in order of
+//asking, and waits until they are free. A file gets a thread for every
+//BATCH_PIXELS_PER_THREAD of its frame size, or more towards the end of
+//the list when fewer files than cores are left.
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "batch.h"
+
+//the queue of one worker, of indices into Batch.files
+typedef struct JobQueue {
+    int             *jobs;
+    int             head, tail;     //steal at the head, take at the tail
+    pthread_mutex_t lock;
+}JobQueue;
+
+typedef struct BatchWorker {
+    struct Batch    *b;
+    int             index;
+    pthread_t       thread;
+    int             running;
+    JobQueue        queue;
+}BatchWorker;
+
+typedef struct Batch {
+    char            **files;
+    int             nb_files;
+    BatchWorker     workers[BATCH_MAX_WORKERS];
+    int             nb_workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cores_cond;
+    int             free_cores;
+    unsigned        next_ticket;    //cores are handed out in ticket order
+    unsigned        serving;
+    int             unfinished;     //files queued or decoding
+    BatchStats      stats;
+}Batch;
+
+typedef struct SizedFile {
+    int             index;
+    int64_t         size;
+}SizedFile;
+
+typedef struct FileResult {
+    int             width, height;
+    int             threads;
+    int             frames;
+    double          decoding;       //s, after the cores were granted
+    double          waiting;        //s, for the cores
+}FileResult;
+
+static int compare_size(const void *a, const void *b) {
+    const SizedFile *fa = a, *fb = b;
+
+    if (fa->size != fb->size)
+        return fa->size < fb->size ? -1 : 1;
+    return fa->index - fb->index;
+}
+
+//the largest file of our own queue, else the smallest of another one
+static int take_job(Batch *b, BatchWorker *w, int *stolen) {
+    JobQueue *q = &w->queue;
+    int i, job = -1;
+
+    *stolen = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+        job = q->jobs[--q->tail];
+    pthread_mutex_unlock(&q->lock);
+
+    for (i = 1; job < 0 && i < b->nb_workers; i++) {
+        q = &b->workers[(w->index + i) % b->nb_workers].queue;
+        pthread_mutex_lock(&q->lock);
+        if (q->tail > q->head) {
+            job = q->jobs[q->head++];
+            *stolen = 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return job;
+}
+
+static int decoder_threads(Batch *b, int width, int height) {
+    int64_t pixels = (int64_t)width * height;
+    int threads = (pixels + BATCH_PIXELS_PER_THREAD - 1) / BATCH_PIXELS_PER_THREAD;
+    int share;
+
+    //the tail of the list: spread the idle cores over what is left
+    pthread_mutex_lock(&b->mutex);
+    share = b->stats.nb_cores / FFMAX(b->unfinished, 1);
+    pthread_mutex_unlock(&b->mutex);
+
+    threads = FFMAX(threads, share);
+    return av_clip(threads, 1, FFMIN(BATCH_MAX_DECODE_THREADS, b->stats.nb_cores));
+}
+
+static void acquire_cores(Batch *b, int n) {
+    unsigned ticket;
+
+    pthread_mutex_lock(&b->mutex);
+    ticket = b->next_ticket++;
+    while (ticket != b->serving || b->free_cores < n)
+        pthread_cond_wait(&b->cores_cond, &b->mutex);
+    b->serving++;
+    b->free_cores -= n;
+    //the next in line may fit in what is left
+    pthread_cond_broadcast(&b->cores_cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static void release_cores(Batch *b, int n) {
+    pthread_mutex_lock(&b->mutex);
+    b->free_cores += n;
+    pthread_cond_broadcast(&b->cores_cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static int decode_packet(AVCodecContext *ctx, AVPacket *pkt, AVFrame *frame) {
+    int got = 0;
+
+    //a video decoder takes the whole packet or drops it as damaged
+    avcodec_decode_video2(ctx, frame, &got, pkt);
+    return got;
+}
+
+static int decode_file(Batch *b, const char *filename, FileResult *r) {
+    AVFormatContext *pFormatCtx = NULL;
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec;
+    AVFrame *frame = NULL;
+    AVPacket packet;
+    int64_t start;
+    int i, videoStream = -1, ret = -1;
+
+    memset(r, 0, sizeof(*r));
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
+        goto end;
+
+    //the demuxer can skip everything but the first video stream
+    for (i = 0; i < pFormatCtx->nb_streams; i++) {
+        if (videoStream < 0 &&
+            pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+            videoStream = i;
+        else
+            pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+    if (videoStream < 0)
+        goto end;
+
+    pCodec = avcodec_find_decoder(pFormatCtx->streams[videoStream]->codec->codec_id);
+    if (!pCodec)
+        goto end;
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (!pCodecCtx ||
+        avcodec_copy_context(pCodecCtx, pFormatCtx->streams[videoStream]->codec) != 0)
+        goto end;
+    r->width = pCodecCtx->width;
+    r->height = pCodecCtx->height;
+    r->threads = decoder_threads(b, r->width, r->height);
+    pCodecCtx->thread_count = r->threads;
+
+    start = av_gettime();
+    acquire_cores(b, r->threads);
+    r->waiting = (av_gettime() - start) / 1000000.0;
+
+    start = av_gettime();
+    frame = av_frame_alloc();
+    if (frame && avcodec_open2(pCodecCtx, pCodec, NULL) == 0) {
+        while (av_read_frame(pFormatCtx, &packet) >= 0) {
+            if (packet.stream_index == videoStream)
+                r->frames += decode_packet(pCodecCtx, &packet, frame);
+            av_free_packet(&packet);
+        }
+        //frames the decoder still holds back
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        while (decode_packet(pCodecCtx, &packet, frame) > 0)
+            r->frames++;
+        ret = 0;
+    }
+    //the decoder's threads are gone before its cores are given back
+    avcodec_free_context(&pCodecCtx);
+    r->decoding = (av_gettime() - start) / 1000000.0;
+    release_cores(b, r->threads);
+
+end:
+    av_frame_free(&frame);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+    return ret;
+}
+
+static void *batch_worker(void *arg) {
+    BatchWorker *w = arg;
+    Batch *b = w->b;
+    FileResult r;
+    int job, stolen, ret;
+
+    while ((job = take_job(b, w, &stolen)) >= 0) {
+        ret = decode_file(b, b->files[job], &r);
+
+        pthread_mutex_lock(&b->mutex);
+        b->unfinished--;
+        b->stats.nb_steals += stolen;
+        if (ret < 0) {
+            b->stats.nb_failed++;
+            fprintf(stderr, "%s: could not decode\n", b->files[job]);
+        } else {
+            b->stats.frames += r.frames;
+            b->stats.pixels += (int64_t)r.frames * r.width * r.height;
+            b->stats.decoding += r.decoding;
+            b->stats.core_time += r.decoding * r.threads;
+            b->stats.waiting += r.waiting;
+            printf("%s: %dx%d, %d threads, %d frames in %.2f s, %.1f fps\n",
+                   b->files[job], r.width, r.height, r.threads, r.frames, r.decoding,
+                   r.decoding > 0 ? r.frames / r.decoding : 0.0);
+            fflush(stdout);
+        }
+        pthread_mutex_unlock(&b->mutex);
+    }
+    return NULL;
+}
+
+int batch_run(char **files, int nb_files, int nb_cores, BatchStats *stats) {
+    Batch *b;
+    SizedFile *order;
+    int64_t start;
+    int i, nb_failed = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    if (nb_files <= 0)
+        return 0;
+    if (nb_cores <= 0)
+        nb_cores = av_cpu_count();
+
+    b = av_mallocz(sizeof(Batch));
+    order = av_malloc_array(nb_files, sizeof(SizedFile));
+    if (!b || !order)
+        goto end;
+    b->files = files;
+    b->nb_files = nb_files;
+    b->unfinished = nb_files;
+    b->free_cores = nb_cores;
+    b->stats.nb_files = nb_files;
+    b->stats.nb_cores = nb_cores;
+    //every file needs a core, more threads could never run at once
+    b->nb_workers = FFMIN(FFMIN(nb_cores, nb_files), BATCH_MAX_WORKERS);
+    b->stats.nb_workers = b->nb_workers;
+    pthread_mutex_init(&b->mutex, NULL);
+    pthread_cond_init(&b->cores_cond, NULL);
+
+    //what cannot be stat'ed goes first, it fails fast
+    for (i = 0; i < nb_files; i++) {
+        struct stat st;
+
+        order[i].index = i;
+        order[i].size = stat(files[i], &st) == 0 ? st.st_size : 0;
+    }
+    qsort(order, nb_files, sizeof(SizedFile), compare_size);
+
+    for (i = 0; i < b->nb_workers; i++) {
+        BatchWorker *w = &b->workers[i];
+
+        w->b = b;
+        w->index = i;
+        pthread_mutex_init(&w->queue.lock, NULL);
+        w->queue.jobs = av_malloc_array(nb_files / b->nb_workers + 1, sizeof(int));
+        if (!w->queue.jobs)
+            goto end;
+    }
+    for (i = 0; i < nb_files; i++) {
+        JobQueue *q = &b->workers[i % b->nb_workers].queue;
+        q->jobs[q->tail++] = order[i].index;
+    }
+
+    //the calling thread is worker 0, so it never matters if a thread
+    //fails to start, the others steal its share
+    start = av_gettime();
+    for (i = 1; i < b->nb_workers; i++) {
+        BatchWorker *w = &b->workers[i];
+        w->running = pthread_create(&w->thread, NULL, batch_worker, w) == 0;
+    }
+    batch_worker(&b->workers[0]);
+    for (i = 1; i < b->nb_workers; i++) {
+        if (b->workers[i].running)
+            pthread_join(b->workers[i].thread, NULL);
+    }
+    b->stats.elapsed = (av_gettime() - start) / 1000000.0;
+
+    *stats = b->stats;
+    nb_failed = stats->nb_failed;
+
+end:
+    if (b) {
+        for (i = 0; i < b->nb_workers; i++) {
+            if (b->workers[i].b)
+                pthread_mutex_destroy(&b->workers[i].queue.lock);
+            av_freep(&b->workers[i].queue.jobs);
+        }
+        if (b->nb_workers) {
+            pthread_cond_destroy(&b->cores_cond);
+            pthread_mutex_destroy(&b->mutex);
+        }
+    }
+    av_free(order);
+    av_free(b);
+    return nb_failed < 0 ? nb_files : nb_failed;
+}
+
+int batch_read_list(const char *list, char ***files) {
+    char line[4096];
+    FILE *pFile;
+    char **names = NULL;
+    int nb_names = 0, nb_alloc = 0;
+
+    *files = NULL;
+    pFile = strcmp(list, "-") ? fopen(list, "r") : stdin;
+    if (pFile == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), pFile)) {
+        size_t len = strcspn(line, "\r\n");
+
+        line[len] = 0;
+        if (!len || line[0] == '#')
+            continue;
+        if (nb_names == nb_alloc) {
+            int n = nb_alloc ? nb_alloc * 2 : 256;
+            char **p = av_realloc_array(names, n, sizeof(char *));
+            if (!p)
+                break;
+            names = p;
+            nb_alloc = n;
+        }
+        names[nb_names] = av_strdup(line);
+        if (!names[nb_names])
+            break;
+        nb_names++;
+    }
+    if (ferror(pFile) || !feof(pFile)) {
+        //a read error or out of memory, never run half a list
+        batch_free_list(&names, nb_names);
+        nb_names = -1;
+    }
+    if (pFile != stdin)
+        fclose(pFile);
+    *files = names;
+    return nb_names;
+}
+
+void batch_free_list(char ***files, int nb_files) {
+    int i;
+
+    if (!*files)
+        return;
+    for (i = 0; i < nb_files; i++)
+        av_free((*files)[i]);
+    av_freep(files);
+}
+
+void batch_print_stats(const BatchStats *stats, const char *name) {
+    double elapsed = stats->elapsed > 0 ? stats->elapsed : 1e-9;
+
+    fprintf(stderr, "%s: %d files, %d failed, %d threads on %d cores, %d files stolen\n",
+            name, stats->nb_files, stats->nb_failed, stats->nb_workers, stats->nb_cores,
+            stats->nb_steals);
+    fprintf(stderr, "%s: %"PRId64" frames in %.2f s, %.1f fps, %.1f Mpixel/s, "
+            "cores busy %.0f%%, %.2f s waited for cores\n", name, stats->frames,
+            stats->elapsed, stats->frames / elapsed, stats->pixels / elapsed / 1000000.0,
+            100.0 * stats->core_time / (elapsed * FFMAX(stats->nb_cores, 1)),
+            stats->waiting);
+}
@@ -0,0 +1,51 @@
+//batch.h
+//Decode a long list of files in one process for offline jobs. A fixed
+//pool of threads, one per core, takes the files from per thread queues
+//and steals from the others when its own runs dry. How many decoder
+//threads a file gets depends on its resolution and on how much of the
+//list is left, so the cores are neither idle nor oversubscribed.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+
+#define BATCH_MAX_WORKERS           64
+#define BATCH_MAX_DECODE_THREADS    8
+#define BATCH_PIXELS_PER_THREAD     (1280 * 720)    //a core's share of a frame
+
+typedef struct BatchStats {
+    int         nb_files;
+    int         nb_failed;
+    int         nb_workers;
+    int         nb_cores;       //shared out to the decoders
+    int         nb_steals;      //files run by a thread they were not queued on
+    int64_t     frames;
+    int64_t     pixels;         //decoded, all files
+    double      elapsed;        //s, wall clock of the whole batch
+    double      decoding;       //s, summed over the files
+    double      core_time;      //s, cores held by decoders, summed
+    double      waiting;        //s, files waited for free cores
+}BatchStats;
+
+/*
+ * Read a list of files, one path per line, "-" for stdin. Empty lines
+ * and lines starting with '#' are skipped. Returns the number of files,
+ * -1 if the list cannot be read.
+ */
+int batch_read_list(const char *list, char ***files);
+
+void batch_free_list(char ***files, int nb_files);
+
+/*
+ * Decode the first video stream of each of the 'nb_files' files, larger
+ * files first, on 'nb_cores' threads, <= 0 for one per cpu. A line with
+ * the resolution, decoder threads, frames and speed is printed for every
+ * file as it finishes. Returns the number of files that failed.
+ */
+int batch_run(char **files, int nb_files, int nb_cores, BatchStats *stats);
+
+//totals and aggregate throughput on stderr
+void batch_print_stats(const BatchStats *stats, const char *name);
+
+#endif
@@ -0,0 +1,156 @@
+//bitdepth.c
+//Each output sample is (sample + threshold) >> (depth - 8), saturated.
+//The threshold is half a step without dithering, or the 8x8 Bayer value
+//for the sample's position scaled to one step. Thresholds repeat every
+//8 samples, so a vector of them is loaded once per row and the SIMD
+//loops only add, shift and pack.
+
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+
+#include "bitdepth.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+typedef void (*ReduceFunc)(const uint16_t *src, uint8_t *dst, int width,
+                           const uint16_t *threshold, int shift);
+
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+static void reduce_scalar_from(const uint16_t *src, uint8_t *dst, int x, int width,
+                               const uint16_t *threshold, int shift) {
+    for (; x < width; x++)
+        dst[x] = av_clip_uint8((src[x] + threshold[x & 7]) >> shift);
+}
+
+static void reduce_scalar(const uint16_t *src, uint8_t *dst, int width,
+                          const uint16_t *threshold, int shift) {
+    reduce_scalar_from(src, dst, 0, width, threshold, shift);
+}
+
+#if HAVE_X86_SIMD
+
+//the sums saturate at 0xFFFF and packus saturates what is left above 255
+__attribute__((target("sse2")))
+static void reduce_sse2(const uint16_t *src, uint8_t *dst, int width,
+                        const uint16_t *threshold, int shift) {
+    const __m128i t = _mm_loadu_si128((const __m128i *)threshold);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i a = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + x)), t);
+        __m128i b = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + x + 8)), t);
+
+        a = _mm_srl_epi16(a, count);
+        b = _mm_srl_epi16(b, count);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(a, b));
+    }
+    reduce_scalar_from(src, dst, x, width, threshold, shift);
+}
+
+__attribute__((target("avx2")))
+static void reduce_avx2(const uint16_t *src, uint8_t *dst, int width,
+                        const uint16_t *threshold, int shift) {
+    const __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)threshold));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i a = _mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + x)), t);
+        __m256i b = _mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + x + 16)), t);
+
+        a = _mm256_srl_epi16(a, count);
+        b = _mm256_srl_epi16(b, count);
+        //packus works per lane, put the quarters back in order
+        a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i *)(dst + x), a);
+    }
+    reduce_scalar_from(src, dst, x, width, threshold, shift);
+}
+
+static ReduceFunc best_reduce(void) {
+    if (__builtin_cpu_supports("avx2"))
+        return reduce_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return reduce_sse2;
+    return reduce_scalar;
+}
+
+#else
+
+static ReduceFunc best_reduce(void) {
+    return reduce_scalar;
+}
+
+#endif
+
+int bit_depth_supported(enum AVPixelFormat srcFormat, enum AVPixelFormat dstFormat) {
+    const AVPixFmtDescriptor *sdesc = av_pix_fmt_desc_get(srcFormat);
+    const AVPixFmtDescriptor *ddesc = av_pix_fmt_desc_get(dstFormat);
+    int i;
+
+    //same planar layout, native endian on both sides
+    if (!sdesc || !ddesc || !(sdesc->flags & AV_PIX_FMT_FLAG_PLANAR) ||
+        sdesc->flags != ddesc->flags || (sdesc->flags & AV_PIX_FMT_FLAG_BE) ||
+        sdesc->nb_components != ddesc->nb_components ||
+        sdesc->log2_chroma_w != ddesc->log2_chroma_w ||
+        sdesc->log2_chroma_h != ddesc->log2_chroma_h)
+        return 0;
+    for (i = 0; i < sdesc->nb_components; i++) {
+        if (sdesc->comp[i].plane != ddesc->comp[i].plane ||
+            sdesc->comp[i].depth != sdesc->comp[0].depth ||
+            sdesc->comp[i].depth <= 8 || sdesc->comp[i].depth > 16 ||
+            sdesc->comp[i].step != 2 || sdesc->comp[i].shift ||
+            ddesc->comp[i].depth != 8 || ddesc->comp[i].step != 1)
+            return 0;
+    }
+    return 1;
+}
+
+int bit_depth_reduce(const uint8_t *const src[], const int srcStride[],
+                     enum AVPixelFormat srcFormat, int srcSliceY, int srcSliceH,
+                     uint8_t *const dst[], const int dstStride[], int width, int dither) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(srcFormat);
+    ReduceFunc reduce = best_reduce();
+    int shift, i, p, y;
+
+    if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) ||
+        desc->comp[0].depth <= 8 || desc->comp[0].depth > 16)
+        return -1;
+    shift = desc->comp[0].depth - 8;
+
+    for (p = 0; p < desc->nb_components; p++) {
+        //U and V are subsampled, luma and alpha are not
+        int chroma = (p == 1 || p == 2) && desc->nb_components > 2;
+        int sw = chroma ? desc->log2_chroma_w : 0;
+        int sh = chroma ? desc->log2_chroma_h : 0;
+        int w = -((-width) >> sw);
+        int y0 = srcSliceY >> sh;
+        int y1 = -((-(srcSliceY + srcSliceH)) >> sh);
+
+        for (y = y0; y < y1; y++) {
+            uint16_t threshold[8];
+
+            for (i = 0; i < 8; i++)
+                threshold[i] = dither ? (bayer8[y & 7][i] << shift) >> 6 : 1 << (shift - 1);
+            reduce((const uint16_t *)(src[p] + y * srcStride[p]),
+                   dst[p] + y * dstStride[p], w, threshold, shift);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+//bitdepth.h
+//9 to 16 bit planar YUV down to the same layout in 8 bits, with an
+//optional 8x8 ordered dither so gradients don't band. For 10 and 12 bit
+//sources where swscale would otherwise run its generic path just to
+//drop the low bits.
+
+#ifndef BITDEPTH_H
+#define BITDEPTH_H
+
+#include <libavutil/pixfmt.h>
+
+#include <stdint.h>
+
+//whether srcFormat and dstFormat differ in nothing but the bit depth
+int bit_depth_supported(enum AVPixelFormat srcFormat, enum AVPixelFormat dstFormat);
+
+/*
+ * Reduce rows srcSliceY to srcSliceY + srcSliceH of a 'width' wide
+ * picture, like sws_scale() without scaling: src and dst point at the
+ * top of the whole pictures. Rounds to nearest without 'dither', else
+ * adds a Bayer matrix threshold that depends on the position in the
+ * plane, so slices line up. dst must be the 8 bit format
+ * bit_depth_supported() accepted. Returns -1 if srcFormat is not a high
+ * bit depth planar format.
+ */
+int bit_depth_reduce(const uint8_t *const src[], const int srcStride[],
+                     enum AVPixelFormat srcFormat, int srcSliceY, int srcSliceH,
+                     uint8_t *const dst[], const int dstStride[], int width, int dither);
+
+#endif
@@ -0,0 +1,329 @@
+//fastopen.c
+//Opens an input with a bounded probe, or without probing at all when a
+//stream descriptor for the same file was saved by an earlier run.
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/dict.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fastopen.h"
+
+/*
+ * Descriptor layout, host byte order:
+ *   DescHeader
+ *   DescStream + extradata bytes, nb_streams times
+ */
+typedef struct DescHeader {
+    char        magic[4];
+    uint32_t    version;
+    int64_t     file_size;
+    int64_t     file_mtime;
+    char        format_name[32];    //first of the demuxer's names
+    int64_t     duration;
+    int64_t     start_time;
+    int64_t     bit_rate;
+    uint32_t    nb_streams;
+    uint32_t    reserved;
+}DescHeader;
+
+typedef struct DescStream {
+    int32_t     codec_type;
+    int32_t     codec_id;
+    uint32_t    codec_tag;
+    int32_t     width, height;
+    int32_t     pix_fmt;
+    int32_t     sample_rate;
+    int32_t     channels;
+    int32_t     sample_fmt;
+    int32_t     frame_size;
+    uint64_t    channel_layout;
+    int64_t     bit_rate;
+    int32_t     profile, level;
+    int32_t     has_b_frames;
+    int32_t     sar_num, sar_den;
+    int32_t     r_frame_rate_num, r_frame_rate_den;
+    int32_t     avg_frame_rate_num, avg_frame_rate_den;
+    uint32_t    extradata_size;
+}DescStream;
+
+void fast_open_default_options(FastOpenOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+}
+
+int fast_open_parse_option(FastOpenOptions *opts, int argc, char **argv, int *i) {
+    const char *opt = argv[*i];
+
+    if (!strcmp(opt, "-fast")) {
+        opts->use_cache = 1;
+        if (!opts->probesize)
+            opts->probesize = FAST_OPEN_PROBESIZE;
+        if (!opts->analyzeduration)
+            opts->analyzeduration = FAST_OPEN_ANALYZEDURATION;
+        return 1;
+    }
+    if (!strcmp(opt, "-probesize") && *i + 1 < argc) {
+        opts->probesize = strtoll(argv[++*i], NULL, 10);
+        return 1;
+    }
+    if (!strcmp(opt, "-analyzeduration") && *i + 1 < argc) {
+        opts->analyzeduration = strtoll(argv[++*i], NULL, 10);
+        return 1;
+    }
+    return 0;
+}
+
+static void desc_filename(char *buf, size_t size, const char *filename) {
+    snprintf(buf, size, "%s%s", filename, FAST_OPEN_SUFFIX);
+}
+
+static void save_descriptor(AVFormatContext *ic, const char *filename,
+                            const struct stat *st) {
+    char name[1024], tmpname[1040];
+    DescHeader hdr;
+    FILE *pFile;
+    int i, ret = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FAST_OPEN_MAGIC, 4);
+    hdr.version    = FAST_OPEN_VERSION;
+    hdr.file_size  = st->st_size;
+    hdr.file_mtime = st->st_mtime;
+    //"mov,mp4,m4a,..." -> "mov", which av_find_input_format() accepts
+    av_strlcpy(hdr.format_name, ic->iformat->name, sizeof(hdr.format_name));
+    hdr.format_name[strcspn(hdr.format_name, ",")] = 0;
+    hdr.duration   = ic->duration;
+    hdr.start_time = ic->start_time;
+    hdr.bit_rate   = ic->bit_rate;
+    hdr.nb_streams = ic->nb_streams;
+
+    desc_filename(name, sizeof(name), filename);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    pFile = fopen(tmpname, "wb");
+    if (pFile == NULL)
+        return;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, pFile) != 1)
+        ret = -1;
+    for (i = 0; i < ic->nb_streams && ret == 0; i++) {
+        AVStream *stream = ic->streams[i];
+        AVCodecContext *c = stream->codec;
+        DescStream ds;
+
+        memset(&ds, 0, sizeof(ds));
+        ds.codec_type         = c->codec_type;
+        ds.codec_id           = c->codec_id;
+        ds.codec_tag          = c->codec_tag;
+        ds.width              = c->width;
+        ds.height             = c->height;
+        ds.pix_fmt            = c->pix_fmt;
+        ds.sample_rate        = c->sample_rate;
+        ds.channels           = c->channels;
+        ds.sample_fmt         = c->sample_fmt;
+        ds.frame_size         = c->frame_size;
+        ds.channel_layout     = c->channel_layout;
+        ds.bit_rate           = c->bit_rate;
+        ds.profile            = c->profile;
+        ds.level              = c->level;
+        ds.has_b_frames       = c->has_b_frames;
+        ds.sar_num            = stream->sample_aspect_ratio.num;
+        ds.sar_den            = stream->sample_aspect_ratio.den;
+        ds.r_frame_rate_num   = stream->r_frame_rate.num;
+        ds.r_frame_rate_den   = stream->r_frame_rate.den;
+        ds.avg_frame_rate_num = stream->avg_frame_rate.num;
+        ds.avg_frame_rate_den = stream->avg_frame_rate.den;
+        ds.extradata_size     = c->extradata ? c->extradata_size : 0;
+
+        if (fwrite(&ds, sizeof(ds), 1, pFile) != 1 ||
+            (ds.extradata_size &&
+             fwrite(c->extradata, 1, ds.extradata_size, pFile) != ds.extradata_size))
+            ret = -1;
+    }
+
+    if (fclose(pFile) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmpname, name) == 0)
+        return;
+    unlink(tmpname);
+}
+
+/*
+ * Read the descriptor of 'filename' if it is current. On success *hdr
+ * is filled in and the file is left positioned at the first stream.
+ */
+static FILE *open_descriptor(const char *filename, const struct stat *st,
+                             DescHeader *hdr) {
+    char name[1024];
+    FILE *pFile;
+
+    desc_filename(name, sizeof(name), filename);
+    pFile = fopen(name, "rb");
+    if (pFile == NULL)
+        return NULL;
+
+    if (fread(hdr, sizeof(*hdr), 1, pFile) != 1 ||
+        memcmp(hdr->magic, FAST_OPEN_MAGIC, 4) ||
+        hdr->version != FAST_OPEN_VERSION ||
+        hdr->file_size != st->st_size || hdr->file_mtime != st->st_mtime) {
+        fclose(pFile);
+        return NULL;
+    }
+    hdr->format_name[sizeof(hdr->format_name) - 1] = 0;
+    return pFile;
+}
+
+//fill the streams of an opened 'ic' in from the descriptor. Everything
+//is read and checked first, so a mismatch leaves 'ic' untouched.
+static int apply_descriptor(AVFormatContext *ic, const DescHeader *hdr, FILE *pFile) {
+    DescStream *ds;
+    uint8_t **extradata;
+    int i, ret = -1;
+
+    if (ic->nb_streams != hdr->nb_streams || ic->nb_streams == 0)
+        return -1;  //the demuxer sees a different layout, probe after all
+
+    ds = av_mallocz_array(ic->nb_streams, sizeof(*ds));
+    extradata = av_mallocz_array(ic->nb_streams, sizeof(*extradata));
+    if (!ds || !extradata)
+        goto end;
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVCodecContext *c = ic->streams[i]->codec;
+
+        if (fread(&ds[i], sizeof(ds[i]), 1, pFile) != 1 || ds[i].extradata_size > (1 << 24))
+            goto end;
+        if (c->codec_type != AVMEDIA_TYPE_UNKNOWN && c->codec_type != ds[i].codec_type)
+            goto end;
+        if (ds[i].extradata_size) {
+            extradata[i] = av_mallocz(ds[i].extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (!extradata[i] ||
+                fread(extradata[i], 1, ds[i].extradata_size, pFile) != ds[i].extradata_size)
+                goto end;
+        }
+    }
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *stream = ic->streams[i];
+        AVCodecContext *c = stream->codec;
+
+        c->codec_type     = ds[i].codec_type;
+        c->codec_id       = ds[i].codec_id;
+        c->codec_tag      = ds[i].codec_tag;
+        c->width          = ds[i].width;
+        c->height         = ds[i].height;
+        c->pix_fmt        = ds[i].pix_fmt;
+        c->sample_rate    = ds[i].sample_rate;
+        c->channels       = ds[i].channels;
+        c->sample_fmt     = ds[i].sample_fmt;
+        c->frame_size     = ds[i].frame_size;
+        c->channel_layout = ds[i].channel_layout;
+        c->bit_rate       = ds[i].bit_rate;
+        c->profile        = ds[i].profile;
+        c->level          = ds[i].level;
+        c->has_b_frames   = ds[i].has_b_frames;
+        stream->sample_aspect_ratio = av_make_q(ds[i].sar_num, ds[i].sar_den);
+        stream->r_frame_rate        = av_make_q(ds[i].r_frame_rate_num, ds[i].r_frame_rate_den);
+        stream->avg_frame_rate      = av_make_q(ds[i].avg_frame_rate_num, ds[i].avg_frame_rate_den);
+
+        //keep what the demuxer read from the header, else use ours
+        if (extradata[i] && !c->extradata) {
+            c->extradata      = extradata[i];
+            c->extradata_size = ds[i].extradata_size;
+            extradata[i]      = NULL;
+        }
+        //avformat_find_stream_info() is skipped, which is what would
+        //have filled codecpar from the context
+        if (avcodec_parameters_from_context(stream->codecpar, c) < 0)
+            goto end;
+    }
+
+    if (ic->duration == AV_NOPTS_VALUE)
+        ic->duration = hdr->duration;
+    if (ic->start_time == AV_NOPTS_VALUE)
+        ic->start_time = hdr->start_time;
+    if (!ic->bit_rate)
+        ic->bit_rate = hdr->bit_rate;
+    ret = 0;
+
+end:
+    if (extradata) {
+        for (i = 0; i < ic->nb_streams; i++)
+            av_free(extradata[i]);
+    }
+    av_free(extradata);
+    av_free(ds);
+    return ret;
+}
+
+int fast_open_input(AVFormatContext **pFormatCtx, const char *filename,
+                    const FastOpenOptions *opts, FastOpenStats *stats) {
+    AVInputFormat *fmt = NULL;
+    AVDictionary *dict = NULL;
+    DescHeader hdr;
+    FILE *pDesc = NULL;
+    struct stat st;
+    int cacheable, ret;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->open_start = av_gettime();
+
+    cacheable = opts->use_cache && stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+    if (cacheable) {
+        pDesc = open_descriptor(filename, &st, &hdr);
+        //the cached demuxer name also skips the format probe
+        if (pDesc)
+            fmt = av_find_input_format(hdr.format_name);
+    }
+
+    if (opts->probesize > 0)
+        av_dict_set_int(&dict, "probesize", opts->probesize, 0);
+    if (opts->analyzeduration > 0)
+        av_dict_set_int(&dict, "analyzeduration", opts->analyzeduration, 0);
+
+    ret = avformat_open_input(pFormatCtx, filename, fmt, &dict);
+    av_dict_free(&dict);
+    if (ret != 0) {
+        if (pDesc)
+            fclose(pDesc);
+        return -1;
+    }
+
+    if (pDesc) {
+        stats->cache_hit = apply_descriptor(*pFormatCtx, &hdr, pDesc) == 0;
+        fclose(pDesc);
+    }
+
+    if (!stats->cache_hit) {
+        if (avformat_find_stream_info(*pFormatCtx, NULL) < 0) {
+            avformat_close_input(pFormatCtx);
+            return -1;
+        }
+        if (cacheable)
+            save_descriptor(*pFormatCtx, filename, &st);
+    }
+
+    stats->open_done = av_gettime();
+    return 0;
+}
+
+void fast_open_first_frame(FastOpenStats *stats, const char *filename) {
+    int64_t now;
+
+    if (stats->first_frame_done || !stats->open_start)
+        return;
+    stats->first_frame_done = 1;
+
+    now = av_gettime();
+    fprintf(stderr, "%s: opened in %.1f ms (%s), first frame after %.1f ms\n",
+            filename,
+            (stats->open_done - stats->open_start) / 1000.0,
+            stats->cache_hit ? "cached" : "probed",
+            (now - stats->open_start) / 1000.0);
+}
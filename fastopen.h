@@ -0,0 +1,56 @@
+//fastopen.h
+//Bounded probing and cached stream parameters for avformat_open_input
+//+ avformat_find_stream_info, with time to first frame reporting.
+
+#ifndef FASTOPEN_H
+#define FASTOPEN_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+#define FAST_OPEN_MAGIC     "AVDS"
+#define FAST_OPEN_VERSION   1
+#define FAST_OPEN_SUFFIX    ".avdesc"
+
+//budget used by -fast when no explicit one is given
+#define FAST_OPEN_PROBESIZE         (512 * 1024)
+#define FAST_OPEN_ANALYZEDURATION   (AV_TIME_BASE / 2)
+
+typedef struct FastOpenOptions {
+    int64_t probesize;          //bytes, 0 for the libavformat default
+    int64_t analyzeduration;    //AV_TIME_BASE units, 0 for the default
+    int     use_cache;          //read and write the stream descriptor cache
+}FastOpenOptions;
+
+typedef struct FastOpenStats {
+    int64_t open_start;         //av_gettime() when opening started
+    int64_t open_done;          //... and when the streams were known
+    int     cache_hit;
+    int     first_frame_done;
+}FastOpenStats;
+
+void fast_open_default_options(FastOpenOptions *opts);
+
+/*
+ * Handle -fast, -probesize BYTES and -analyzeduration USEC at argv[*i].
+ * Returns 1 and advances *i past any argument if the option was ours,
+ * 0 otherwise.
+ */
+int fast_open_parse_option(FastOpenOptions *opts, int argc, char **argv, int *i);
+
+/*
+ * Drop-in for avformat_open_input() + avformat_find_stream_info().
+ * If the cache is enabled and holds a descriptor for this file (same
+ * size and mtime), the streams are filled in from it and probing is
+ * skipped entirely. Otherwise the streams are probed within the budget
+ * in 'opts' and, with the cache enabled, the descriptor is saved.
+ * Returns 0 on success, a negative value on error.
+ */
+int fast_open_input(AVFormatContext **pFormatCtx, const char *filename,
+                    const FastOpenOptions *opts, FastOpenStats *stats);
+
+//print the open time and the time to first frame, once per stats
+void fast_open_first_frame(FastOpenStats *stats, const char *filename);
+
+#endif
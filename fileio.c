@@ -0,0 +1,149 @@
+//fileio.c
+//Memory mapped input for local files. The demuxer's reads become
+//memcpy's out of the page cache, and a sliding window ahead of the read
+//position is handed to posix_fadvise/madvise so the kernel fetches it
+//asynchronously instead of av_read_frame blocking on every cold page.
+
+#include <libavformat/avio.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fileio.h"
+
+typedef struct FileIO {
+    int         fd;
+    uint8_t     *map;
+    int64_t     size;
+    int64_t     pos;
+    int64_t     advised;    //end of the window already hinted
+}FileIO;
+
+//keep FILE_IO_READAHEAD bytes ahead of the reader hinted
+static void file_io_advise(FileIO *f) {
+    int64_t len;
+
+    if (f->advised - f->pos > FILE_IO_READAHEAD / 2 || f->advised >= f->size)
+        return;
+    if (f->advised < f->pos)
+        f->advised = f->pos;
+
+    len = FFMIN(f->pos + FILE_IO_READAHEAD, f->size) - f->advised;
+    posix_fadvise(f->fd, f->advised, len, POSIX_FADV_WILLNEED);
+    //madvise wants a page aligned start
+    {
+        int64_t page = sysconf(_SC_PAGESIZE);
+        int64_t start = f->advised & ~(page - 1);
+        madvise(f->map + start, f->advised + len - start, MADV_WILLNEED);
+    }
+    f->advised += len;
+}
+
+static int file_io_read(void *opaque, uint8_t *buf, int buf_size) {
+    FileIO *f = (FileIO *)opaque;
+    int64_t len = FFMIN(buf_size, f->size - f->pos);
+
+    if (len <= 0)
+        return AVERROR_EOF;
+
+    file_io_advise(f);
+    memcpy(buf, f->map + f->pos, len);
+    f->pos += len;
+    return (int)len;
+}
+
+static int64_t file_io_seek(void *opaque, int64_t offset, int whence) {
+    FileIO *f = (FileIO *)opaque;
+    int64_t pos;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return f->size;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = f->pos + offset;
+        break;
+    case SEEK_END:
+        pos = f->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > f->size)
+        return AVERROR(EINVAL);
+
+    //a jump invalidates the read ahead window
+    if (pos < f->pos || pos > f->advised)
+        f->advised = pos;
+    f->pos = pos;
+    return pos;
+}
+
+AVIOContext *file_io_open(const char *filename) {
+    FileIO *f;
+    AVIOContext *pb;
+    uint8_t *buffer;
+    struct stat st;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    f = av_mallocz(sizeof(FileIO));
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
+    f->fd = fd;
+    f->size = st.st_size;
+    f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (f->map == MAP_FAILED) {
+        close(fd);
+        av_free(f);
+        return NULL;
+    }
+
+    //demuxing is mostly a forward scan, let the kernel read ahead hard
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    madvise(f->map, f->size, MADV_SEQUENTIAL);
+    file_io_advise(f);
+
+    buffer = av_malloc(FILE_IO_BUFFER_SIZE);
+    pb = buffer ? avio_alloc_context(buffer, FILE_IO_BUFFER_SIZE, 0, f,
+                                     file_io_read, NULL, file_io_seek) : NULL;
+    if (!pb) {
+        av_free(buffer);
+        munmap(f->map, f->size);
+        close(fd);
+        av_free(f);
+        return NULL;
+    }
+    pb->seekable = AVIO_SEEKABLE_NORMAL;
+    return pb;
+}
+
+void file_io_close(AVIOContext **pb) {
+    FileIO *f;
+
+    if (!*pb)
+        return;
+    f = (FileIO *)(*pb)->opaque;
+    munmap(f->map, f->size);
+    close(f->fd);
+    av_free(f);
+    av_freep(&(*pb)->buffer);
+    av_freep(pb);
+}
@@ -0,0 +1,25 @@
+//fileio.h
+//AVIOContext for local files that reads from a memory mapping and keeps
+//the kernel reading ahead of the demuxer.
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <libavformat/avio.h>
+
+#define FILE_IO_BUFFER_SIZE (256 * 1024)        //AVIOContext buffer
+#define FILE_IO_READAHEAD   (8 * 1024 * 1024)   //hinted ahead of the reader
+
+/*
+ * Open 'filename' for reading through a memory mapping. Returns NULL if
+ * it is not a regular local file or cannot be mapped, in which case the
+ * caller should let libavformat open it the default way.
+ * Attach the result to an AVFormatContext as its pb, with
+ * AVFMT_FLAG_CUSTOM_IO set, before calling avformat_open_input().
+ */
+AVIOContext *file_io_open(const char *filename);
+
+//free a context from file_io_open(), avformat_close_input() does not
+void file_io_close(AVIOContext **pb);
+
+#endif
@@ -0,0 +1,578 @@
+//framehash.c
+//The calling thread demuxes and decodes and hands every frame, by
+//reference, to a ring of jobs. The workers take the oldest job nobody
+//has started, hash it and drop the reference, so the decoder gets its
+//buffer back as soon as the hash is done. Finished jobs are written out
+//by the calling thread strictly in decoding order, whichever worker was
+//fastest. It only waits when the ring is full, the time spent there is
+//what hashing costs on top of plain decoding.
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "framehash.h"
+#include "framepool.h"
+
+#define NB_STREAMS  2   //the video, the audio
+
+typedef struct HashJob {
+    AVFrame     *frame;
+    int         stream;     //index into FrameHash.st
+    int64_t     pts, duration;
+    int         size;       //-1 for a format that cannot be hashed
+    char        hash[33];
+    int         done;
+}HashJob;
+
+typedef struct RefFrame {
+    int         size;
+    char        hash[33];
+}RefFrame;
+
+typedef struct ReportStream {
+    int             index;      //in the input, -1 when there is none
+    int             id;         //stream# in the report
+    AVCodecContext  *ctx;
+    AVRational      tb;         //of the report
+    int64_t         next_pts;   //for frames without a timestamp
+    int             nb_frames;  //written out
+    RefFrame        *ref;
+    int             nb_ref;
+}ReportStream;
+
+typedef struct HashWorker {
+    struct FrameHash    *fh;
+    pthread_t           thread;
+    struct AVMD5        *md5;
+    uint8_t             *buf;   //interleaved audio
+    unsigned int        buf_size;
+}HashWorker;
+
+typedef struct FrameHash {
+    HashWorker      workers[FRAME_HASH_MAX_THREADS];
+    int             nb_threads;
+    int             depth;      //jobs in the ring at most
+
+    //the ring, all under mutex. [written, queued) is in use, jobs from
+    //'started' on wait for a worker
+    HashJob         jobs[FRAME_HASH_QUEUE];
+    uint64_t        written, started, queued;
+    int             quit;
+    pthread_mutex_t mutex;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+
+    ReportStream    st[NB_STREAMS];
+    AVFormatContext *pFormatCtx;
+    FILE            *out;
+    int             have_ref;
+    int             mismatches;
+    int             errors;     //frames that could not be hashed
+    int64_t         stall;      //the decoder waited for the workers
+}FrameHash;
+
+//the rawvideo packet: every plane's rows without padding, then the palette
+static int hash_video(HashWorker *w, const AVFrame *frame) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int i, p, y, planes = 0, size = 0;
+
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        return -1;
+    for (i = 0; i < desc->nb_components; i++)
+        planes = FFMAX(planes, desc->comp[i].plane + 1);
+
+    for (p = 0; p < planes; p++) {
+        int chroma = (p == 1 || p == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+        int h = chroma ? -((-frame->height) >> desc->log2_chroma_h) : frame->height;
+        int bytes = av_image_get_linesize(frame->format, frame->width, p);
+
+        if (bytes < 0)
+            return -1;
+        for (y = 0; y < h; y++)
+            av_md5_update(w->md5, frame->data[p] + y * frame->linesize[p], bytes);
+        size += bytes * h;
+    }
+    if ((desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)) && frame->data[1]) {
+        av_md5_update(w->md5, frame->data[1], 256 * 4);
+        size += 256 * 4;
+    }
+    return size;
+}
+
+//packed samples, planar formats are interleaved into the worker's buffer
+static int hash_audio(HashWorker *w, const AVFrame *frame) {
+    int channels = av_frame_get_channels(frame);
+    int bps = av_get_bytes_per_sample(frame->format);
+    int size = frame->nb_samples * channels * bps;
+    int c, i;
+
+    if (bps <= 0 || channels <= 0)
+        return -1;
+    if (!av_sample_fmt_is_planar(frame->format) || channels == 1) {
+        av_md5_update(w->md5, frame->extended_data[0], size);
+        return size;
+    }
+
+    av_fast_malloc(&w->buf, &w->buf_size, size);
+    if (!w->buf)
+        return -1;
+    for (c = 0; c < channels; c++) {
+        const uint8_t *src = frame->extended_data[c];
+
+        if (bps == 4) {
+            uint32_t *dst = (uint32_t *)w->buf + c;
+
+            for (i = 0; i < frame->nb_samples; i++)
+                dst[i * channels] = ((const uint32_t *)src)[i];
+        } else if (bps == 2) {
+            uint16_t *dst = (uint16_t *)w->buf + c;
+
+            for (i = 0; i < frame->nb_samples; i++)
+                dst[i * channels] = ((const uint16_t *)src)[i];
+        } else {
+            for (i = 0; i < frame->nb_samples; i++)
+                memcpy(w->buf + (i * channels + c) * bps, src + i * bps, bps);
+        }
+    }
+    av_md5_update(w->md5, w->buf, size);
+    return size;
+}
+
+static void hash_job(HashWorker *w, HashJob *job) {
+    uint8_t digest[16];
+    int i;
+
+    av_md5_init(w->md5);
+    if (job->stream == 0)
+        job->size = hash_video(w, job->frame);
+    else
+        job->size = hash_audio(w, job->frame);
+    av_md5_final(w->md5, digest);
+    for (i = 0; i < 16; i++)
+        snprintf(job->hash + 2 * i, 3, "%02x", digest[i]);
+}
+
+static void *hash_worker(void *arg) {
+    HashWorker *w = (HashWorker *)arg;
+    FrameHash *fh = w->fh;
+    HashJob *job;
+
+    for (;;) {
+        pthread_mutex_lock(&fh->mutex);
+        while (!fh->quit && fh->started == fh->queued)
+            pthread_cond_wait(&fh->work_cond, &fh->mutex);
+        if (fh->started == fh->queued) {
+            pthread_mutex_unlock(&fh->mutex);
+            return NULL;
+        }
+        job = &fh->jobs[fh->started++ % FRAME_HASH_QUEUE];
+        pthread_mutex_unlock(&fh->mutex);
+
+        hash_job(w, job);
+        av_frame_unref(job->frame);
+
+        pthread_mutex_lock(&fh->mutex);
+        job->done = 1;
+        pthread_cond_signal(&fh->done_cond);
+        pthread_mutex_unlock(&fh->mutex);
+    }
+}
+
+static void write_job(FrameHash *fh, const HashJob *job) {
+    ReportStream *rs = &fh->st[job->stream];
+    int n = rs->nb_frames++;
+
+    if (job->size < 0) {
+        if (fh->errors++ == 0)
+            fprintf(stderr, "stream %d frame %d: cannot hash this format\n", rs->id, n);
+        return;
+    }
+    if (fh->out)
+        fprintf(fh->out, "%d, %10"PRId64", %10"PRId64", %8"PRId64", %8d, %s\n", rs->id,
+                job->pts, job->pts, job->duration, job->size, job->hash);
+
+    //frames past the end of the reference are counted at the end
+    if (fh->have_ref && n < rs->nb_ref &&
+        (rs->ref[n].size != job->size || strcmp(rs->ref[n].hash, job->hash))) {
+        if (fh->mismatches++ < FRAME_HASH_MAX_SHOWN)
+            fprintf(stderr, "stream %d frame %d pts %"PRId64": %8d %s, reference %8d %s\n",
+                    rs->id, n, job->pts, job->size, job->hash, rs->ref[n].size, rs->ref[n].hash);
+    }
+}
+
+//write out the finished jobs at the front, waiting until at most
+//'max_pending' are left in the ring
+static void write_jobs(FrameHash *fh, int max_pending) {
+    pthread_mutex_lock(&fh->mutex);
+    for (;;) {
+        HashJob *job = &fh->jobs[fh->written % FRAME_HASH_QUEUE];
+
+        if (fh->written < fh->queued && job->done) {
+            HashJob done = *job;
+
+            //the slot is only reused by this thread, after we are back
+            fh->written++;
+            pthread_mutex_unlock(&fh->mutex);
+            write_job(fh, &done);
+            pthread_mutex_lock(&fh->mutex);
+        } else if (fh->queued - fh->written > max_pending) {
+            int64_t start = av_gettime();
+
+            pthread_cond_wait(&fh->done_cond, &fh->mutex);
+            fh->stall += av_gettime() - start;
+        } else {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fh->mutex);
+}
+
+//takes over the frame's reference
+static void queue_frame(FrameHash *fh, int s, AVFrame *frame) {
+    ReportStream *rs = &fh->st[s];
+    AVStream *st = fh->pFormatCtx->streams[rs->index];
+    int64_t ts = av_frame_get_best_effort_timestamp(frame);
+    int64_t duration;
+    HashJob *job;
+
+    if (s == 0)
+        duration = FFMAX(av_rescale_q(av_frame_get_pkt_duration(frame), st->time_base, rs->tb), 1);
+    else
+        duration = frame->nb_samples;
+
+    write_jobs(fh, fh->depth - 1);
+
+    //only this thread adds jobs, the slot stays free without the lock
+    job = &fh->jobs[fh->queued % FRAME_HASH_QUEUE];
+    job->stream = s;
+    job->pts = ts != AV_NOPTS_VALUE ? av_rescale_q(ts, st->time_base, rs->tb) : rs->next_pts;
+    job->duration = duration;
+    job->done = 0;
+    av_frame_move_ref(job->frame, frame);
+    rs->next_pts = job->pts + duration;
+
+    pthread_mutex_lock(&fh->mutex);
+    fh->queued++;
+    pthread_cond_signal(&fh->work_cond);
+    pthread_mutex_unlock(&fh->mutex);
+}
+
+//returns the number of frames the decoder gave back
+static int decode(FrameHash *fh, int s, AVPacket *pkt, AVFrame *frame) {
+    ReportStream *rs = &fh->st[s];
+    AVPacket p = *pkt;
+    int got, ret, n = 0;
+
+    do {
+        got = 0;
+        if (s == 0) {
+            ret = avcodec_decode_video2(rs->ctx, frame, &got, &p);
+            if (ret >= 0)
+                ret = p.size;
+        } else {
+            ret = avcodec_decode_audio4(rs->ctx, frame, &got, &p);
+        }
+        if (got) {
+            queue_frame(fh, s, frame);
+            n++;
+        }
+        //a damaged packet, drop the rest of it
+        if (ret < 0 || (ret == 0 && !got))
+            break;
+        p.data += ret;
+        p.size -= ret;
+    } while (p.size > 0);
+    return n;
+}
+
+static int open_stream(FrameHash *fh, int s, FramePool *pool, int decode_threads) {
+    ReportStream *rs = &fh->st[s];
+    AVStream *st = fh->pFormatCtx->streams[rs->index];
+    AVCodec *pCodec;
+
+    pCodec = avcodec_find_decoder(st->codec->codec_id);
+    if (!pCodec) {
+        fprintf(stderr, "Unsupported codec!\n");
+        return -1;
+    }
+    rs->ctx = avcodec_alloc_context3(pCodec);
+    if (!rs->ctx || avcodec_copy_context(rs->ctx, st->codec) != 0)
+        return -1;
+    //the workers hold on to the frames
+    rs->ctx->refcounted_frames = 1;
+    rs->ctx->thread_count = decode_threads;
+    if (s == 0)
+        frame_pool_attach(pool, rs->ctx);
+    if (avcodec_open2(rs->ctx, pCodec, NULL) < 0)
+        return -1;
+
+    //the time bases of ffmpeg's rawvideo and pcm encoders
+    if (s == 0) {
+        AVRational fr = av_guess_frame_rate(fh->pFormatCtx, st, NULL);
+
+        rs->tb = fr.num > 0 && fr.den > 0 ? av_inv_q(fr) : st->time_base;
+    } else {
+        if (rs->ctx->sample_rate <= 0)
+            return -1;
+        rs->tb = (AVRational){ 1, rs->ctx->sample_rate };
+    }
+    return 0;
+}
+
+static int load_reference(FrameHash *fh, const char *filename) {
+    FILE *f = fopen(filename, "r");
+    char line[1024];
+
+    if (!f) {
+        fprintf(stderr, "%s: cannot open the reference\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        ReportStream *rs = NULL;
+        RefFrame r;
+        int64_t dts, pts, duration;
+        int id, i;
+
+        if (line[0] == '#' ||
+            sscanf(line, "%d, %"SCNd64", %"SCNd64", %"SCNd64", %d, %32s",
+                   &id, &dts, &pts, &duration, &r.size, r.hash) != 6)
+            continue;
+        for (i = 0; i < NB_STREAMS; i++) {
+            if (fh->st[i].index >= 0 && fh->st[i].id == id)
+                rs = &fh->st[i];
+        }
+        if (!rs)
+            continue;   //a stream we do not decode
+
+        //double on every power of two
+        if (!(rs->nb_ref & (rs->nb_ref - 1)) &&
+            av_reallocp_array(&rs->ref, FFMAX(rs->nb_ref * 2, 256), sizeof(RefFrame)) < 0) {
+            rs->nb_ref = 0;
+            fclose(f);
+            return -1;
+        }
+        rs->ref[rs->nb_ref++] = r;
+    }
+    fclose(f);
+    fh->have_ref = 1;
+    return 0;
+}
+
+static void write_header(FrameHash *fh) {
+    int s;
+
+    fprintf(fh->out, "#format: frame checksums\n#version: 2\n#hash: MD5\n");
+    for (s = 0; s < NB_STREAMS; s++) {
+        ReportStream *rs = &fh->st[s];
+
+        if (rs->index < 0)
+            continue;
+        fprintf(fh->out, "#tb %d: %d/%d\n", rs->id, rs->tb.num, rs->tb.den);
+        fprintf(fh->out, "#media_type %d: %s\n", rs->id, s == 0 ? "video" : "audio");
+        if (s == 0) {
+            AVRational sar = rs->ctx->sample_aspect_ratio;
+
+            fprintf(fh->out, "#codec_id %d: rawvideo\n", rs->id);
+            fprintf(fh->out, "#dimensions %d: %dx%d\n", rs->id, rs->ctx->width, rs->ctx->height);
+            //unknown is 0/1 to ffmpeg
+            fprintf(fh->out, "#sar %d: %d/%d\n", rs->id, sar.num, sar.num ? sar.den : 1);
+        } else {
+            enum AVSampleFormat fmt = av_get_packed_sample_fmt(rs->ctx->sample_fmt);
+            char layout[128];
+
+            av_get_channel_layout_string(layout, sizeof(layout), rs->ctx->channels,
+                                         rs->ctx->channel_layout);
+            fprintf(fh->out, "#codec_id %d: %s\n", rs->id,
+                    avcodec_get_name(av_get_pcm_codec(fmt, -1)));
+            fprintf(fh->out, "#sample_rate %d: %d\n", rs->id, rs->ctx->sample_rate);
+            fprintf(fh->out, "#channel_layout_name %d: %s\n", rs->id, layout);
+        }
+    }
+    fprintf(fh->out, "#stream#, dts,        pts, duration,     size, hash\n");
+}
+
+static int start_workers(FrameHash *fh, int nb_threads) {
+    int i;
+
+    pthread_mutex_init(&fh->mutex, NULL);
+    pthread_cond_init(&fh->work_cond, NULL);
+    pthread_cond_init(&fh->done_cond, NULL);
+    for (i = 0; i < FRAME_HASH_QUEUE; i++) {
+        fh->jobs[i].frame = av_frame_alloc();
+        if (!fh->jobs[i].frame)
+            return -1;
+    }
+
+    if (nb_threads <= 0)
+        nb_threads = av_cpu_count();
+    nb_threads = av_clip(nb_threads, 1, FRAME_HASH_MAX_THREADS);
+    fh->depth = FFMIN(FRAME_HASH_QUEUE, 4 * nb_threads + 4);
+
+    //fewer workers than asked for only makes it slower
+    for (i = 0; i < nb_threads; i++) {
+        HashWorker *w = &fh->workers[fh->nb_threads];
+
+        w->fh = fh;
+        w->md5 = av_md5_alloc();
+        if (!w->md5 || pthread_create(&w->thread, NULL, hash_worker, w) != 0) {
+            av_freep(&w->md5);
+            break;
+        }
+        fh->nb_threads++;
+    }
+    return fh->nb_threads > 0 ? 0 : -1;
+}
+
+static void stop_workers(FrameHash *fh) {
+    int i;
+
+    pthread_mutex_lock(&fh->mutex);
+    fh->quit = 1;
+    pthread_cond_broadcast(&fh->work_cond);
+    pthread_mutex_unlock(&fh->mutex);
+    for (i = 0; i < fh->nb_threads; i++) {
+        pthread_join(fh->workers[i].thread, NULL);
+        av_freep(&fh->workers[i].md5);
+        av_freep(&fh->workers[i].buf);
+    }
+    pthread_cond_destroy(&fh->done_cond);
+    pthread_cond_destroy(&fh->work_cond);
+    pthread_mutex_destroy(&fh->mutex);
+}
+
+int frame_hash(const char *filename, const char *out, const char *ref,
+               int decode_threads, int hash_threads) {
+    FrameHash *fh;
+    FramePool *pool = NULL;
+    AVFrame *frame = NULL;
+    AVPacket packet;
+    int64_t start;
+    int i, s, running = 0, ret = -1;
+
+    fh = av_mallocz(sizeof(FrameHash));
+    if (!fh)
+        return -1;
+    fh->st[0].index = fh->st[1].index = -1;
+
+    if (avformat_open_input(&fh->pFormatCtx, filename, NULL, NULL) != 0)
+        goto end;
+    if (avformat_find_stream_info(fh->pFormatCtx, NULL) < 0)
+        goto end;
+
+    //the first video and the first audio stream, numbered in that order
+    for (i = 0; i < fh->pFormatCtx->nb_streams; i++) {
+        enum AVMediaType type = fh->pFormatCtx->streams[i]->codec->codec_type;
+
+        if (type == AVMEDIA_TYPE_VIDEO && fh->st[0].index < 0)
+            fh->st[0].index = i;
+        else if (type == AVMEDIA_TYPE_AUDIO && fh->st[1].index < 0)
+            fh->st[1].index = i;
+    }
+    if (fh->st[0].index < 0 && fh->st[1].index < 0)
+        goto end;
+    fh->st[1].id = fh->st[0].index >= 0;
+
+    pool = frame_pool_alloc();
+    for (s = 0; s < NB_STREAMS; s++) {
+        if (fh->st[s].index >= 0 && open_stream(fh, s, pool, decode_threads) < 0)
+            goto end;
+    }
+
+    if (ref && load_reference(fh, ref) < 0)
+        goto end;
+    if (out) {
+        fh->out = strcmp(out, "-") ? fopen(out, "w") : stdout;
+        if (!fh->out) {
+            fprintf(stderr, "%s: cannot create the report\n", out);
+            goto end;
+        }
+        write_header(fh);
+    }
+
+    running = 1;
+    if (start_workers(fh, hash_threads) < 0)
+        goto end;
+    frame = av_frame_alloc();
+    if (!frame)
+        goto end;
+
+    start = av_gettime();
+    while (av_read_frame(fh->pFormatCtx, &packet) >= 0) {
+        for (s = 0; s < NB_STREAMS; s++) {
+            if (packet.stream_index == fh->st[s].index)
+                decode(fh, s, &packet, frame);
+        }
+        av_free_packet(&packet);
+    }
+    //frames the decoders still hold back
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    for (s = 0; s < NB_STREAMS; s++) {
+        if (fh->st[s].index >= 0)
+            while (decode(fh, s, &packet, frame) > 0)
+                ;
+    }
+    write_jobs(fh, 0);
+
+    //frames missing at the end, on either side, count as mismatches
+    for (s = 0; s < NB_STREAMS && fh->have_ref; s++) {
+        ReportStream *rs = &fh->st[s];
+
+        if (rs->index >= 0 && rs->nb_frames != rs->nb_ref) {
+            fprintf(stderr, "stream %d: %d frames, the reference has %d\n",
+                    rs->id, rs->nb_frames, rs->nb_ref);
+            fh->mismatches += abs(rs->nb_frames - rs->nb_ref);
+        }
+    }
+
+    {
+        double elapsed = (av_gettime() - start) / 1000000.0;
+        int nb_video = fh->st[0].nb_frames;
+
+        fprintf(stderr, "%s: %d video, %d audio frames in %.2f s (%.1f fps), "
+                "%d hashing threads, decoding waited %.2f s for them\n", filename,
+                nb_video, fh->st[1].nb_frames, elapsed, elapsed > 0 ? nb_video / elapsed : 0.0,
+                fh->nb_threads, fh->stall / 1000000.0);
+        if (fh->have_ref && fh->mismatches)
+            fprintf(stderr, "%s: DIFFERS from the reference, %d frames\n", filename,
+                    fh->mismatches);
+        else if (fh->have_ref)
+            fprintf(stderr, "%s: matches the reference\n", filename);
+    }
+    ret = fh->mismatches || fh->errors ? -1 : 0;
+
+end:
+    if (running)
+        stop_workers(fh);
+    for (i = 0; i < FRAME_HASH_QUEUE; i++)
+        av_frame_free(&fh->jobs[i].frame);
+    av_frame_free(&frame);
+    if (fh->out && fh->out != stdout)
+        fclose(fh->out);
+    for (s = 0; s < NB_STREAMS; s++) {
+        avcodec_free_context(&fh->st[s].ctx);
+        av_freep(&fh->st[s].ref);
+    }
+    //the buffers are back, the decoders are gone
+    frame_pool_print_stats(pool, filename);
+    frame_pool_free(&pool);
+    avformat_close_input(&fh->pFormatCtx);
+    av_free(fh);
+    return ret;
+}
@@ -0,0 +1,33 @@
+//framehash.h
+//Per frame MD5 of the decoded output for ingest QC, written in the
+//format of ffmpeg's framemd5 muxer and optionally checked against a
+//reference report. The hashing runs on a pool of threads while the
+//calling thread keeps decoding.
+
+#ifndef FRAMEHASH_H
+#define FRAMEHASH_H
+
+#define FRAME_HASH_MAX_THREADS  16
+#define FRAME_HASH_QUEUE        64  //frames decoded ahead of the report, at most
+#define FRAME_HASH_MAX_SHOWN    10  //mismatching frames printed, the rest counted
+
+/*
+ * Decode the first video and the first audio stream of 'filename' and
+ * hash every frame, video as the rawvideo packet of its pixel format
+ * would hold it, audio as packed samples of its sample format. Stream 0
+ * of the report is the video, 1 the audio, with the time bases ffmpeg
+ * gives them, 1/frame rate and 1/sample rate. A reference made with
+ * "ffmpeg -i in -vsync passthrough -c:a pcm_<fmt> -f framemd5 out", the
+ * pcm codec matching the decoder's sample format, has the same hashes.
+ *
+ * The report goes to 'out', "-" for stdout, or nowhere when NULL. With
+ * 'ref' set, the sizes and hashes of each stream are compared frame by
+ * frame with that report, the timestamps are not. 'decode_threads' is
+ * the decoders' thread_count, 0 lets libavcodec choose. 'hash_threads'
+ * <= 0 uses one per cpu. Returns 0 on success, -1 if the file cannot be
+ * decoded or any frame differs from the reference.
+ */
+int frame_hash(const char *filename, const char *out, const char *ref,
+               int decode_threads, int hash_threads);
+
+#endif
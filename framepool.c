@@ -0,0 +1,263 @@
+//framepool.c
+//Every buffer carries a small header in front of its data that points
+//back at the pool, so a release from any thread finds its way home.
+//Sizes are rounded up to classes (within 1/8 of a power of two) so a
+//decoder asking for slightly different sizes still hits.
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "framepool.h"
+
+typedef struct PoolBuffer {
+    struct FramePool    *pool;
+    struct PoolBuffer   *next;  //free list
+    int                 size;   //size class, the data that follows
+}PoolBuffer;
+
+typedef struct SizeClass {
+    int         size;
+    PoolBuffer  *free;
+    int         nb_free;
+}SizeClass;
+
+struct FramePool {
+    SizeClass       classes[FRAME_POOL_CLASSES];
+    int             nb_classes;
+    FramePoolStats  stats;
+    int             refs;       //the owner and every buffer in use
+    int             owner_gone; //frame_pool_free() ran, idle buffers are not kept
+    pthread_mutex_t mutex;
+};
+
+//the header and enough room after it to align the data, whatever
+//alignment av_malloc() gives
+#define HEADER_SIZE ((int)sizeof(PoolBuffer) + FRAME_POOL_ALIGN - 1)
+
+static uint8_t *buffer_data(PoolBuffer *b) {
+    return (uint8_t *)FFALIGN((uintptr_t)(b + 1), FRAME_POOL_ALIGN);
+}
+
+static int size_class(int size) {
+    int step = 4096;
+
+    while (step * 8 < size)
+        step *= 2;
+    return FFALIGN(size, step);
+}
+
+//drop idle buffers of class 'c', with the lock held
+static void class_drain(FramePool *pool, SizeClass *c) {
+    PoolBuffer *b;
+
+    while ((b = c->free)) {
+        c->free = b->next;
+        pool->stats.idle--;
+        pool->stats.idle_bytes -= c->size;
+        av_free(b);
+    }
+    c->nb_free = 0;
+}
+
+static void pool_destroy(FramePool *pool) {
+    int i;
+
+    //nothing can be parked once the owner is gone, but never leak
+    for (i = 0; i < pool->nb_classes; i++)
+        class_drain(pool, &pool->classes[i]);
+    pthread_mutex_destroy(&pool->mutex);
+    av_free(pool);
+}
+
+//the class for 'size', made on demand. NULL if the table is full of
+//classes that still have idle buffers.
+static SizeClass *find_class(FramePool *pool, int size) {
+    SizeClass *c;
+    int i;
+
+    for (i = 0; i < pool->nb_classes; i++)
+        if (pool->classes[i].size == size)
+            return &pool->classes[i];
+    if (pool->nb_classes < FRAME_POOL_CLASSES) {
+        c = &pool->classes[pool->nb_classes++];
+    } else {
+        //take over an empty class, its buffers in use are freed on release
+        for (i = 0; i < pool->nb_classes && pool->classes[i].nb_free; i++)
+            ;
+        if (i == pool->nb_classes)
+            return NULL;
+        c = &pool->classes[i];
+    }
+    c->size = size;
+    c->free = NULL;
+    c->nb_free = 0;
+    return c;
+}
+
+static void pool_release(void *opaque, uint8_t *data) {
+    PoolBuffer *b = (PoolBuffer *)opaque;
+    FramePool *pool = b->pool;
+    SizeClass *c = NULL;
+    int i, refs;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (i = 0; i < pool->nb_classes; i++)
+        if (pool->classes[i].size == b->size)
+            c = &pool->classes[i];
+    //keep the buffer only for an owner that can still ask for it
+    if (c && c->nb_free < FRAME_POOL_MAX_FREE && !pool->owner_gone) {
+        b->next = c->free;
+        c->free = b;
+        c->nb_free++;
+        pool->stats.idle++;
+        pool->stats.idle_bytes += b->size;
+        b = NULL;
+    }
+    pool->stats.in_use--;
+    refs = --pool->refs;
+    pthread_mutex_unlock(&pool->mutex);
+
+    av_free(b);
+    if (refs == 0)
+        pool_destroy(pool);
+}
+
+FramePool *frame_pool_alloc(void) {
+    FramePool *pool = av_mallocz(sizeof(FramePool));
+
+    if (!pool)
+        return NULL;
+    pool->refs = 1;
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+}
+
+void frame_pool_free(FramePool **pool) {
+    FramePool *p = *pool;
+    int i, refs;
+
+    if (!p)
+        return;
+    *pool = NULL;
+    pthread_mutex_lock(&p->mutex);
+    for (i = 0; i < p->nb_classes; i++)
+        class_drain(p, &p->classes[i]);
+    p->owner_gone = 1;
+    refs = --p->refs;
+    pthread_mutex_unlock(&p->mutex);
+    if (refs == 0)
+        pool_destroy(p);
+}
+
+AVBufferRef *frame_pool_get(FramePool *pool, int size) {
+    AVBufferRef *ref;
+    PoolBuffer *b = NULL;
+    SizeClass *c;
+    int csize = size_class(size);
+
+    pthread_mutex_lock(&pool->mutex);
+    c = find_class(pool, csize);
+    if (c && c->free) {
+        b = c->free;
+        c->free = b->next;
+        c->nb_free--;
+        pool->stats.idle--;
+        pool->stats.idle_bytes -= csize;
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    pool->stats.in_use++;
+    pool->refs++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!b) {
+        b = av_malloc(HEADER_SIZE + csize);
+        if (b) {
+            b->pool = pool;
+            b->size = csize;
+        }
+    }
+    ref = b ? av_buffer_create(buffer_data(b), size, pool_release, b, 0) : NULL;
+    if (!ref) {
+        //hand the reference back through the normal path
+        if (b)
+            pool_release(b, NULL);
+        else {
+            pthread_mutex_lock(&pool->mutex);
+            pool->stats.in_use--;
+            pool->refs--;
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+    return ref;
+}
+
+void frame_pool_attach(FramePool *pool, AVCodecContext *ctx) {
+    if (!pool)
+        return;
+    ctx->opaque = pool;
+    ctx->get_buffer2 = frame_pool_get_buffer2;
+    //frame_pool_get() may be called from any decoding thread
+    ctx->thread_safe_callbacks = 1;
+}
+
+int frame_pool_get_buffer2(AVCodecContext *ctx, AVFrame *frame, int flags) {
+    FramePool *pool = (FramePool *)ctx->opaque;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int linesizes[4];
+    uint8_t *data[4];
+    int w = frame->width, h = frame->height;
+    int i, size;
+
+    if (!pool || ctx->codec_type != AVMEDIA_TYPE_VIDEO ||
+        !(ctx->codec->capabilities & CODEC_CAP_DR1))
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    //the decoder may write up to its macroblock/alignment padding
+    avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+    if (av_image_fill_linesizes(linesizes, frame->format, w) < 0)
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    for (i = 0; i < 4; i++)
+        linesizes[i] = FFALIGN(linesizes[i], FRAME_POOL_ALIGN);
+    size = av_image_fill_pointers(data, frame->format, h, NULL, linesizes);
+    if (size < 0)
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    //all planes in one buffer, plus the overread some SIMD code does
+    frame->buf[0] = frame_pool_get(pool, size + 16);
+    if (!frame->buf[0])
+        return AVERROR(ENOMEM);
+    av_image_fill_pointers(frame->data, frame->format, h, frame->buf[0]->data, linesizes);
+    for (i = 0; i < 4; i++)
+        frame->linesize[i] = linesizes[i];
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+void frame_pool_get_stats(FramePool *pool, FramePoolStats *stats) {
+    pthread_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void frame_pool_print_stats(FramePool *pool, const char *name) {
+    FramePoolStats st;
+    uint64_t total;
+
+    if (!pool)
+        return;
+    frame_pool_get_stats(pool, &st);
+    total = st.hits + st.misses;
+    fprintf(stderr, "%s: frame pool %llu hits, %llu misses (%.1f%% hit), "
+            "%d in use, %d idle (%lld KiB)\n", name,
+            (unsigned long long)st.hits, (unsigned long long)st.misses,
+            total ? 100.0 * st.hits / total : 0.0,
+            st.in_use, st.idle, (long long)(st.idle_bytes / 1024));
+}
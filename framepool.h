@@ -0,0 +1,58 @@
+//framepool.h
+//Pool of aligned, refcounted frame buffers in size classes. Plugged in
+//as a decoder's get_buffer2, steady state decoding reuses the same few
+//buffers instead of allocating one per frame.
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+#include <stdint.h>
+
+#define FRAME_POOL_ALIGN    64  //buffer and linesize alignment
+#define FRAME_POOL_CLASSES  16  //distinct buffer sizes tracked
+#define FRAME_POOL_MAX_FREE 32  //idle buffers kept per size class
+
+typedef struct FramePoolStats {
+    uint64_t    hits;       //served from an idle buffer
+    uint64_t    misses;     //had to allocate
+    int         in_use;     //buffers handed out and not yet released
+    int         idle;       //buffers waiting in the pool
+    int64_t     idle_bytes;
+}FramePoolStats;
+
+typedef struct FramePool FramePool;
+
+FramePool *frame_pool_alloc(void);
+
+/*
+ * Drop the owner's reference. Buffers still held by frames stay valid,
+ * the pool itself goes away with the last of them.
+ */
+void frame_pool_free(FramePool **pool);
+
+/*
+ * A buffer of at least 'size' bytes, FRAME_POOL_ALIGN aligned. It goes
+ * back to the pool when its last reference is unreferenced, from any
+ * thread. Returns NULL when out of memory.
+ */
+AVBufferRef *frame_pool_get(FramePool *pool, int size);
+
+/*
+ * Make 'ctx' take its video frames from 'pool'. Call before
+ * avcodec_open2(); uses ctx->opaque. Decoders that cannot use custom
+ * buffers (no CODEC_CAP_DR1) and audio keep the default allocator.
+ */
+void frame_pool_attach(FramePool *pool, AVCodecContext *ctx);
+
+//the get_buffer2 callback installed by frame_pool_attach()
+int frame_pool_get_buffer2(AVCodecContext *ctx, AVFrame *frame, int flags);
+
+void frame_pool_get_stats(FramePool *pool, FramePoolStats *stats);
+
+//one line of hit/miss statistics on stderr
+void frame_pool_print_stats(FramePool *pool, const char *name);
+
+#endif
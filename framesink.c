@@ -0,0 +1,132 @@
+//framesink.c
+//The slot's picture is laid out by av_image_fill_arrays() with lines
+//aligned to SHM_RING_ALIGN, and its plane offsets and line sizes are
+//written into the slot, so a consumer needs no FFmpeg to find the
+//pixels. Conversion writes into the slot directly, a frame that
+//already matches is copied once, that copy is all the sink costs.
+
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "framesink.h"
+#include "shmring.h"
+#include "slicescale.h"
+
+struct FrameSink {
+    ShmRing             *ring;
+    SliceScale          *scaler;
+    int                 width, height;
+    enum AVPixelFormat  format;
+    FrameSinkStats      stats;      //__atomic, printed from other threads
+};
+
+FrameSink *frame_sink_alloc(const char *name, int width, int height,
+                            enum AVPixelFormat format, int nb_slots) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    FrameSink *s;
+    int size;
+
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || width <= 0 || height <= 0)
+        return NULL;
+    size = av_image_get_buffer_size(format, width, height, SHM_RING_ALIGN);
+    if (size < 0)
+        return NULL;
+
+    s = av_mallocz(sizeof(FrameSink));
+    if (!s)
+        return NULL;
+    s->width = width;
+    s->height = height;
+    s->format = format;
+    s->scaler = slice_scale_alloc(0);
+    s->ring = shm_ring_create(name, nb_slots > 0 ? nb_slots : FRAME_SINK_SLOTS, size);
+    if (!s->scaler || !s->ring) {
+        frame_sink_free(&s);
+        return NULL;
+    }
+    return s;
+}
+
+void frame_sink_free(FrameSink **s) {
+    if (!*s)
+        return;
+    shm_ring_close(&(*s)->ring);
+    slice_scale_free(&(*s)->scaler);
+    av_freep(s);
+}
+
+int frame_sink_write(FrameSink *s, const AVFrame *frame, double pts) {
+    const char *name = av_get_pix_fmt_name(s->format);
+    uint8_t *data, *dst[4];
+    int linesize[4];
+    ShmSlot *slot;
+    int i, convert;
+
+    //set up before taking a slot, a failure leaves the ring alone
+    convert = frame->width != s->width || frame->height != s->height ||
+              frame->format != s->format;
+    if (convert && slice_scale_config(s->scaler, frame->width, frame->height, frame->format,
+                                      s->width, s->height, s->format, SWS_BILINEAR) < 0) {
+        __atomic_add_fetch(&s->stats.failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    slot = shm_ring_begin(s->ring, &data);
+    if (!slot) {
+        __atomic_add_fetch(&s->stats.dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    av_image_fill_arrays(dst, linesize, data, s->format, s->width, s->height, SHM_RING_ALIGN);
+    if (convert) {
+        slice_scale(s->scaler, (uint8_t const *const *)frame->data, frame->linesize,
+                    dst, linesize);
+        __atomic_add_fetch(&s->stats.converted, 1, __ATOMIC_RELAXED);
+    } else {
+        av_image_copy(dst, linesize, (const uint8_t **)frame->data, frame->linesize,
+                      s->format, s->width, s->height);
+    }
+
+    slot->width = s->width;
+    slot->height = s->height;
+    slot->format = s->format;
+    snprintf(slot->format_name, sizeof(slot->format_name), "%s", name ? name : "");
+    slot->pts = llrint(pts * 1000000);
+    for (i = 0; i < SHM_RING_MAX_PLANES; i++) {
+        slot->linesize[i] = dst[i] ? linesize[i] : 0;
+        slot->offset[i] = dst[i] ? dst[i] - data : 0;
+    }
+    shm_ring_publish(s->ring, slot);
+    __atomic_add_fetch(&s->stats.published, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void frame_sink_close(FrameSink *s) {
+    if (s)
+        shm_ring_shutdown(s->ring);
+}
+
+void frame_sink_get_stats(FrameSink *s, FrameSinkStats *stats) {
+    stats->published = __atomic_load_n(&s->stats.published, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&s->stats.dropped, __ATOMIC_RELAXED);
+    stats->converted = __atomic_load_n(&s->stats.converted, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&s->stats.failed, __ATOMIC_RELAXED);
+}
+
+void frame_sink_print_stats(FrameSink *s, const char *name) {
+    FrameSinkStats stats;
+
+    if (!s)
+        return;
+    frame_sink_get_stats(s, &stats);
+    fprintf(stderr, "%s: frame sink %dx%d %s, %llu published, %llu dropped for held slots, "
+            "%llu converted, %llu could not be converted\n", name, s->width, s->height,
+            av_get_pix_fmt_name(s->format), (unsigned long long)stats.published,
+            (unsigned long long)stats.dropped, (unsigned long long)stats.converted,
+            (unsigned long long)stats.failed);
+}
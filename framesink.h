@@ -0,0 +1,55 @@
+//framesink.h
+//Decoded frames published to a shmring.c ring in shared memory, for an
+//analytics process on the same host to read in place instead of going
+//through pipes or image files. Every frame is converted to one size and
+//format on the way in, straight into its slot.
+
+#ifndef FRAMESINK_H
+#define FRAMESINK_H
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+#include <stdint.h>
+
+#define FRAME_SINK_SLOTS    8
+
+typedef struct FrameSinkStats {
+    uint64_t    published;
+    uint64_t    dropped;        //a consumer still held the slot
+    uint64_t    converted;      //went through the scaler, the rest was copied
+    uint64_t    failed;         //no conversion to the ring's format
+}FrameSinkStats;
+
+typedef struct FrameSink FrameSink;
+
+/*
+ * Create the ring "/name" for 'nb_slots' frames of 'width' x 'height'
+ * in 'format', <= 0 slots for FRAME_SINK_SLOTS. Hardware formats cannot
+ * be published. Returns NULL on failure.
+ */
+FrameSink *frame_sink_alloc(const char *name, int width, int height,
+                            enum AVPixelFormat format, int nb_slots);
+
+void frame_sink_free(FrameSink **s);
+
+/*
+ * Publish 'frame', 'pts' in seconds. A frame of the ring's size and
+ * format is copied, anything else is scaled. Never waits for consumers.
+ * Returns 1 if published, 0 if dropped, -1 if it cannot be converted.
+ * One thread at a time.
+ */
+int frame_sink_write(FrameSink *s, const AVFrame *frame, double pts);
+
+/*
+ * Tell the consumers no more frames come and remove the ring's name.
+ * Safe from another thread than frame_sink_write()'s.
+ */
+void frame_sink_close(FrameSink *s);
+
+void frame_sink_get_stats(FrameSink *s, FrameSinkStats *stats);
+
+//published, dropped and converted frames on stderr
+void frame_sink_print_stats(FrameSink *s, const char *name);
+
+#endif
@@ -0,0 +1,171 @@
+//gopcache.c
+//Frames are kept in a small array sorted by pts. Decoders output in
+//presentation order, so an add is nearly always an append, and the
+//array is short enough that eviction can scan it.
+
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+
+#include <string.h>
+#include <pthread.h>
+
+#include "gopcache.h"
+
+typedef struct CacheEntry {
+    AVFrame     *frame;
+    int64_t     pts;
+    int         gop;        //GOP counter at the time it was added
+    uint64_t    seq;        //add order, neighbours in pts are consecutive
+    uint64_t    last_use;
+    size_t      size;
+}CacheEntry;
+
+struct GopCache {
+    CacheEntry      entries[GOP_CACHE_MAX_FRAMES];
+    int             nb_entries;
+    int             gop;
+    uint64_t        seq;
+    uint64_t        clock;      //LRU tick
+    size_t          size, budget;
+    pthread_mutex_t mutex;
+};
+
+static size_t frame_size(const AVFrame *frame) {
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+        if (frame->buf[i])
+            size += frame->buf[i]->size;
+    return size;
+}
+
+static void remove_entry(GopCache *gc, int i) {
+    gc->size -= gc->entries[i].size;
+    av_frame_free(&gc->entries[i].frame);
+    memmove(&gc->entries[i], &gc->entries[i + 1],
+            (gc->nb_entries - i - 1) * sizeof(CacheEntry));
+    gc->nb_entries--;
+}
+
+//evict by LRU until 'need' more bytes and one more entry fit
+static void make_room(GopCache *gc, size_t need) {
+    while (gc->nb_entries > 0 &&
+           (gc->size + need > gc->budget || gc->nb_entries == GOP_CACHE_MAX_FRAMES)) {
+        int i, oldest = 0;
+
+        for (i = 1; i < gc->nb_entries; i++)
+            if (gc->entries[i].last_use < gc->entries[oldest].last_use)
+                oldest = i;
+        remove_entry(gc, oldest);
+    }
+}
+
+GopCache *gop_cache_alloc(size_t budget) {
+    GopCache *gc = av_mallocz(sizeof(GopCache));
+
+    if (!gc)
+        return NULL;
+    gc->budget = budget ? budget : GOP_CACHE_BUDGET;
+    pthread_mutex_init(&gc->mutex, NULL);
+    return gc;
+}
+
+void gop_cache_free(GopCache **gc) {
+    if (!*gc)
+        return;
+    gop_cache_clear(*gc);
+    pthread_mutex_destroy(&(*gc)->mutex);
+    av_freep(gc);
+}
+
+int gop_cache_add(GopCache *gc, const AVFrame *frame, int64_t pts) {
+    CacheEntry *e;
+    AVFrame *ref;
+    int i;
+
+    if (!gc)
+        return 0;
+    ref = av_frame_clone(frame);
+    if (!ref)
+        return -1;
+
+    pthread_mutex_lock(&gc->mutex);
+
+    //keep the current GOP and the previous one
+    if (frame->key_frame) {
+        gc->gop++;
+        for (i = gc->nb_entries - 1; i >= 0; i--)
+            if (gc->entries[i].gop < gc->gop - 1)
+                remove_entry(gc, i);
+    }
+
+    //the same pts again means the decoder restarted, keep the new one
+    for (i = 0; i < gc->nb_entries; i++)
+        if (gc->entries[i].pts == pts) {
+            remove_entry(gc, i);
+            break;
+        }
+
+    make_room(gc, frame_size(ref));
+
+    for (i = gc->nb_entries; i > 0 && gc->entries[i - 1].pts > pts; i--)
+        ;
+    memmove(&gc->entries[i + 1], &gc->entries[i],
+            (gc->nb_entries - i) * sizeof(CacheEntry));
+    e = &gc->entries[i];
+    e->frame = ref;
+    e->pts = pts;
+    e->gop = gc->gop;
+    e->seq = ++gc->seq;
+    e->last_use = ++gc->clock;
+    e->size = frame_size(ref);
+    gc->size += e->size;
+    gc->nb_entries++;
+
+    pthread_mutex_unlock(&gc->mutex);
+    return 0;
+}
+
+int gop_cache_get(GopCache *gc, int64_t pts, int dir, AVFrame *dst) {
+    int i, j = -1, ret = 0;
+
+    if (!gc)
+        return 0;
+    pthread_mutex_lock(&gc->mutex);
+
+    for (i = 0; i < gc->nb_entries && gc->entries[i].pts < pts; i++)
+        ;
+    if (dir == 0) {
+        if (i < gc->nb_entries && gc->entries[i].pts == pts)
+            j = i;
+    } else if (i < gc->nb_entries && gc->entries[i].pts == pts) {
+        //frames come out of the decoder in pts order, so a neighbour
+        //added right before or after is the true next/previous frame,
+        //anything else means the LRU or a seek left a hole
+        j = dir > 0 ? i + 1 : i - 1;
+        if (j < 0 || j >= gc->nb_entries ||
+            gc->entries[j].seq != (dir > 0 ? gc->entries[i].seq + 1
+                                           : gc->entries[i].seq - 1))
+            j = -1;
+    }
+
+    if (j >= 0) {
+        gc->entries[j].last_use = ++gc->clock;
+        ret = av_frame_ref(dst, gc->entries[j].frame) < 0 ? -1 : 1;
+    }
+
+    pthread_mutex_unlock(&gc->mutex);
+    return ret;
+}
+
+void gop_cache_clear(GopCache *gc) {
+    if (!gc)
+        return;
+    pthread_mutex_lock(&gc->mutex);
+    while (gc->nb_entries > 0)
+        remove_entry(gc, gc->nb_entries - 1);
+    //a new run must not chain onto the seq of the old one
+    gc->seq++;
+    pthread_mutex_unlock(&gc->mutex);
+}
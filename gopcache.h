@@ -0,0 +1,46 @@
+//gopcache.h
+//Bounded cache of decoded video frames keyed by pts. It keeps the GOP
+//being decoded and the one before it, so single frame steps and short
+//reverse playback do not seek and re-decode from the last keyframe.
+
+#ifndef GOPCACHE_H
+#define GOPCACHE_H
+
+#include <libavutil/frame.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GOP_CACHE_BUDGET     (256 * 1024 * 1024)    //bytes of frame data
+#define GOP_CACHE_MAX_FRAMES 1024
+
+//the functions below treat a NULL cache as an always empty one
+typedef struct GopCache GopCache;
+
+//'budget' bytes of frame data at most, 0 picks GOP_CACHE_BUDGET
+GopCache *gop_cache_alloc(size_t budget);
+void gop_cache_free(GopCache **gc);
+
+/*
+ * Add a reference to 'frame' under 'pts'. A keyframe starts a new GOP
+ * and drops everything older than the previous one. When the budget is
+ * exceeded the least recently used frames go first.
+ * Frames from a decoder with refcounted_frames set are shared, anything
+ * else is copied. Returns 0 on success, a negative value on error.
+ */
+int gop_cache_add(GopCache *gc, const AVFrame *frame, int64_t pts);
+
+/*
+ * Look up the frame at 'pts' (dir == 0), or step from it to the frame
+ * decoded right after it (dir > 0) or right before it (dir < 0), and
+ * reference that into 'dst'. Either way the frame at 'pts' itself must
+ * be cached, and a step only succeeds between frames that were decoded
+ * in one run, so a gap in the cache is a miss rather than a jump.
+ * Returns 1 on a hit, 0 on a miss, a negative value on error.
+ */
+int gop_cache_get(GopCache *gc, int64_t pts, int dir, AVFrame *dst);
+
+//forget every frame, e.g. after a seek
+void gop_cache_clear(GopCache *gc);
+
+#endif
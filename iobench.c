@@ -0,0 +1,96 @@
+//iobench.c
+//Cold cache demux benchmark of the input backends.
+
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fileio.h"
+#include "iobench.h"
+#include "uringio.h"
+
+enum {
+    BACKEND_DEFAULT,
+    BACKEND_MMAP,
+    BACKEND_URING,
+    NB_BACKENDS,
+};
+
+static const char *backend_names[NB_BACKENDS] = { "default", "mmap", "io_uring" };
+
+//evict the file's clean pages, so every run starts from the disk
+static void drop_cache(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static int run_backend(const char *filename, int backend) {
+    AVFormatContext *pFormatCtx = NULL;
+    AVIOContext *pb = NULL;
+    AVPacket packet;
+    int64_t start, bytes = 0, nb_packets = 0;
+    double elapsed;
+
+    drop_cache(filename);
+    start = av_gettime();
+
+    if (backend == BACKEND_MMAP)
+        pb = file_io_open(filename);
+    else if (backend == BACKEND_URING)
+        pb = uring_io_open(filename);
+    if (backend != BACKEND_DEFAULT && !pb) {
+        printf("%-8s  not available\n", backend_names[backend]);
+        return 0;
+    }
+    if (pb) {
+        pFormatCtx = avformat_alloc_context();
+        pFormatCtx->pb = pb;
+        pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0 ||
+        avformat_find_stream_info(pFormatCtx, NULL) < 0) {
+        avformat_close_input(&pFormatCtx);
+        if (backend == BACKEND_MMAP)
+            file_io_close(&pb);
+        else
+            uring_io_close(&pb);
+        return -1;
+    }
+
+    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+        bytes += packet.size;
+        nb_packets++;
+        av_free_packet(&packet);
+    }
+    elapsed = (av_gettime() - start) / 1000000.0;
+
+    printf("%-8s  %8.1f ms  %8.1f MB/s  %lld packets\n",
+           backend_names[backend], elapsed * 1000.0,
+           elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0.0,
+           (long long)nb_packets);
+
+    avformat_close_input(&pFormatCtx);
+    if (backend == BACKEND_MMAP)
+        file_io_close(&pb);
+    else if (backend == BACKEND_URING)
+        uring_io_close(&pb);
+    return 0;
+}
+
+int io_bench(const char *filename) {
+    int i;
+
+    printf("%s: cold cache demux\n", filename);
+    for (i = 0; i < NB_BACKENDS; i++) {
+        if (run_backend(filename, i) < 0)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+//iobench.h
+//Demux throughput of the input backends on a cold page cache.
+
+#ifndef IOBENCH_H
+#define IOBENCH_H
+
+/*
+ * Demux all of 'filename' once through each input backend (libavformat's
+ * file protocol, fileio.c and uringio.c), evicting the file from the
+ * page cache before every run, and print the time and throughput.
+ * Returns 0 on success, a negative value if the file cannot be read.
+ */
+int io_bench(const char *filename);
+
+#endif
@@ -0,0 +1,651 @@
+//loudness.c
+//The producer converts to float into a single producer single consumer
+//ring, the indices published with acquire/release atomics. The analysis
+//thread copies chunks out of it as double, one frame per
+//LOUDNESS_MAX_CHANNELS lanes, and runs everything on the channels side
+//by side: the two K-weighting biquads, the squares for loudness and
+//RMS, the sample peak and a 4x polyphase interpolator for the true
+//peak. The SIMD versions take two (SSE2) or four (AVX2) channels per
+//vector with the operations in the same order as the scalar code, so
+//all of them measure the same.
+//
+//Loudness is summed in 100 ms sub-blocks. The last 4 make the
+//momentary, 400 ms block, the last 30 the short-term one, and every
+//400 ms block is kept for the gated integrated loudness.
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "loudness.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+#define LANES       LOUDNESS_MAX_CHANNELS   //doubles per frame in the work buffer
+#define TP_PHASES   4
+#define TP_TAPS     12                      //per phase
+#define HISTORY     16                      //frames kept before a chunk, >= TP_TAPS - 1
+#define CHUNK       1024                    //frames analyzed at a time
+#define SHORT_TERM  30                      //sub-blocks, 3 s
+#define MOMENTARY   4                       //sub-blocks, 400 ms
+#define ABS_GATE    (-70.0)                 //LUFS
+#define REL_GATE    (-10.0)                 //LU
+
+typedef struct Filter {
+    double  b0, b1, b2, a1, a2;     //pre-filter, high shelf
+    double  r1, r2;                 //RLB high pass, b is 1 -2 1
+    double  h[TP_PHASES][TP_TAPS];  //interpolator, h[p][k] applies to x[n - k]
+}Filter;
+
+//per lane, the SIMD code loads and stores these in place
+typedef struct FilterState {
+    double  z[4][LANES];            //pre-filter z1 z2, RLB z1 z2
+    double  kw[LANES];              //K-weighted squares of the sub-block
+    double  sq[LANES];              //squares of the whole run
+    double  peak[LANES];
+    double  true_peak[LANES];
+}FilterState;
+
+typedef void (*AnalyzeFunc)(FilterState *s, const Filter *f, const double *x,
+                            int n, int lanes);
+
+struct LoudnessMeter {
+    int             sample_rate, channels;
+    double          weight[LANES];  //channel weights, 0 for the LFE
+
+    //the ring, interleaved float. 'written' only moves on the producer,
+    //'read' only on the analysis thread
+    float           *ring;
+    uint64_t        size;           //frames, a power of two
+    uint64_t        written, read;
+    uint64_t        dropped;        //atomic, for loudness_get_stats()
+
+    //analysis thread only
+    pthread_t       thread;
+    int             quit;           //atomic
+    AnalyzeFunc     analyze;
+    Filter          filter;
+    FilterState     state;
+    double          *work;          //HISTORY + CHUNK frames of LANES
+    int             step;           //frames in a sub-block
+    int             pos;            //frames into the current one
+    double          sub[SHORT_TERM];    //energies of the last sub-blocks
+    uint64_t        nb_sub;
+
+    //published for loudness_get_stats()
+    pthread_mutex_t mutex;
+    double          *blocks;        //energy of every 400 ms block
+    int             nb_blocks;
+    double          momentary, momentary_max;
+    double          short_term, short_term_max;
+    FilterState     snapshot;
+    uint64_t        frames;
+};
+
+static void analyze_scalar(FilterState *s, const Filter *f, const double *x,
+                           int n, int lanes) {
+    int c, i, p, k;
+
+    for (c = 0; c < lanes; c++) {
+        double z0 = s->z[0][c], z1 = s->z[1][c], z2 = s->z[2][c], z3 = s->z[3][c];
+        double kw = s->kw[c], sq = s->sq[c], pk = s->peak[c], tp = s->true_peak[c];
+
+        for (i = 0; i < n; i++) {
+            const double *xi = x + i * LANES + c;
+            double v = *xi, y1, y2;
+
+            y1 = f->b0 * v + z0;
+            z0 = (f->b1 * v - f->a1 * y1) + z1;
+            z1 = f->b2 * v - f->a2 * y1;
+            y2 = y1 + z2;
+            z2 = (-2.0 * y1 - f->r1 * y2) + z3;
+            z3 = y1 - f->r2 * y2;
+
+            kw = kw + y2 * y2;
+            sq = sq + v * v;
+            pk = fabs(v) > pk ? fabs(v) : pk;
+            for (p = 0; p < TP_PHASES; p++) {
+                double acc = f->h[p][0] * xi[0];
+
+                for (k = 1; k < TP_TAPS; k++)
+                    acc = acc + f->h[p][k] * xi[-k * LANES];
+                tp = fabs(acc) > tp ? fabs(acc) : tp;
+            }
+        }
+        s->z[0][c] = z0;
+        s->z[1][c] = z1;
+        s->z[2][c] = z2;
+        s->z[3][c] = z3;
+        s->kw[c] = kw;
+        s->sq[c] = sq;
+        s->peak[c] = pk;
+        s->true_peak[c] = tp;
+    }
+}
+
+#if HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void analyze_sse2(FilterState *s, const Filter *f, const double *x,
+                         int n, int lanes) {
+    const __m128d b0 = _mm_set1_pd(f->b0), b1 = _mm_set1_pd(f->b1), b2 = _mm_set1_pd(f->b2);
+    const __m128d a1 = _mm_set1_pd(f->a1), a2 = _mm_set1_pd(f->a2);
+    const __m128d r1 = _mm_set1_pd(f->r1), r2 = _mm_set1_pd(f->r2);
+    const __m128d m2 = _mm_set1_pd(-2.0);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    int c, i, p, k;
+
+    for (c = 0; c < lanes; c += 2) {
+        __m128d z0 = _mm_loadu_pd(s->z[0] + c), z1 = _mm_loadu_pd(s->z[1] + c);
+        __m128d z2 = _mm_loadu_pd(s->z[2] + c), z3 = _mm_loadu_pd(s->z[3] + c);
+        __m128d kw = _mm_loadu_pd(s->kw + c), sq = _mm_loadu_pd(s->sq + c);
+        __m128d pk = _mm_loadu_pd(s->peak + c), tp = _mm_loadu_pd(s->true_peak + c);
+
+        for (i = 0; i < n; i++) {
+            const double *xi = x + i * LANES + c;
+            __m128d v = _mm_loadu_pd(xi), y1, y2;
+
+            y1 = _mm_add_pd(_mm_mul_pd(b0, v), z0);
+            z0 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, v), _mm_mul_pd(a1, y1)), z1);
+            z1 = _mm_sub_pd(_mm_mul_pd(b2, v), _mm_mul_pd(a2, y1));
+            y2 = _mm_add_pd(y1, z2);
+            z2 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(m2, y1), _mm_mul_pd(r1, y2)), z3);
+            z3 = _mm_sub_pd(y1, _mm_mul_pd(r2, y2));
+
+            kw = _mm_add_pd(kw, _mm_mul_pd(y2, y2));
+            sq = _mm_add_pd(sq, _mm_mul_pd(v, v));
+            pk = _mm_max_pd(_mm_andnot_pd(sign, v), pk);
+            for (p = 0; p < TP_PHASES; p++) {
+                __m128d acc = _mm_mul_pd(_mm_set1_pd(f->h[p][0]), v);
+
+                for (k = 1; k < TP_TAPS; k++)
+                    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(f->h[p][k]),
+                                                     _mm_loadu_pd(xi - k * LANES)));
+                tp = _mm_max_pd(_mm_andnot_pd(sign, acc), tp);
+            }
+        }
+        _mm_storeu_pd(s->z[0] + c, z0);
+        _mm_storeu_pd(s->z[1] + c, z1);
+        _mm_storeu_pd(s->z[2] + c, z2);
+        _mm_storeu_pd(s->z[3] + c, z3);
+        _mm_storeu_pd(s->kw + c, kw);
+        _mm_storeu_pd(s->sq + c, sq);
+        _mm_storeu_pd(s->peak + c, pk);
+        _mm_storeu_pd(s->true_peak + c, tp);
+    }
+}
+
+__attribute__((target("avx2")))
+static void analyze_avx2(FilterState *s, const Filter *f, const double *x,
+                         int n, int lanes) {
+    const __m256d b0 = _mm256_set1_pd(f->b0), b1 = _mm256_set1_pd(f->b1), b2 = _mm256_set1_pd(f->b2);
+    const __m256d a1 = _mm256_set1_pd(f->a1), a2 = _mm256_set1_pd(f->a2);
+    const __m256d r1 = _mm256_set1_pd(f->r1), r2 = _mm256_set1_pd(f->r2);
+    const __m256d m2 = _mm256_set1_pd(-2.0);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    int c, i, p, k;
+
+    for (c = 0; c < lanes; c += 4) {
+        __m256d z0 = _mm256_loadu_pd(s->z[0] + c), z1 = _mm256_loadu_pd(s->z[1] + c);
+        __m256d z2 = _mm256_loadu_pd(s->z[2] + c), z3 = _mm256_loadu_pd(s->z[3] + c);
+        __m256d kw = _mm256_loadu_pd(s->kw + c), sq = _mm256_loadu_pd(s->sq + c);
+        __m256d pk = _mm256_loadu_pd(s->peak + c), tp = _mm256_loadu_pd(s->true_peak + c);
+
+        for (i = 0; i < n; i++) {
+            const double *xi = x + i * LANES + c;
+            __m256d v = _mm256_loadu_pd(xi), y1, y2;
+
+            y1 = _mm256_add_pd(_mm256_mul_pd(b0, v), z0);
+            z0 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b1, v), _mm256_mul_pd(a1, y1)), z1);
+            z1 = _mm256_sub_pd(_mm256_mul_pd(b2, v), _mm256_mul_pd(a2, y1));
+            y2 = _mm256_add_pd(y1, z2);
+            z2 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(m2, y1), _mm256_mul_pd(r1, y2)), z3);
+            z3 = _mm256_sub_pd(y1, _mm256_mul_pd(r2, y2));
+
+            kw = _mm256_add_pd(kw, _mm256_mul_pd(y2, y2));
+            sq = _mm256_add_pd(sq, _mm256_mul_pd(v, v));
+            pk = _mm256_max_pd(_mm256_andnot_pd(sign, v), pk);
+            for (p = 0; p < TP_PHASES; p++) {
+                __m256d acc = _mm256_mul_pd(_mm256_set1_pd(f->h[p][0]), v);
+
+                for (k = 1; k < TP_TAPS; k++)
+                    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(f->h[p][k]),
+                                                           _mm256_loadu_pd(xi - k * LANES)));
+                tp = _mm256_max_pd(_mm256_andnot_pd(sign, acc), tp);
+            }
+        }
+        _mm256_storeu_pd(s->z[0] + c, z0);
+        _mm256_storeu_pd(s->z[1] + c, z1);
+        _mm256_storeu_pd(s->z[2] + c, z2);
+        _mm256_storeu_pd(s->z[3] + c, z3);
+        _mm256_storeu_pd(s->kw + c, kw);
+        _mm256_storeu_pd(s->sq + c, sq);
+        _mm256_storeu_pd(s->peak + c, pk);
+        _mm256_storeu_pd(s->true_peak + c, tp);
+    }
+}
+
+static AnalyzeFunc best_analyze(void) {
+    if (__builtin_cpu_supports("avx2"))
+        return analyze_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return analyze_sse2;
+    return analyze_scalar;
+}
+
+//the filters decay into denormals on silence, which is slow on x86
+__attribute__((target("sse")))
+static void flush_denormals(void) {
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+}
+
+#else
+
+static AnalyzeFunc best_analyze(void) {
+    return analyze_scalar;
+}
+
+static void flush_denormals(void) {
+}
+
+#endif
+
+//BS.1770 K-weighting for any rate, and a windowed sinc interpolator
+static void init_filter(Filter *f, int sample_rate) {
+    double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / sample_rate);
+    double vh = pow(10.0, gain / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    int p, i;
+
+    f->b0 = (vh + vb * k / q + k * k) / a0;
+    f->b1 = 2.0 * (k * k - vh) / a0;
+    f->b2 = (vh - vb * k / q + k * k) / a0;
+    f->a1 = 2.0 * (k * k - 1.0) / a0;
+    f->a2 = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / sample_rate);
+    f->r1 = 2.0 * (k * k - 1.0) / (1.0 + k / q + k * k);
+    f->r2 = (1.0 - k / q + k * k) / (1.0 + k / q + k * k);
+
+    //phase p is the sinc shifted by p/4 of a sample, Hann windowed and
+    //normalized to unity gain at DC
+    for (p = 0; p < TP_PHASES; p++) {
+        double sum = 0;
+
+        for (i = 0; i < TP_TAPS; i++) {
+            double t = i - (TP_TAPS / 2 - 1) - (double)p / TP_PHASES;
+            double w = 0.5 + 0.5 * cos(M_PI * t / (TP_TAPS / 2));
+
+            f->h[p][i] = (t == 0 ? 1.0 : sin(M_PI * t) / (M_PI * t)) * w;
+            sum += f->h[p][i];
+        }
+        for (i = 0; i < TP_TAPS; i++)
+            f->h[p][i] /= sum;
+    }
+}
+
+static double to_lufs(double energy) {
+    return energy > 0 ? -0.691 + 10.0 * log10(energy) : -HUGE_VAL;
+}
+
+static double to_db(double amplitude) {
+    return amplitude > 0 ? 20.0 * log10(amplitude) : -HUGE_VAL;
+}
+
+//mean energy over the last 'nb' sub-blocks
+static double window_energy(const LoudnessMeter *m, int nb) {
+    double sum = 0;
+    int i;
+
+    for (i = 1; i <= nb; i++)
+        sum += m->sub[(m->nb_sub - i) % SHORT_TERM];
+    return sum / nb;
+}
+
+static void end_sub_block(LoudnessMeter *m) {
+    double energy = 0, block;
+    int c;
+
+    for (c = 0; c < m->channels; c++) {
+        energy += m->weight[c] * m->state.kw[c];
+        m->state.kw[c] = 0;
+    }
+    m->sub[m->nb_sub++ % SHORT_TERM] = energy / m->step;
+    if (m->nb_sub < MOMENTARY)
+        return;
+
+    block = window_energy(m, MOMENTARY);
+    pthread_mutex_lock(&m->mutex);
+    if (!(m->nb_blocks & (m->nb_blocks - 1)) &&
+        av_reallocp_array(&m->blocks, FFMAX(2 * m->nb_blocks, 256), sizeof(double)) < 0)
+        m->nb_blocks = 0;
+    if (m->blocks)
+        m->blocks[m->nb_blocks++] = block;
+    m->momentary = to_lufs(block);
+    m->momentary_max = FFMAX(m->momentary_max, m->momentary);
+    if (m->nb_sub >= SHORT_TERM) {
+        m->short_term = to_lufs(window_energy(m, SHORT_TERM));
+        m->short_term_max = FFMAX(m->short_term_max, m->short_term);
+    }
+    pthread_mutex_unlock(&m->mutex);
+}
+
+//analyze 'n' frames starting at ring position 'read'
+static void analyze_chunk(LoudnessMeter *m, uint64_t read, int n) {
+    double *x = m->work + HISTORY * LANES;
+    int c, i;
+
+    for (i = 0; i < n; i++) {
+        const float *src = m->ring + ((read + i) & (m->size - 1)) * m->channels;
+
+        for (c = 0; c < m->channels; c++)
+            x[i * LANES + c] = src[c];
+    }
+    m->analyze(&m->state, &m->filter, x, n, m->channels);
+    memmove(m->work, m->work + n * LANES, HISTORY * LANES * sizeof(double));
+
+    m->pos += n;
+    if (m->pos == m->step) {
+        m->pos = 0;
+        end_sub_block(m);
+    }
+    pthread_mutex_lock(&m->mutex);
+    m->snapshot = m->state;
+    m->frames += n;
+    pthread_mutex_unlock(&m->mutex);
+}
+
+static void *analysis_thread(void *arg) {
+    LoudnessMeter *m = (LoudnessMeter *)arg;
+
+    flush_denormals();
+    for (;;) {
+        uint64_t written = __atomic_load_n(&m->written, __ATOMIC_ACQUIRE);
+        int n = FFMIN(written - m->read, CHUNK);
+
+        //a chunk ends with the sub-block, that is where loudness is taken
+        n = FFMIN(n, m->step - m->pos);
+        if (n > 0) {
+            analyze_chunk(m, m->read, n);
+            __atomic_store_n(&m->read, m->read + n, __ATOMIC_RELEASE);
+        } else if (__atomic_load_n(&m->quit, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        } else {
+            av_usleep(5000);
+        }
+    }
+}
+
+LoudnessMeter *loudness_alloc(int sample_rate, int channels) {
+    LoudnessMeter *m;
+    int c;
+
+    if (channels <= 0 || channels > LOUDNESS_MAX_CHANNELS || sample_rate < 10)
+        return NULL;
+    m = av_mallocz(sizeof(LoudnessMeter));
+    if (!m)
+        return NULL;
+    m->sample_rate = sample_rate;
+    m->channels = channels;
+    m->size = 1;
+    while (m->size < (uint64_t)sample_rate * LOUDNESS_RING_SECONDS)
+        m->size <<= 1;
+    m->ring = av_malloc_array(m->size * channels, sizeof(float));
+    m->work = av_mallocz_array((HISTORY + CHUNK) * LANES, sizeof(double));
+    if (!m->ring || !m->work) {
+        av_free(m->ring);
+        av_free(m->work);
+        av_free(m);
+        return NULL;
+    }
+
+    //libavutil's default layouts: the LFE is the 4th of 5.1 and up, and
+    //the channels after the front three are surrounds
+    for (c = 0; c < channels; c++)
+        m->weight[c] = c < 3 ? 1.0 : 1.41;
+    if (channels >= 6)
+        m->weight[3] = 0;
+    init_filter(&m->filter, sample_rate);
+    m->analyze = best_analyze();
+    m->step = sample_rate / 10;
+    m->momentary = m->momentary_max = -HUGE_VAL;
+    m->short_term = m->short_term_max = -HUGE_VAL;
+
+    pthread_mutex_init(&m->mutex, NULL);
+    if (pthread_create(&m->thread, NULL, analysis_thread, m) != 0) {
+        pthread_mutex_destroy(&m->mutex);
+        av_free(m->ring);
+        av_free(m->work);
+        av_free(m);
+        return NULL;
+    }
+    return m;
+}
+
+void loudness_free(LoudnessMeter **m) {
+    LoudnessMeter *lm = *m;
+
+    if (!lm)
+        return;
+    __atomic_store_n(&lm->quit, 1, __ATOMIC_RELEASE);
+    pthread_join(lm->thread, NULL);
+    pthread_mutex_destroy(&lm->mutex);
+    av_free(lm->ring);
+    av_free(lm->work);
+    av_free(lm->blocks);
+    av_freep(m);
+}
+
+//convert samples [from, from + n) into the ring at frame 'pos'
+static void convert(LoudnessMeter *m, const uint8_t *const *data, enum AVSampleFormat fmt,
+                    int from, int n, uint64_t pos) {
+    int planar = av_sample_fmt_is_planar(fmt);
+    int channels = m->channels;
+    int i, c;
+
+#define CONVERT(type, expr)                                                     \
+    for (i = 0; i < n; i++) {                                                   \
+        float *dst = m->ring + ((pos + i) & (m->size - 1)) * channels;          \
+        for (c = 0; c < channels; c++) {                                        \
+            type v = planar ? ((const type *)data[c])[from + i] :               \
+                              ((const type *)data[0])[(from + i) * channels + c];  \
+            dst[c] = expr;                                                      \
+        }                                                                       \
+    }
+
+    switch (av_get_packed_sample_fmt(fmt)) {
+    case AV_SAMPLE_FMT_U8:  CONVERT(uint8_t, (v - 128) * (1.0f / 128)); break;
+    case AV_SAMPLE_FMT_S16: CONVERT(int16_t, v * (1.0f / 32768)); break;
+    case AV_SAMPLE_FMT_S32: CONVERT(int32_t, v * (1.0f / 2147483648.0f)); break;
+    case AV_SAMPLE_FMT_FLT: CONVERT(float, v); break;
+    case AV_SAMPLE_FMT_DBL: CONVERT(double, (float)v); break;
+    default:
+        for (i = 0; i < n; i++)
+            memset(m->ring + ((pos + i) & (m->size - 1)) * channels, 0, channels * sizeof(float));
+        break;
+    }
+#undef CONVERT
+}
+
+int loudness_push(LoudnessMeter *m, const uint8_t *const *data, enum AVSampleFormat fmt,
+                  int nb_samples, int wait) {
+    int done = 0;
+
+    while (done < nb_samples) {
+        uint64_t read = __atomic_load_n(&m->read, __ATOMIC_ACQUIRE);
+        int n = FFMIN(nb_samples - done, m->size - (m->written - read));
+
+        if (n == 0 && wait) {
+            av_usleep(1000);
+            continue;
+        }
+        if (n == 0) {
+            __atomic_store_n(&m->dropped, m->dropped + nb_samples - done, __ATOMIC_RELAXED);
+            break;
+        }
+        convert(m, data, fmt, done, n, m->written);
+        __atomic_store_n(&m->written, m->written + n, __ATOMIC_RELEASE);
+        done += n;
+    }
+    return done;
+}
+
+void loudness_flush(LoudnessMeter *m) {
+    while (__atomic_load_n(&m->read, __ATOMIC_ACQUIRE) != m->written)
+        av_usleep(1000);
+}
+
+void loudness_get_stats(LoudnessMeter *m, LoudnessStats *stats) {
+    double sum = 0, gate;
+    int i, c, nb = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&m->mutex);
+    //absolute gate, then relative to what passed it
+    for (i = 0; i < m->nb_blocks; i++) {
+        if (to_lufs(m->blocks[i]) > ABS_GATE) {
+            sum += m->blocks[i];
+            nb++;
+        }
+    }
+    gate = nb ? to_lufs(sum / nb) + REL_GATE : ABS_GATE;
+    for (sum = 0, nb = 0, i = 0; i < m->nb_blocks; i++) {
+        double l = to_lufs(m->blocks[i]);
+
+        if (l > ABS_GATE && l > gate) {
+            sum += m->blocks[i];
+            nb++;
+        }
+    }
+    stats->integrated = nb ? to_lufs(sum / nb) : -HUGE_VAL;
+    stats->momentary = m->momentary;
+    stats->momentary_max = m->momentary_max;
+    stats->short_term = m->short_term;
+    stats->short_term_max = m->short_term_max;
+    stats->true_peak = -HUGE_VAL;
+    for (c = 0; c < m->channels; c++) {
+        stats->channel_true_peak[c] = to_db(m->snapshot.true_peak[c]);
+        stats->channel_peak[c] = to_db(m->snapshot.peak[c]);
+        stats->channel_rms[c] = m->frames ? to_db(sqrt(m->snapshot.sq[c] / m->frames)) : -HUGE_VAL;
+        stats->true_peak = FFMAX(stats->true_peak, stats->channel_true_peak[c]);
+    }
+    stats->frames = m->frames;
+    pthread_mutex_unlock(&m->mutex);
+    stats->channels = m->channels;
+    stats->dropped = __atomic_load_n(&m->dropped, __ATOMIC_RELAXED);
+}
+
+void loudness_print_stats(LoudnessMeter *m, const char *name) {
+    LoudnessStats st;
+    int c;
+
+    if (!m)
+        return;
+    loudness_get_stats(m, &st);
+    fprintf(stderr, "%s: integrated %.1f LUFS, short-term max %.1f LUFS, "
+            "momentary max %.1f LUFS, true peak %.1f dBTP\n", name, st.integrated,
+            st.short_term_max, st.momentary_max, st.true_peak);
+    for (c = 0; c < st.channels; c++)
+        fprintf(stderr, "%s: channel %d rms %.1f dBFS, peak %.1f dBFS, true peak %.1f dBTP\n",
+                name, c, st.channel_rms[c], st.channel_peak[c], st.channel_true_peak[c]);
+    fprintf(stderr, "%s: %.1f s analyzed, %llu samples dropped\n", name,
+            (double)st.frames / m->sample_rate, (unsigned long long)st.dropped);
+}
+
+int loudness_analyze(const char *filename) {
+    AVFormatContext *pFormatCtx = NULL;
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec;
+    AVFrame *pFrame = NULL;
+    AVPacket packet;
+    LoudnessMeter *m = NULL;
+    int64_t start;
+    int audioStream = -1, gotFrame, i, ret = -1;
+
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
+        goto end;
+    for (i = 0; i < pFormatCtx->nb_streams; i++) {
+        if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+            audioStream = i;
+            break;
+        }
+    }
+    if (audioStream == -1)
+        goto end;
+    pCodec = avcodec_find_decoder(pFormatCtx->streams[audioStream]->codec->codec_id);
+    if (!pCodec)
+        goto end;
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (avcodec_copy_context(pCodecCtx, pFormatCtx->streams[audioStream]->codec) != 0 ||
+        avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
+        goto end;
+    m = loudness_alloc(pCodecCtx->sample_rate, pCodecCtx->channels);
+    pFrame = av_frame_alloc();
+    if (!m || !pFrame)
+        goto end;
+
+    start = av_gettime();
+    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+        AVPacket pkt = packet;
+
+        while (packet.stream_index == audioStream && pkt.size > 0) {
+            int len = avcodec_decode_audio4(pCodecCtx, pFrame, &gotFrame, &pkt);
+
+            if (len < 0)
+                break;
+            if (gotFrame)
+                loudness_push(m, (const uint8_t *const *)pFrame->extended_data,
+                              pFrame->format, pFrame->nb_samples, 1);
+            pkt.data += len;
+            pkt.size -= len;
+        }
+        av_free_packet(&packet);
+    }
+    //samples the decoder still holds
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    while ((pCodec->capabilities & CODEC_CAP_DELAY) &&
+           avcodec_decode_audio4(pCodecCtx, pFrame, &gotFrame, &packet) >= 0 && gotFrame)
+        loudness_push(m, (const uint8_t *const *)pFrame->extended_data,
+                      pFrame->format, pFrame->nb_samples, 1);
+    loudness_flush(m);
+
+    loudness_print_stats(m, filename);
+    {
+        double elapsed = (av_gettime() - start) / 1000000.0;
+        LoudnessStats st;
+
+        loudness_get_stats(m, &st);
+        fprintf(stderr, "%s: measured in %.2f s, %.1fx real time\n", filename, elapsed,
+                elapsed > 0 ? st.frames / (double)pCodecCtx->sample_rate / elapsed : 0.0);
+    }
+    ret = 0;
+
+end:
+    if (!m && pCodecCtx && pCodecCtx->channels > LOUDNESS_MAX_CHANNELS)
+        fprintf(stderr, "%s: more than %d channels\n", filename, LOUDNESS_MAX_CHANNELS);
+    loudness_free(&m);
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+    return ret;
+}
@@ -0,0 +1,64 @@
+//loudness.h
+//EBU R128 / ITU-R BS.1770 loudness, true peak and per channel RMS of a
+//stream of samples, measured on a thread of its own. The producer only
+//copies into a lock-free ring, so it can sit in an audio callback.
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <libavutil/samplefmt.h>
+
+#include <stdint.h>
+
+#define LOUDNESS_MAX_CHANNELS   8
+#define LOUDNESS_RING_SECONDS   2   //buffered ahead of the analysis
+
+typedef struct LoudnessStats {
+    int         channels;
+    double      integrated;         //LUFS, gated, -inf before the first block
+    double      momentary;          //LUFS, the last 400 ms
+    double      momentary_max;
+    double      short_term;         //LUFS, the last 3 s
+    double      short_term_max;
+    double      true_peak;          //dBTP, 4x oversampled, all channels
+    double      channel_true_peak[LOUDNESS_MAX_CHANNELS];   //dBTP
+    double      channel_peak[LOUDNESS_MAX_CHANNELS];        //sample peak, dBFS
+    double      channel_rms[LOUDNESS_MAX_CHANNELS];         //dBFS
+    uint64_t    frames;             //analyzed, per channel
+    uint64_t    dropped;            //lost to a full ring
+}LoudnessStats;
+
+typedef struct LoudnessMeter LoudnessMeter;
+
+//starts the analysis thread, NULL for more than LOUDNESS_MAX_CHANNELS
+LoudnessMeter *loudness_alloc(int sample_rate, int channels);
+
+void loudness_free(LoudnessMeter **m);
+
+/*
+ * Queue 'nb_samples' per channel, of any sample format, for 'channels'
+ * channels as given to loudness_alloc(). Only one thread may push. If
+ * the ring is full the rest is dropped and counted, unless 'wait' is
+ * set, then it sleeps until the analysis has caught up. Never takes a
+ * lock. Returns the samples per channel queued.
+ */
+int loudness_push(LoudnessMeter *m, const uint8_t *const *data, enum AVSampleFormat fmt,
+                  int nb_samples, int wait);
+
+//wait until everything pushed so far has been analyzed
+void loudness_flush(LoudnessMeter *m);
+
+//the integrated loudness is gated over the whole run, computed here
+void loudness_get_stats(LoudnessMeter *m, LoudnessStats *stats);
+
+//the measurements on stderr
+void loudness_print_stats(LoudnessMeter *m, const char *name);
+
+/*
+ * Headless: decode the first audio stream of 'filename' as fast as it
+ * goes, measure all of it and print the result with the speed relative
+ * to real time. Returns 0 on success, -1 if it cannot be decoded.
+ */
+int loudness_analyze(const char *filename);
+
+#endif
@@ -0,0 +1,277 @@
+//mosaic.c
+//Contact sheet generator built on the tutorial01 extraction path.
+//Every worker thread owns its own demuxer and decoder, seeks to the
+//position of the next free tile and lets swscale downscale the decoded
+//frame straight into that tile's rectangle of the shared canvas, so
+//there is no intermediate tile buffer and no separate blit pass.
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libavutil/cpu.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mosaic.h"
+#include "seekindex.h"
+
+typedef struct Mosaic {
+    const char      *filename;
+    int             cols, rows;
+    int             tile_w, tile_h;
+    int64_t         duration;   //in AV_TIME_BASE units
+    FastOpenOptions open_opts;
+    SeekIndex       *seek_index;    //sidecar index, NULL if there is none
+
+    uint8_t         *canvas;    //RGB24, cols * tile_w x rows * tile_h
+    int             linesize;
+
+    int             next_tile;  //next tile to be picked up by a worker
+    int             tiles_done;
+    pthread_mutex_t mutex;
+}Mosaic;
+
+static int open_video(const char *filename, const FastOpenOptions *opts,
+                      AVFormatContext **pFormatCtx, AVCodecContext **pCodecCtx,
+                      int *videoStream) {
+    AVCodecContext *pCodecCtxOrig;
+    AVCodec *pCodec;
+    FastOpenStats fo_stats;
+    int i;
+
+    *pFormatCtx = NULL;
+    *pCodecCtx = NULL;
+
+    if (fast_open_input(pFormatCtx, filename, opts, &fo_stats) < 0)
+        return -1;  //couldn't open file
+
+    *videoStream = -1;
+    for (i = 0; i < (*pFormatCtx)->nb_streams; i++) {
+        if ((*pFormatCtx)->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            *videoStream = i;
+            break;
+        }
+    }
+    if (*videoStream == -1)
+        goto fail;
+
+    pCodecCtxOrig = (*pFormatCtx)->streams[*videoStream]->codec;
+    pCodec = avcodec_find_decoder(pCodecCtxOrig->codec_id);
+    if (pCodec == NULL) {
+        fprintf(stderr, "Unsupported codec!\n");
+        goto fail;
+    }
+    *pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (avcodec_copy_context(*pCodecCtx, pCodecCtxOrig) != 0)
+        goto fail;
+    //tiles are decoded in parallel already, one decoder thread each is enough
+    (*pCodecCtx)->thread_count = 1;
+    if (avcodec_open2(*pCodecCtx, pCodec, NULL) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    avcodec_free_context(pCodecCtx);
+    avformat_close_input(pFormatCtx);
+    return -1;
+}
+
+//decode the first frame after seeking back to the keyframe at or before
+//'ts' (AV_TIME_BASE units); a tile needs a picture near 'ts', not the
+//exact one, and this way it costs a single decoded frame
+static int decode_at(AVFormatContext *pFormatCtx, AVCodecContext *pCodecCtx,
+                     const SeekIndex *idx, int videoStream, int64_t ts,
+                     AVFrame *pFrame) {
+    AVRational tb = pFormatCtx->streams[videoStream]->time_base;
+    AVPacket packet;
+    int frameFinished = 0;
+
+    //the sidecar index finds the keyframe without asking the demuxer
+    if (seek_index_seek(pFormatCtx, idx, videoStream,
+                        av_rescale_q(ts, AV_TIME_BASE_Q, tb)) == AV_NOPTS_VALUE &&
+        av_seek_frame(pFormatCtx, -1, ts, AVSEEK_FLAG_BACKWARD) < 0)
+        return -1;
+    avcodec_flush_buffers(pCodecCtx);
+
+    while (!frameFinished && av_read_frame(pFormatCtx, &packet) >= 0) {
+        if (packet.stream_index == videoStream)
+            avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+        av_free_packet(&packet);
+    }
+
+    //drain the decoder if the file ended before a frame came out
+    if (!frameFinished) {
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+    }
+
+    return frameFinished ? 0 : -1;
+}
+
+static void *mosaic_worker(void *arg) {
+    Mosaic *m = (Mosaic *)arg;
+    AVFormatContext *pFormatCtx;
+    AVCodecContext  *pCodecCtx;
+    AVFrame         *pFrame;
+    struct SwsContext *sws_ctx = NULL;
+    int videoStream;
+    int nb_tiles = m->cols * m->rows;
+
+    if (open_video(m->filename, &m->open_opts, &pFormatCtx, &pCodecCtx, &videoStream) < 0)
+        return NULL;
+    pFrame = av_frame_alloc();
+
+    for (;;) {
+        int tile, x, y;
+        int64_t ts;
+        uint8_t *dst[4] = { NULL };
+        int dst_linesize[4] = { 0 };
+
+        pthread_mutex_lock(&m->mutex);
+        tile = m->next_tile++;
+        pthread_mutex_unlock(&m->mutex);
+        if (tile >= nb_tiles)
+            break;
+
+        //sample the middle of each of the nb_tiles equal intervals
+        ts = m->duration * (2 * tile + 1) / (2 * nb_tiles);
+        if (pFormatCtx->start_time != AV_NOPTS_VALUE)
+            ts += pFormatCtx->start_time;
+        if (decode_at(pFormatCtx, pCodecCtx, m->seek_index, videoStream, ts, pFrame) < 0)
+            continue;   //leave the tile black
+
+        //the source size may change mid stream, so use the cached context
+        sws_ctx = sws_getCachedContext(sws_ctx,
+                                       pFrame->width, pFrame->height,
+                                       pFrame->format,
+                                       m->tile_w, m->tile_h,
+                                       AV_PIX_FMT_RGB24,
+                                       SWS_BILINEAR, NULL, NULL, NULL);
+        if (!sws_ctx)
+            continue;
+
+        //point the destination at the tile inside the canvas
+        x = tile % m->cols;
+        y = tile / m->cols;
+        dst[0] = m->canvas + y * m->tile_h * m->linesize + x * m->tile_w * 3;
+        dst_linesize[0] = m->linesize;
+
+        sws_scale(sws_ctx, (uint8_t const *const *)pFrame->data,
+                  pFrame->linesize, 0, pFrame->height,
+                  dst, dst_linesize);
+
+        pthread_mutex_lock(&m->mutex);
+        m->tiles_done++;
+        pthread_mutex_unlock(&m->mutex);
+    }
+
+    sws_freeContext(sws_ctx);
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+    return NULL;
+}
+
+static int save_ppm(const char *outname, uint8_t *data, int linesize,
+                    int width, int height) {
+    FILE *pFile;
+    int y;
+
+    pFile = fopen(outname, "wb");
+    if (pFile == NULL)
+        return -1;
+
+    fprintf(pFile, "P6\n%d %d\n255\n", width, height);
+    for (y = 0; y < height; y++)
+        fwrite(data + y * linesize, 1, width * 3, pFile);
+
+    fclose(pFile);
+    return 0;
+}
+
+int mosaic_generate(const char *filename, int cols, int rows,
+                    int tile_w, int nb_threads,
+                    const FastOpenOptions *opts, const char *outname) {
+    AVFormatContext *pFormatCtx;
+    AVCodecContext  *pCodecCtx;
+    pthread_t *threads;
+    Mosaic m;
+    int videoStream;
+    int i, ret;
+
+    if (cols <= 0 || rows <= 0)
+        return -1;
+
+    memset(&m, 0, sizeof(m));
+    m.open_opts = *opts;
+    m.seek_index = seek_index_open(filename);
+
+    //probe once on this thread for the geometry and the duration
+    if (open_video(filename, &m.open_opts, &pFormatCtx, &pCodecCtx, &videoStream) < 0) {
+        seek_index_close(&m.seek_index);
+        return -1;
+    }
+
+    m.filename = filename;
+    m.cols     = cols;
+    m.rows     = rows;
+    m.duration = pFormatCtx->duration;
+    m.tile_w   = tile_w > 0 ? tile_w : MOSAIC_TILE_WIDTH;
+    if (m.tile_w > pCodecCtx->width)
+        m.tile_w = pCodecCtx->width;
+    m.tile_w &= ~1;
+    m.tile_h = (int)av_rescale(m.tile_w, pCodecCtx->height, pCodecCtx->width) & ~1;
+
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+
+    if (m.duration <= 0 || m.tile_w <= 0 || m.tile_h <= 0) {
+        fprintf(stderr, "%s: unknown duration or size, no mosaic\n", filename);
+        seek_index_close(&m.seek_index);
+        return -1;
+    }
+
+    //pad each row so the canvas rows stay aligned for swscale
+    m.linesize = FFALIGN(cols * m.tile_w * 3, 32);
+    m.canvas = av_mallocz((size_t)m.linesize * rows * m.tile_h);
+    if (!m.canvas) {
+        seek_index_close(&m.seek_index);
+        return -1;
+    }
+    pthread_mutex_init(&m.mutex, NULL);
+
+    if (nb_threads <= 0)
+        nb_threads = av_cpu_count();
+    if (nb_threads > cols * rows)
+        nb_threads = cols * rows;
+    threads = av_malloc_array(nb_threads, sizeof(*threads));
+    if (!threads) {
+        av_free(m.canvas);
+        seek_index_close(&m.seek_index);
+        return -1;
+    }
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(&threads[i], NULL, mosaic_worker, &m) != 0)
+            break;
+    }
+    nb_threads = i;
+    if (nb_threads == 0)
+        mosaic_worker(&m);  //no threads available, do it ourselves
+    for (i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("%s: %d/%d tiles -> %s\n", filename, m.tiles_done, cols * rows, outname);
+    ret = save_ppm(outname, m.canvas, m.linesize, cols * m.tile_w, rows * m.tile_h);
+
+    pthread_mutex_destroy(&m.mutex);
+    av_free(threads);
+    av_free(m.canvas);
+    seek_index_close(&m.seek_index);
+    return ret;
+}
@@ -0,0 +1,24 @@
+//mosaic.h
+//Contact sheet generator: decodes N x M frames evenly spaced through
+//a file and composites them into a single RGB24 image.
+
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include "fastopen.h"
+
+#define MOSAIC_TILE_WIDTH 320
+
+/*
+ * Build a cols x rows contact sheet of 'filename' and write it as a
+ * PPM to 'outname'. Every tile is width 'tile_w' (0 picks the default)
+ * and keeps the source aspect ratio. Tiles are decoded in parallel by
+ * seek position, 'nb_threads' <= 0 uses one thread per cpu. Every
+ * worker opens the file with 'opts'.
+ * Returns 0 on success, a negative value on error.
+ */
+int mosaic_generate(const char *filename, int cols, int rows,
+                    int tile_w, int nb_threads,
+                    const FastOpenOptions *opts, const char *outname);
+
+#endif
@@ -0,0 +1,444 @@
+//phash.c
+//The luma plane is averaged down in bands of rows: every row of a band
+//is added into 16 bit column sums, 16 (SSE2) or 32 (AVX2) pixels at a
+//time, and only the column sums are split into the PHASH_SIZE cells.
+//That pass reads every pixel once and is all the per pixel work there
+//is, the DCT of the 32x32 cells only needs the 9 lowest frequencies
+//each way.
+//
+//Searching XORs the query with 2 (SSE2) or 4 (AVX2) stored hashes at a
+//time and counts the bits with byte sums, keeping the smallest distance
+//of every block. Only a block that has a match is looked at again to
+//find which frame it was.
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "phash.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+#define NB_FREQ         8       //8x8 frequencies make the 64 bits
+#define MAX_BAND_ROWS   256     //rows added before 16 bit sums could overflow
+#define SEARCH_BLOCK    256     //hashes per minimum
+
+typedef void (*AccumulateFunc)(uint16_t *sum, const uint8_t *src, int width);
+typedef int (*MinDistanceFunc)(const uint64_t *hashes, int n, uint64_t q);
+
+//a signature file mapped for searching
+typedef struct Signature {
+    uint8_t             *map;
+    size_t              map_size;
+    const PHashEntry    *entries;
+    uint64_t            *hashes;    //the hashes alone, for the SIMD loops
+    int                 nb_entries;
+}Signature;
+
+static void accumulate_scalar_from(uint16_t *sum, const uint8_t *src, int x, int width) {
+    for (; x < width; x++)
+        sum[x] += src[x];
+}
+
+static void accumulate_scalar(uint16_t *sum, const uint8_t *src, int width) {
+    accumulate_scalar_from(sum, src, 0, width);
+}
+
+static int popcount64(uint64_t v) {
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (v * 0x0101010101010101ULL) >> 56;
+}
+
+static int min_distance_scalar(const uint64_t *hashes, int n, uint64_t q) {
+    int i, min = 64;
+
+    for (i = 0; i < n; i++)
+        min = FFMIN(min, popcount64(hashes[i] ^ q));
+    return min;
+}
+
+#if HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void accumulate_sse2(uint16_t *sum, const uint8_t *src, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i lo = _mm_loadu_si128((const __m128i *)(sum + x));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(sum + x + 8));
+
+        _mm_storeu_si128((__m128i *)(sum + x), _mm_add_epi16(lo, _mm_unpacklo_epi8(p, zero)));
+        _mm_storeu_si128((__m128i *)(sum + x + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(p, zero)));
+    }
+    accumulate_scalar_from(sum, src, x, width);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint16_t *sum, const uint8_t *src, int width) {
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + x)));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + x + 16)));
+
+        lo = _mm256_add_epi16(lo, _mm256_loadu_si256((const __m256i *)(sum + x)));
+        hi = _mm256_add_epi16(hi, _mm256_loadu_si256((const __m256i *)(sum + x + 16)));
+        _mm256_storeu_si256((__m256i *)(sum + x), lo);
+        _mm256_storeu_si256((__m256i *)(sum + x + 16), hi);
+    }
+    accumulate_scalar_from(sum, src, x, width);
+}
+
+//bit counts of the 64 bit lanes, SWAR down to bytes then summed by psadbw
+__attribute__((target("sse2")))
+static int min_distance_sse2(const uint64_t *hashes, int n, uint64_t q) {
+    const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0F);
+    const __m128i vq = _mm_set1_epi64x(q);
+    __m128i min = _mm_set1_epi16(64);
+    uint16_t lanes[8];
+    int i, best;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(hashes + i)), vq);
+
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+        v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+        v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+        //the counts land in the low word of each lane, the rest is 0
+        min = _mm_min_epi16(min, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    _mm_storeu_si128((__m128i *)lanes, min);
+    best = FFMIN(lanes[0], lanes[4]);
+    return FFMIN(best, min_distance_scalar(hashes + i, n - i, q));
+}
+
+__attribute__((target("avx2")))
+static int min_distance_avx2(const uint64_t *hashes, int n, uint64_t q) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i vq = _mm256_set1_epi64x(q);
+    __m256i min = _mm256_set1_epi16(64);
+    uint16_t lanes[16];
+    int i, best = 64;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(hashes + i)), vq);
+        __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(v, m4)),
+                                    _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), m4)));
+
+        min = _mm256_min_epi16(min, _mm256_sad_epu8(c, _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, min);
+    for (i = 0; i < 16; i += 4)
+        best = FFMIN(best, lanes[i]);
+    return FFMIN(best, min_distance_scalar(hashes + (n & ~3), n & 3, q));
+}
+
+static AccumulateFunc best_accumulate(void) {
+    if (__builtin_cpu_supports("avx2"))
+        return accumulate_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return accumulate_sse2;
+    return accumulate_scalar;
+}
+
+static MinDistanceFunc best_min_distance(void) {
+    if (__builtin_cpu_supports("avx2"))
+        return min_distance_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return min_distance_sse2;
+    return min_distance_scalar;
+}
+
+#else
+
+static AccumulateFunc best_accumulate(void) {
+    return accumulate_scalar;
+}
+
+static MinDistanceFunc best_min_distance(void) {
+    return min_distance_scalar;
+}
+
+#endif
+
+//mean of every cell of a PHASH_SIZE x PHASH_SIZE grid over the plane
+static int downsample(const uint8_t *luma, int linesize, int width, int height,
+                      float cells[PHASH_SIZE][PHASH_SIZE]) {
+    AccumulateFunc accumulate = best_accumulate();
+    uint16_t *sum;
+    int x0[PHASH_SIZE + 1];
+    int i, j, x, y;
+
+    sum = av_malloc(width * sizeof(uint16_t));
+    if (!sum)
+        return -1;
+    for (j = 0; j <= PHASH_SIZE; j++)
+        x0[j] = j * width / PHASH_SIZE;
+
+    for (i = 0; i < PHASH_SIZE; i++) {
+        int y0 = i * height / PHASH_SIZE, y1 = (i + 1) * height / PHASH_SIZE;
+        uint32_t total[PHASH_SIZE] = { 0 };
+
+        //16 bit sums, emptied into 'total' before they could overflow
+        for (y = y0; y < y1; y += MAX_BAND_ROWS) {
+            int rows = FFMIN(y1 - y, MAX_BAND_ROWS);
+            int k;
+
+            memset(sum, 0, width * sizeof(uint16_t));
+            for (k = 0; k < rows; k++)
+                accumulate(sum, luma + (y + k) * linesize, width);
+            for (j = 0; j < PHASH_SIZE; j++) {
+                for (x = x0[j]; x < x0[j + 1]; x++)
+                    total[j] += sum[x];
+            }
+        }
+        for (j = 0; j < PHASH_SIZE; j++)
+            cells[i][j] = (float)total[j] / ((y1 - y0) * (x0[j + 1] - x0[j]));
+    }
+    av_free(sum);
+    return 0;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+int phash_compute(const uint8_t *luma, int linesize, int width, int height, uint64_t *hash) {
+    static float basis[NB_FREQ + 1][PHASH_SIZE];
+    static int basis_done;
+    float cells[PHASH_SIZE][PHASH_SIZE];
+    float rows[NB_FREQ + 1][PHASH_SIZE];
+    float coef[NB_FREQ * NB_FREQ], sorted[NB_FREQ * NB_FREQ];
+    float median;
+    int u, v, x, y;
+
+    if (width < PHASH_SIZE || height < PHASH_SIZE ||
+        downsample(luma, linesize, width, height, cells) < 0)
+        return -1;
+
+    //DCT-II basis, the scale does not matter for a comparison to the median
+    if (!basis_done) {
+        for (u = 0; u <= NB_FREQ; u++) {
+            for (x = 0; x < PHASH_SIZE; x++)
+                basis[u][x] = cos(M_PI * (2 * x + 1) * u / (2 * PHASH_SIZE));
+        }
+        basis_done = 1;
+    }
+
+    //down the columns, then along the rows, frequencies 1 to NB_FREQ
+    for (u = 1; u <= NB_FREQ; u++) {
+        for (x = 0; x < PHASH_SIZE; x++) {
+            float acc = 0;
+
+            for (y = 0; y < PHASH_SIZE; y++)
+                acc += basis[u][y] * cells[y][x];
+            rows[u][x] = acc;
+        }
+    }
+    for (u = 1; u <= NB_FREQ; u++) {
+        for (v = 1; v <= NB_FREQ; v++) {
+            float acc = 0;
+
+            for (x = 0; x < PHASH_SIZE; x++)
+                acc += rows[u][x] * basis[v][x];
+            coef[(u - 1) * NB_FREQ + v - 1] = acc;
+        }
+    }
+
+    memcpy(sorted, coef, sizeof(coef));
+    qsort(sorted, NB_FREQ * NB_FREQ, sizeof(float), compare_floats);
+    median = (sorted[NB_FREQ * NB_FREQ / 2 - 1] + sorted[NB_FREQ * NB_FREQ / 2]) / 2;
+
+    *hash = 0;
+    for (u = 0; u < NB_FREQ * NB_FREQ; u++) {
+        if (coef[u] > median)
+            *hash |= 1ULL << u;
+    }
+    return 0;
+}
+
+int phash_list_add(PHashList *list, uint64_t hash, int64_t time_ms, int frame) {
+    if (list->nb_entries == list->nb_alloc) {
+        int nb_alloc = list->nb_alloc ? list->nb_alloc * 2 : 256;
+        PHashEntry *entries = av_realloc_array(list->entries, nb_alloc, sizeof(PHashEntry));
+        if (!entries)
+            return -1;
+        list->entries = entries;
+        list->nb_alloc = nb_alloc;
+    }
+    list->entries[list->nb_entries].hash = hash;
+    list->entries[list->nb_entries].time_ms = av_clip64(time_ms, 0, UINT32_MAX);
+    list->entries[list->nb_entries].frame = frame;
+    list->nb_entries++;
+    return 0;
+}
+
+void phash_list_free(PHashList *list) {
+    av_freep(&list->entries);
+    list->nb_entries = list->nb_alloc = 0;
+}
+
+int phash_save(const char *filename, const PHashList *list, int flags) {
+    char name[1024], tmpname[1040];
+    PHashHeader hdr;
+    FILE *pFile;
+    int ret = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PHASH_MAGIC, 4);
+    hdr.version    = PHASH_VERSION;
+    hdr.flags      = flags;
+    hdr.nb_entries = list->nb_entries;
+
+    //write to a temporary name first so a search never sees half a file
+    snprintf(name, sizeof(name), "%s%s", filename, PHASH_SUFFIX);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    pFile = fopen(tmpname, "wb");
+    if (pFile == NULL)
+        return -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, pFile) != 1 ||
+        fwrite(list->entries, sizeof(PHashEntry), list->nb_entries, pFile) != list->nb_entries)
+        ret = -1;
+    if (fclose(pFile) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmpname, name) != 0)
+        ret = -1;
+    if (ret < 0)
+        unlink(tmpname);
+    return ret;
+}
+
+static void signature_close(Signature *sig) {
+    if (sig->map)
+        munmap(sig->map, sig->map_size);
+    av_freep(&sig->hashes);
+    memset(sig, 0, sizeof(*sig));
+}
+
+static int signature_open(Signature *sig, const char *path) {
+    const PHashHeader *hdr;
+    struct stat st;
+    int fd, i;
+
+    memset(sig, 0, sizeof(*sig));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(PHashHeader)) {
+        close(fd);
+        return -1;
+    }
+    sig->map_size = st.st_size;
+    sig->map = mmap(NULL, sig->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sig->map == MAP_FAILED) {
+        sig->map = NULL;
+        return -1;
+    }
+
+    //never trust the count read from disk
+    hdr = (const PHashHeader *)sig->map;
+    if (memcmp(hdr->magic, PHASH_MAGIC, 4) || hdr->version != PHASH_VERSION ||
+        hdr->nb_entries > (sig->map_size - sizeof(PHashHeader)) / sizeof(PHashEntry) ||
+        hdr->nb_entries > INT_MAX) {
+        signature_close(sig);
+        return -1;
+    }
+    sig->entries = (const PHashEntry *)(sig->map + sizeof(PHashHeader));
+    sig->nb_entries = hdr->nb_entries;
+    sig->hashes = av_malloc_array(FFMAX(sig->nb_entries, 1), sizeof(uint64_t));
+    if (!sig->hashes) {
+        signature_close(sig);
+        return -1;
+    }
+    for (i = 0; i < sig->nb_entries; i++)
+        sig->hashes[i] = sig->entries[i].hash;
+    return 0;
+}
+
+//closest entry of 'sig' to 'q', -1 if none is within 'max_distance'
+static int closest(const Signature *sig, uint64_t q, int max_distance,
+                   MinDistanceFunc min_distance, int *distance) {
+    int b, i, n, best = -1;
+
+    *distance = max_distance + 1;
+    for (b = 0; b < sig->nb_entries; b += SEARCH_BLOCK) {
+        n = FFMIN(SEARCH_BLOCK, sig->nb_entries - b);
+        if (min_distance(sig->hashes + b, n, q) >= *distance)
+            continue;
+        for (i = b; i < b + n; i++) {
+            int d = popcount64(sig->hashes[i] ^ q);
+
+            if (d < *distance) {
+                *distance = d;
+                best = i;
+            }
+        }
+    }
+    return best;
+}
+
+static void print_time(uint32_t ms) {
+    printf("%u:%02u:%02u.%03u", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+}
+
+int phash_search(const char *query, char **files, int nb_files, int max_distance) {
+    MinDistanceFunc min_distance = best_min_distance();
+    Signature q, sig;
+    int f, i, nb_matching = 0;
+
+    if (signature_open(&q, query) < 0) {
+        fprintf(stderr, "%s: not a signature file\n", query);
+        return -1;
+    }
+    for (f = 0; f < nb_files; f++) {
+        int matches = 0, best = 65, distance, k;
+
+        if (signature_open(&sig, files[f]) < 0) {
+            fprintf(stderr, "%s: not a signature file\n", files[f]);
+            continue;
+        }
+        for (i = 0; i < q.nb_entries; i++) {
+            k = closest(&sig, q.hashes[i], max_distance, min_distance, &distance);
+            if (k < 0)
+                continue;
+            best = FFMIN(best, distance);
+            if (matches++ < PHASH_MAX_SHOWN) {
+                printf("  ");
+                print_time(q.entries[i].time_ms);
+                printf(" ~ %s ", files[f]);
+                print_time(sig.entries[k].time_ms);
+                printf(" (distance %d)\n", distance);
+            }
+        }
+        if (matches) {
+            printf("%s: %d of %d frames match, closest distance %d\n", files[f], matches,
+                   q.nb_entries, best);
+            nb_matching++;
+        }
+        signature_close(&sig);
+    }
+    signature_close(&q);
+    return nb_matching;
+}
@@ -0,0 +1,72 @@
+//phash.h
+//Perceptual hashes of decoded frames for duplicate and near duplicate
+//detection, stored next to the asset ("movie.mp4.phsh") and searched by
+//Hamming distance. Frames that look alike hash a few bits apart, after
+//scaling, recompression or small color changes.
+
+#ifndef PHASH_H
+#define PHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PHASH_MAGIC     "PHSH"
+#define PHASH_VERSION   1
+#define PHASH_SUFFIX    ".phsh"
+
+#define PHASH_SIZE          32  //luma is averaged down to this square
+#define PHASH_DISTANCE      10  //bits, default for a match
+#define PHASH_MAX_SHOWN     5   //matching frames printed per file
+
+#define PHASH_FLAG_KEYFRAMES    1   //only keyframes were hashed
+
+/*
+ * On disk layout, all fields in host byte order:
+ *   PHashHeader
+ *   PHashEntry[nb_entries] in decoding order
+ */
+typedef struct PHashHeader {
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    flags;
+    uint32_t    reserved;
+    uint64_t    nb_entries;
+}PHashHeader;
+
+typedef struct PHashEntry {
+    uint64_t    hash;
+    uint32_t    time_ms;    //from the start of the stream
+    uint32_t    frame;      //decoded frame number
+}PHashEntry;
+
+typedef struct PHashList {
+    PHashEntry  *entries;
+    int         nb_entries;
+    int         nb_alloc;
+}PHashList;
+
+/*
+ * 64 bit DCT hash of an 8 bit luma plane: the plane is averaged down to
+ * PHASH_SIZE x PHASH_SIZE, each bit says whether one of the 8x8 lowest
+ * frequencies after DC is above their median. Returns -1 if the plane
+ * is smaller than PHASH_SIZE either way.
+ */
+int phash_compute(const uint8_t *luma, int linesize, int width, int height, uint64_t *hash);
+
+//append to 'list', returns -1 when out of memory
+int phash_list_add(PHashList *list, uint64_t hash, int64_t time_ms, int frame);
+void phash_list_free(PHashList *list);
+
+//write 'list' as the signature of 'filename', next to it
+int phash_save(const char *filename, const PHashList *list, int flags);
+
+/*
+ * For every frame of the signature file 'query', find the closest frame
+ * of each of the 'nb_files' signature files in 'files', and print per
+ * file how many frames are within 'max_distance' bits, with the first
+ * PHASH_MAX_SHOWN of them. Returns the number of files with any match,
+ * -1 if 'query' cannot be read.
+ */
+int phash_search(const char *query, char **files, int nb_files, int max_distance);
+
+#endif
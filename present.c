@@ -0,0 +1,157 @@
+//present.c
+//Presentation for the SDL2 players. A picture is copied to the window
+//once, when it is due; nothing is redrawn until the next one unless the
+//window manager reports the window as exposed or resized. The wait for
+//the next deadline blocks in SDL_WaitEventTimeout, so an idle player
+//costs no CPU, and other threads can cut the sleep short with an event.
+//Pictures are converted straight into a locked streaming texture, one
+//slot ahead of the one on screen, so there is no intermediate copy and
+//the upload never waits for the renderer to finish with the texture it
+//is drawing.
+
+#include <libavutil/time.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "present.h"
+
+int presenter_init(Presenter *p, SDL_Renderer *renderer, int width, int height) {
+    int i;
+
+    memset(p, 0, sizeof(Presenter));
+    p->renderer = renderer;
+    p->width = width;
+    p->height = height;
+    p->base = INT64_MIN;
+
+    for (i = 0; i < PRESENT_RING_SIZE; i++) {
+        p->ring[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
+                                       SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (!p->ring[i])
+            break;
+        p->nb_textures++;
+    }
+    if (!p->nb_textures) {
+        fprintf(stderr, "SDL: could not create texture: %s\n", SDL_GetError());
+        return -1;
+    }
+    //the first picture is not drawn over anything
+    p->front = p->nb_textures - 1;
+    return 0;
+}
+
+void presenter_close(Presenter *p) {
+    int i;
+
+    for (i = 0; i < p->nb_textures; i++)
+        SDL_DestroyTexture(p->ring[i]);
+    p->nb_textures = 0;
+}
+
+int64_t presenter_due(Presenter *p, double pts) {
+    int64_t now = av_gettime();
+    int64_t due;
+
+    if (isnan(pts))
+        return 0;
+    due = p->base + (int64_t)(pts * 1000000);
+    //first picture, a discontinuity or we fell badly behind
+    if (p->base == INT64_MIN || due > now + PRESENT_RESYNC || due < now - PRESENT_RESYNC) {
+        p->base = now - (int64_t)(pts * 1000000);
+        due = now;
+    }
+    return due;
+}
+
+//note damage from a window event, 0 if it is no window event at all
+static int presenter_damage(Presenter *p, SDL_Event *event) {
+    switch (event->type) {
+    case SDL_WINDOWEVENT:
+        if (event->window.event == SDL_WINDOWEVENT_EXPOSED ||
+            event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            p->damaged = 1;
+        return 1;
+    case SDL_RENDER_TARGETS_RESET:
+        p->damaged = 1;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void presenter_flip(Presenter *p, int slot) {
+    //the texture covers the whole target, nothing to clear first
+    SDL_RenderCopy(p->renderer, p->ring[slot], NULL, NULL);
+    SDL_RenderPresent(p->renderer);
+    p->damaged = 0;
+}
+
+//repaint what is on screen, not the picture waiting for its time
+static void presenter_repaint(Presenter *p) {
+    if (!p->damaged || !p->shown)
+        return;
+    presenter_flip(p, p->front);
+    p->redraws++;
+}
+
+int presenter_wait(Presenter *p, int64_t due) {
+    SDL_Event event;
+    int64_t left;
+    int got;
+
+    for (;;) {
+        left = due - av_gettime();
+        if (due < 0)
+            got = SDL_WaitEvent(&event);
+        else if (left > 0)
+            got = SDL_WaitEventTimeout(&event, (int)((left + 999) / 1000));
+        else
+            got = SDL_PollEvent(&event);
+        if (!got)
+            return 0;   //deadline reached, or nothing queued
+        if (event.type == SDL_QUIT)
+            return -1;
+        if (!presenter_damage(p, &event))
+            return 1;
+        presenter_repaint(p);
+    }
+}
+
+int presenter_lock(Presenter *p, uint8_t *data[4], int linesize[4]) {
+    void *pixels;
+    int pitch, chroma_h = (p->height + 1) / 2;
+
+    if (SDL_LockTexture(p->ring[p->back], NULL, &pixels, &pitch) < 0) {
+        fprintf(stderr, "SDL: could not lock texture: %s\n", SDL_GetError());
+        return -1;
+    }
+    //YV12 is Y, then V, then U, chroma pitch is half the luma pitch
+    data[0] = pixels;
+    linesize[0] = pitch;
+    linesize[1] = linesize[2] = (pitch + 1) / 2;
+    data[2] = data[0] + pitch * p->height;
+    data[1] = data[2] + linesize[2] * chroma_h;
+    data[3] = NULL;
+    linesize[3] = 0;
+    return 0;
+}
+
+void presenter_unlock(Presenter *p) {
+    SDL_UnlockTexture(p->ring[p->back]);
+    p->fresh = 1;
+}
+
+void presenter_present(Presenter *p) {
+    if (!p->fresh) {
+        presenter_repaint(p);
+        return;
+    }
+    presenter_flip(p, p->back);
+    p->front = p->back;
+    p->back = (p->back + 1) % p->nb_textures;
+    p->fresh = 0;
+    p->shown = 1;
+    p->presents++;
+}
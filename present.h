@@ -0,0 +1,69 @@
+//present.h
+//Puts decoded pictures on an SDL2 window when they are due, redraws the
+//last one only when the window is damaged, and sleeps on the event queue
+//in between instead of spinning. Pictures are written straight into a
+//small ring of streaming YV12 textures.
+
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <SDL.h>
+
+#include <stdint.h>
+
+#define PRESENT_RESYNC      1000000 //a pts jump this large (us) restarts the timing
+#define PRESENT_RING_SIZE   3       //on screen, being filled, one spare
+
+typedef struct Presenter {
+    SDL_Renderer    *renderer;
+    SDL_Texture     *ring[PRESENT_RING_SIZE];
+    int             nb_textures;
+    int             width, height;
+    int             front;      //ring slot on screen
+    int             back;       //ring slot the next picture goes to
+    int64_t         base;       //av_gettime() at pts 0, INT64_MIN until the first picture
+    int             fresh;      //the back slot holds a picture not presented yet
+    int             damaged;    //the window lost what was presented last
+    int             shown;      //something has been presented at all
+    uint64_t        presents;   //new pictures
+    uint64_t        redraws;    //repaints after damage
+}Presenter;
+
+/*
+ * Create the texture ring for width x height pictures. Fewer textures
+ * than PRESENT_RING_SIZE still work, just with less overlap. Returns -1
+ * if not even one could be created.
+ */
+int presenter_init(Presenter *p, SDL_Renderer *renderer, int width, int height);
+
+void presenter_close(Presenter *p);
+
+//wall clock time (av_gettime() units) the picture with 'pts' seconds is due
+//at, 0 (now) for a picture without a timestamp
+int64_t presenter_due(Presenter *p, double pts);
+
+/*
+ * Sleep until 'due' handling window events, repainting on damage. Pass 0
+ * to only handle what is already queued, or a negative 'due' to sleep
+ * until some other event arrives. Returns -1 as soon as the user closes
+ * the window, 1 when any other event than a window event wakes it up
+ * first (another thread pushing SDL_USEREVENT, a key), 0 at the deadline.
+ */
+int presenter_wait(Presenter *p, int64_t due);
+
+/*
+ * Lock the next ring slot for writing. data/linesize get the Y, U and V
+ * planes in that order and a NULL fourth, ready for sws_scale(). With
+ * more than one texture the slot on screen is never handed out, so the
+ * renderer can still be reading it. Returns -1 if the texture cannot be
+ * locked.
+ */
+int presenter_lock(Presenter *p, uint8_t *data[4], int linesize[4]);
+
+//done writing, the slot holds the next picture to present
+void presenter_unlock(Presenter *p);
+
+//flip to the new picture if there is one, or repaint after damage
+void presenter_present(Presenter *p);
+
+#endif
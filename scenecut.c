@@ -0,0 +1,175 @@
+//scenecut.c
+//Shot boundary detection on a block downsampled luma plane.
+//Both the downsampling and the frame difference are sums of absolute
+//differences, which SSE2 does 16 pixels at a time with psadbw, so a
+//1080p frame costs a single pass over its luma plane.
+
+#include <libavutil/mem.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "scenecut.h"
+
+#define BLOCK_PIXELS (SCENECUT_BLOCK * SCENECUT_BLOCK)
+
+//rows of the downsampled plane are padded to 16 zero bytes
+static int plane_stride(const SceneCut *sc) {
+    return (sc->bw + 15) & ~15;
+}
+
+SceneCut *scenecut_alloc(int width, int height, double threshold) {
+    SceneCut *sc;
+    size_t size;
+
+    if (width < SCENECUT_BLOCK || height < SCENECUT_BLOCK)
+        return NULL;
+
+    sc = av_mallocz(sizeof(SceneCut));
+    if (!sc)
+        return NULL;
+
+    sc->width = width;
+    sc->height = height;
+    sc->bw = width / SCENECUT_BLOCK;
+    sc->bh = height / SCENECUT_BLOCK;
+    sc->threshold = threshold > 0 ? threshold : SCENECUT_THRESHOLD;
+
+    size = (size_t)plane_stride(sc) * sc->bh;
+    sc->cur  = av_mallocz(size);
+    sc->prev = av_mallocz(size);
+    if (!sc->cur || !sc->prev)
+        scenecut_free(&sc);
+
+    return sc;
+}
+
+void scenecut_free(SceneCut **sc) {
+    if (!*sc)
+        return;
+    av_freep(&(*sc)->cur);
+    av_freep(&(*sc)->prev);
+    av_freep(sc);
+}
+
+//replace every SCENECUT_BLOCK x SCENECUT_BLOCK block by its mean
+static void downsample(SceneCut *sc, const uint8_t *luma, int linesize) {
+    int stride = plane_stride(sc);
+    int bx, by, x, y;
+
+    for (by = 0; by < sc->bh; by++) {
+        const uint8_t *src = luma + (ptrdiff_t)by * SCENECUT_BLOCK * linesize;
+        uint8_t *dst = sc->cur + by * stride;
+
+        bx = 0;
+#if defined(__SSE2__) && SCENECUT_BLOCK == 8
+        {
+            const __m128i zero = _mm_setzero_si128();
+
+            //psadbw against zero sums each 8 byte half, i.e. two blocks
+            for (; bx + 2 <= sc->bw; bx += 2) {
+                __m128i acc = zero;
+                for (y = 0; y < SCENECUT_BLOCK; y++) {
+                    __m128i row = _mm_loadu_si128((const __m128i *)(src + y * linesize + bx * 8));
+                    acc = _mm_add_epi64(acc, _mm_sad_epu8(row, zero));
+                }
+                dst[bx]     = (_mm_cvtsi128_si32(acc) + BLOCK_PIXELS / 2) / BLOCK_PIXELS;
+                dst[bx + 1] = (_mm_extract_epi16(acc, 4) + BLOCK_PIXELS / 2) / BLOCK_PIXELS;
+            }
+        }
+#endif
+        for (; bx < sc->bw; bx++) {
+            int sum = 0;
+            for (y = 0; y < SCENECUT_BLOCK; y++)
+                for (x = 0; x < SCENECUT_BLOCK; x++)
+                    sum += src[y * linesize + bx * SCENECUT_BLOCK + x];
+            dst[bx] = (sum + BLOCK_PIXELS / 2) / BLOCK_PIXELS;
+        }
+    }
+}
+
+//sum of |a - b| over 'size' bytes, size is a multiple of 16
+static uint64_t sad(const uint8_t *a, const uint8_t *b, size_t size) {
+    uint64_t sum = 0;
+    size_t i = 0;
+
+    //_mm_cvtsi128_si64 only exists on x86-64
+#if defined(__SSE2__) && defined(__x86_64__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i < size; i += 16) {
+        __m128i va = _mm_load_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_load_si128((const __m128i *)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sum = (uint64_t)_mm_cvtsi128_si64(acc) +
+          (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+#endif
+    for (; i < size; i++)
+        sum += abs(a[i] - b[i]);
+
+    return sum;
+}
+
+//mean absolute deviation of the block means from their average
+static double plane_detail(const SceneCut *sc) {
+    DECLARE_ALIGNED(16, uint8_t, flat)[16];
+    size_t size = (size_t)plane_stride(sc) * sc->bh;
+    size_t nb = (size_t)sc->bw * sc->bh;
+    uint64_t total = 0, dev = 0;
+    size_t i;
+    int mean;
+
+    //the padding bytes are zero, so they add nothing to the sum
+    memset(flat, 0, sizeof(flat));
+    for (i = 0; i < size; i += 16)
+        total += sad(sc->cur + i, flat, 16);
+    mean = (int)((total + nb / 2) / nb);
+
+    //compare against a flat plane, then take the padding back out
+    memset(flat, mean, sizeof(flat));
+    for (i = 0; i < size; i += 16)
+        dev += sad(sc->cur + i, flat, 16);
+    dev -= (uint64_t)(size - nb) * mean;
+
+    return (double)dev / nb;
+}
+
+int scenecut_feed(SceneCut *sc, const uint8_t *luma, int linesize, double *detail) {
+    size_t size = (size_t)plane_stride(sc) * sc->bh;
+    uint8_t *tmp;
+    double diff;
+    int cut = 0;
+
+    downsample(sc, luma, linesize);
+    if (detail)
+        *detail = plane_detail(sc);
+
+    if (sc->nb_frames > 0) {
+        diff = (double)sad(sc->cur, sc->prev, size) / ((double)sc->bw * sc->bh);
+
+        //a cut has to stand out from both the fixed threshold and the
+        //recent motion level, and flashes shorter than a shot are ignored
+        if (sc->shot_frames >= SCENECUT_MIN_SHOT &&
+            diff > sc->threshold && diff > 3.0 * sc->avg_diff) {
+            cut = 1;
+        } else if (sc->nb_frames == 1) {
+            sc->avg_diff = diff;
+        } else {
+            sc->avg_diff = 0.9 * sc->avg_diff + 0.1 * diff;
+        }
+    }
+
+    sc->shot_frames = cut ? 1 : sc->shot_frames + 1;
+    sc->nb_frames++;
+
+    tmp = sc->prev;
+    sc->prev = sc->cur;
+    sc->cur = tmp;
+
+    return cut;
+}
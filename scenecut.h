@@ -0,0 +1,35 @@
+//scenecut.h
+//Shot boundary detection on the decoded luma plane.
+
+#ifndef SCENECUT_H
+#define SCENECUT_H
+
+#include <stdint.h>
+
+//the luma plane is reduced to one mean per SCENECUT_BLOCK^2 block
+#define SCENECUT_BLOCK      8
+#define SCENECUT_THRESHOLD  14.0    //mean abs block difference, 0..255
+#define SCENECUT_MIN_SHOT   12      //frames
+
+typedef struct SceneCut {
+    int     width, height;  //of the luma planes it takes
+    int     bw, bh;         //downsampled plane size in blocks
+    uint8_t *cur, *prev;    //block means of this and the previous frame
+    double  threshold;
+    double  avg_diff;       //running average of the frame differences
+    int     nb_frames;
+    int     shot_frames;    //frames since the last cut
+}SceneCut;
+
+SceneCut *scenecut_alloc(int width, int height, double threshold);
+void scenecut_free(SceneCut **sc);
+
+/*
+ * Feed the 8 bit luma plane of the next frame. Returns 1 if the frame
+ * starts a new shot, 0 otherwise. If 'detail' is not NULL it is set to
+ * how much structure the frame has (0 for flat, e.g. black, frames),
+ * which is what makes a frame a good representative of its shot.
+ */
+int scenecut_feed(SceneCut *sc, const uint8_t *luma, int linesize, double *detail);
+
+#endif
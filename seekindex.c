@@ -0,0 +1,286 @@
+//seekindex.c
+//Builds, maps and searches the keyframe sidecar index.
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "seekindex.h"
+
+typedef struct EntryList {
+    SeekIndexEntry  *entries;
+    int             nb_entries;
+    int             nb_alloc;
+    int64_t         last_pts;   //of the last entry, for audio decimation
+}EntryList;
+
+static void index_filename(char *buf, size_t size, const char *filename) {
+    snprintf(buf, size, "%s%s", filename, SEEK_INDEX_SUFFIX);
+}
+
+static int add_entry(EntryList *list, int64_t pts, int64_t pos) {
+    if (list->nb_entries == list->nb_alloc) {
+        int nb_alloc = list->nb_alloc ? list->nb_alloc * 2 : 256;
+        SeekIndexEntry *entries = av_realloc_array(list->entries, nb_alloc,
+                                                   sizeof(SeekIndexEntry));
+        if (!entries)
+            return -1;
+        list->entries = entries;
+        list->nb_alloc = nb_alloc;
+    }
+    list->entries[list->nb_entries].pts = pts;
+    list->entries[list->nb_entries].pos = pos;
+    list->nb_entries++;
+    list->last_pts = pts;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const SeekIndexEntry *ea = a, *eb = b;
+    return ea->pts < eb->pts ? -1 : ea->pts > eb->pts;
+}
+
+static int write_index(const char *filename, const struct stat *st,
+                       AVFormatContext *pFormatCtx, EntryList *lists) {
+    char name[1024], tmpname[1040];
+    SeekIndexHeader hdr;
+    SeekIndexStream *streams;
+    uint64_t offset;
+    FILE *pFile;
+    int i, ret = 0;
+
+    streams = av_mallocz_array(pFormatCtx->nb_streams, sizeof(SeekIndexStream));
+    if (!streams)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SEEK_INDEX_MAGIC, 4);
+    hdr.version    = SEEK_INDEX_VERSION;
+    hdr.file_size  = st->st_size;
+    hdr.file_mtime = st->st_mtime;
+    hdr.nb_streams = pFormatCtx->nb_streams;
+
+    offset = sizeof(hdr) + pFormatCtx->nb_streams * sizeof(SeekIndexStream);
+    for (i = 0; i < pFormatCtx->nb_streams; i++) {
+        AVStream *st = pFormatCtx->streams[i];
+        streams[i].codec_type = st->codec->codec_type;
+        streams[i].codec_id   = st->codec->codec_id;
+        streams[i].tb_num     = st->time_base.num;
+        streams[i].tb_den     = st->time_base.den;
+        streams[i].offset     = offset;
+        streams[i].nb_entries = lists[i].nb_entries;
+        offset += lists[i].nb_entries * sizeof(SeekIndexEntry);
+    }
+
+    //write to a temporary name first so readers never map half a file
+    index_filename(name, sizeof(name), filename);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+    pFile = fopen(tmpname, "wb");
+    if (pFile == NULL) {
+        av_free(streams);
+        return -1;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, pFile) != 1 ||
+        fwrite(streams, sizeof(SeekIndexStream), pFormatCtx->nb_streams, pFile) != pFormatCtx->nb_streams)
+        ret = -1;
+    for (i = 0; i < pFormatCtx->nb_streams && ret == 0; i++) {
+        if (fwrite(lists[i].entries, sizeof(SeekIndexEntry), lists[i].nb_entries, pFile) != lists[i].nb_entries)
+            ret = -1;
+    }
+    if (fclose(pFile) != 0)
+        ret = -1;
+    if (ret == 0 && rename(tmpname, name) != 0)
+        ret = -1;
+    if (ret < 0)
+        unlink(tmpname);
+
+    av_free(streams);
+    return ret;
+}
+
+int seek_index_build(const char *filename) {
+    AVFormatContext *pFormatCtx = NULL;
+    AVPacket packet;
+    EntryList *lists;
+    struct stat st;
+    int i, nb_entries = 0, ret;
+
+    if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+        return -1;  //only local files can be checked for staleness
+
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(pFormatCtx, NULL) < 0) {
+        avformat_close_input(&pFormatCtx);
+        return -1;
+    }
+
+    lists = av_mallocz_array(pFormatCtx->nb_streams, sizeof(EntryList));
+    if (!lists) {
+        avformat_close_input(&pFormatCtx);
+        return -1;
+    }
+    for (i = 0; i < pFormatCtx->nb_streams; i++)
+        lists[i].last_pts = AV_NOPTS_VALUE;
+
+    //one pass over the packets, nothing is decoded
+    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+        AVStream *stream;
+        EntryList *list;
+        int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+
+        //streams may appear while reading (e.g. MPEG-TS), skip those
+        if (packet.stream_index >= pFormatCtx->nb_streams ||
+            !(packet.flags & AV_PKT_FLAG_KEY) || pts == AV_NOPTS_VALUE) {
+            av_free_packet(&packet);
+            continue;
+        }
+        stream = pFormatCtx->streams[packet.stream_index];
+        list = &lists[packet.stream_index];
+
+        if (stream->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
+            list->last_pts != AV_NOPTS_VALUE &&
+            (pts - list->last_pts) * av_q2d(stream->time_base) < SEEK_INDEX_AUDIO_INTERVAL) {
+            av_free_packet(&packet);
+            continue;
+        }
+
+        if (add_entry(list, pts, packet.pos) < 0) {
+            av_free_packet(&packet);
+            break;
+        }
+        av_free_packet(&packet);
+    }
+
+    //reordered keyframes (open GOPs) may be slightly out of order
+    for (i = 0; i < pFormatCtx->nb_streams; i++) {
+        qsort(lists[i].entries, lists[i].nb_entries, sizeof(SeekIndexEntry), compare_entries);
+        nb_entries += lists[i].nb_entries;
+    }
+
+    ret = write_index(filename, &st, pFormatCtx, lists);
+
+    for (i = 0; i < pFormatCtx->nb_streams; i++)
+        av_free(lists[i].entries);
+    av_free(lists);
+    avformat_close_input(&pFormatCtx);
+
+    return ret < 0 ? ret : nb_entries;
+}
+
+SeekIndex *seek_index_open(const char *filename) {
+    char name[1024];
+    struct stat st, ist;
+    SeekIndex *idx;
+    const SeekIndexHeader *hdr;
+    uint8_t *map;
+    size_t size;
+    int fd, i;
+
+    if (stat(filename, &st) < 0)
+        return NULL;
+
+    index_filename(name, sizeof(name), filename);
+    fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &ist) < 0 || ist.st_size < sizeof(SeekIndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size = ist.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = (const SeekIndexHeader *)map;
+    if (memcmp(hdr->magic, SEEK_INDEX_MAGIC, 4) ||
+        hdr->version != SEEK_INDEX_VERSION ||
+        hdr->file_size != st.st_size || hdr->file_mtime != st.st_mtime ||
+        sizeof(SeekIndexHeader) + (uint64_t)hdr->nb_streams * sizeof(SeekIndexStream) > size)
+        goto stale;
+
+    idx = av_mallocz(sizeof(SeekIndex));
+    if (!idx)
+        goto stale;
+    idx->map      = map;
+    idx->map_size = size;
+    idx->hdr      = hdr;
+    idx->streams  = (const SeekIndexStream *)(map + sizeof(SeekIndexHeader));
+
+    //never trust offsets read from disk
+    for (i = 0; i < hdr->nb_streams; i++) {
+        const SeekIndexStream *s = &idx->streams[i];
+        if (s->offset > size || s->nb_entries > (size - s->offset) / sizeof(SeekIndexEntry)) {
+            av_free(idx);
+            goto stale;
+        }
+    }
+
+    return idx;
+
+stale:
+    munmap(map, size);
+    return NULL;
+}
+
+void seek_index_close(SeekIndex **idx) {
+    if (!*idx)
+        return;
+    munmap((*idx)->map, (*idx)->map_size);
+    av_freep(idx);
+}
+
+const SeekIndexEntry *seek_index_lookup(const SeekIndex *idx, int stream, int64_t ts) {
+    const SeekIndexEntry *entries;
+    uint64_t lo, hi;
+
+    if (!idx || stream < 0 || stream >= idx->hdr->nb_streams)
+        return NULL;
+
+    entries = (const SeekIndexEntry *)(idx->map + idx->streams[stream].offset);
+    lo = 0;
+    hi = idx->streams[stream].nb_entries;
+    if (hi == 0 || entries[0].pts > ts)
+        return NULL;
+
+    //invariant: entries[lo].pts <= ts, and everything from hi on is > ts
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].pts <= ts)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &entries[lo];
+}
+
+//Demuxers that resync on any packet start and keep no state of their
+//own about where they are. A byte seek skips read_seek(), which
+//matroska, avi, flv and the like need to set up their reading state.
+#define SEEK_INDEX_BYTE_FORMATS "mpegts,mpeg,h264,hevc,mpegvideo,m4v,cavsvideo,vc1"
+
+int64_t seek_index_seek(AVFormatContext *ic, const SeekIndex *idx, int stream, int64_t ts) {
+    const SeekIndexEntry *e = seek_index_lookup(idx, stream, ts);
+
+    if (!e)
+        return AV_NOPTS_VALUE;
+
+    if (e->pos >= 0 && !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+        av_match_name(ic->iformat->name, SEEK_INDEX_BYTE_FORMATS)) {
+        if (av_seek_frame(ic, stream, e->pos, AVSEEK_FLAG_BYTE) >= 0)
+            return e->pts;
+    }
+    if (av_seek_frame(ic, stream, e->pts, AVSEEK_FLAG_BACKWARD) >= 0)
+        return e->pts;
+
+    return AV_NOPTS_VALUE;
+}
@@ -0,0 +1,84 @@
+//seekindex.h
+//Keyframe index stored next to the media file ("movie.ts.avix") so that
+//seeks do not depend on the demuxer's own index or on scanning the file.
+
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <libavformat/avformat.h>
+
+#define SEEK_INDEX_MAGIC    "AVIX"
+#define SEEK_INDEX_VERSION  1
+#define SEEK_INDEX_SUFFIX   ".avix"
+
+//audio streams get one entry per this many seconds instead of per packet
+#define SEEK_INDEX_AUDIO_INTERVAL 0.5
+
+/*
+ * On disk layout, all fields in host byte order:
+ *   SeekIndexHeader
+ *   SeekIndexStream[nb_streams]
+ *   SeekIndexEntry[] for stream 0, stream 1, ... sorted by pts
+ */
+typedef struct SeekIndexHeader {
+    char        magic[4];
+    uint32_t    version;
+    int64_t     file_size;  //of the indexed media file, to detect staleness
+    int64_t     file_mtime;
+    uint32_t    nb_streams;
+    uint32_t    reserved;
+}SeekIndexHeader;
+
+typedef struct SeekIndexStream {
+    int32_t     codec_type; //enum AVMediaType
+    int32_t     codec_id;   //enum AVCodecID
+    int32_t     tb_num, tb_den;
+    uint64_t    offset;     //of the first entry, from the start of the file
+    uint64_t    nb_entries;
+}SeekIndexStream;
+
+typedef struct SeekIndexEntry {
+    int64_t     pts;        //in the stream time base
+    int64_t     pos;        //byte offset of the packet, -1 if unknown
+}SeekIndexEntry;
+
+typedef struct SeekIndex {
+    uint8_t                 *map;
+    size_t                  map_size;
+    const SeekIndexHeader   *hdr;
+    const SeekIndexStream   *streams;
+}SeekIndex;
+
+/*
+ * Scan 'filename' once and write its sidecar index.
+ * Returns the number of indexed entries, or a negative value on error.
+ */
+int seek_index_build(const char *filename);
+
+/*
+ * Map the sidecar of 'filename'. Returns NULL if there is none, or if it
+ * has the wrong version or was made for a different size/mtime.
+ */
+SeekIndex *seek_index_open(const char *filename);
+void seek_index_close(SeekIndex **idx);
+
+/*
+ * Binary search for the last keyframe of 'stream' with pts <= ts.
+ * Returns NULL if there is none (ts before the first keyframe).
+ */
+const SeekIndexEntry *seek_index_lookup(const SeekIndex *idx, int stream, int64_t ts);
+
+/*
+ * Seek 'ic' to the keyframe at or before 'ts' (time base of 'stream').
+ * Uses a byte seek for MPEG-TS, MPEG-PS and raw elementary streams,
+ * where a packet's position is a safe place to resume reading, the
+ * keyframe's exact pts otherwise. Returns the pts of that keyframe, or
+ * AV_NOPTS_VALUE when the index could not help and the caller should
+ * fall back to av_seek_frame().
+ */
+int64_t seek_index_seek(AVFormatContext *ic, const SeekIndex *idx, int stream, int64_t ts);
+
+#endif
@@ -0,0 +1,63 @@
+//shmreader.c
+//A sample consumer of the frames "tutorial05 -shm NAME" publishes. It
+//reads every frame in place from shared memory and prints its number,
+//time, size and the mean of its first plane, then the frames it lost.
+//Use
+//gcc -o shmreader shmreader.c shmring.c
+//and run it while tutorial05 plays: shmreader NAME [-timeout MS]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shmring.h"
+
+//what an analytics process would do with the picture
+static double plane_mean(const uint8_t *plane, int linesize, int width, int height) {
+    uint64_t sum = 0;
+    int x, y;
+
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            sum += plane[y * linesize + x];
+    return width && height ? (double)sum / ((uint64_t)width * height) : 0;
+}
+
+int main(int argc, char **argv) {
+    const ShmSlot *slot;
+    const uint8_t *data;
+    ShmRing *ring;
+    int timeout = -1, frames = 0, ret;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: shmreader NAME [-timeout MS]\n");
+        return 1;
+    }
+    if (argc > 3 && !strcmp(argv[2], "-timeout"))
+        timeout = atoi(argv[3]);
+
+    ring = shm_ring_open(argv[1]);
+    if (!ring) {
+        fprintf(stderr, "%s: no frames published under this name\n", argv[1]);
+        return 1;
+    }
+
+    while ((ret = shm_ring_acquire(ring, &slot, &data, timeout)) == 0) {
+        //the first plane's bytes per pixel are not known here, the mean
+        //is over the bytes of every line
+        int width = slot->linesize[0] < slot->width ? slot->linesize[0] : slot->width;
+
+        printf("frame %u: %.3f s, %dx%d %s, plane 0 mean %.1f\n", slot->frame,
+               slot->pts / 1000000.0, slot->width, slot->height, slot->format_name,
+               plane_mean(data + slot->offset[0], slot->linesize[0], width, slot->height));
+        shm_ring_release(ring, slot);
+        frames++;
+    }
+    if (ret > 0)
+        fprintf(stderr, "no frame for %d ms\n", timeout);
+
+    fprintf(stderr, "%s: %d frames read, %u lost, %u dropped by the producer\n", argv[1],
+            frames, shm_ring_lost(ring), shm_ring_dropped(ring));
+    shm_ring_close(&ring);
+    return 0;
+}
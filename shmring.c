@@ -0,0 +1,282 @@
+//shmring.c
+//Every field that both sides change is accessed with __atomic builtins,
+//the mapping is the same memory in every process. The two handshakes,
+//a consumer holding a slot against the producer starting to write it,
+//and a consumer going to sleep against the producer publishing, are
+//each a store followed by a load of the other side's variable, both
+//sequentially consistent, so at least one side sees the other.
+//
+//Consumers sleep in FUTEX_WAIT on 'wakeups', which they read before
+//looking for a frame. Anything the producer does after that changes it
+//and the wait returns at once, so no wake up is missed. The futexes are
+//not private, they have to work across processes.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shmring.h"
+
+#define ALIGN_UP(x) (((x) + SHM_RING_ALIGN - 1) & ~(size_t)(SHM_RING_ALIGN - 1))
+
+struct ShmRing {
+    char            name[256];
+    int             producer;
+    int             shut_down;      //producer, shm_ring_shutdown() ran
+    uint8_t         *map;
+    size_t          map_size;
+    ShmRingHeader   *hdr;
+    ShmSlot         *slots;
+    uint8_t         *data;
+    uint32_t        next;           //consumer, the next frame to read
+    uint32_t        lost;
+};
+
+static void futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void wake_consumers(ShmRingHeader *hdr) {
+    __atomic_add_fetch(&hdr->wakeups, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST))
+        futex_wake(&hdr->wakeups);
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+//"name" or "/name", shm_open() wants the slash
+static void set_name(ShmRing *r, const char *name) {
+    snprintf(r->name, sizeof(r->name), "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+static void map_layout(ShmRing *r) {
+    r->hdr = (ShmRingHeader *)r->map;
+    r->slots = (ShmSlot *)(r->map + ALIGN_UP(sizeof(ShmRingHeader)));
+    r->data = r->map + r->hdr->data_offset;
+}
+
+ShmRing *shm_ring_create(const char *name, int nb_slots, size_t slot_size) {
+    ShmRing *r;
+    size_t data_offset;
+    int fd;
+
+    if (nb_slots < 2 || nb_slots > SHM_RING_MAX_SLOTS || !slot_size ||
+        slot_size > UINT32_MAX - SHM_RING_ALIGN)
+        return NULL;
+    r = calloc(1, sizeof(ShmRing));
+    if (!r)
+        return NULL;
+    set_name(r, name);
+    r->producer = 1;
+
+    slot_size = ALIGN_UP(slot_size);
+    data_offset = ALIGN_UP(ALIGN_UP(sizeof(ShmRingHeader)) + nb_slots * sizeof(ShmSlot));
+    r->map_size = data_offset + nb_slots * slot_size;
+
+    //a ring left by a producer that crashed goes, its consumers keep
+    //their mapping of the old one, closed never
+    shm_unlink(r->name);
+    fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        free(r);
+        return NULL;
+    }
+    if (ftruncate(fd, r->map_size) < 0) {
+        close(fd);
+        shm_unlink(r->name);
+        free(r);
+        return NULL;
+    }
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        shm_unlink(r->name);
+        free(r);
+        return NULL;
+    }
+
+    //ftruncate() zeroed it, every slot's sequence says never written
+    r->hdr = (ShmRingHeader *)r->map;
+    r->hdr->version = SHM_RING_VERSION;
+    r->hdr->nb_slots = nb_slots;
+    r->hdr->slot_size = slot_size;
+    r->hdr->data_offset = data_offset;
+    map_layout(r);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(r->hdr->magic, SHM_RING_MAGIC, 4);
+    return r;
+}
+
+ShmSlot *shm_ring_begin(ShmRing *r, uint8_t **data) {
+    ShmRingHeader *hdr = r->hdr;
+    uint32_t n = hdr->published;    //only ever changed by this thread
+    uint32_t i = n % hdr->nb_slots;
+    ShmSlot *slot = &r->slots[i];
+    uint32_t prev = slot->sequence;
+
+    __atomic_store_n(&slot->sequence, 2 * n + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->readers, __ATOMIC_SEQ_CST)) {
+        //a consumer is still on the old frame, it stays readable
+        __atomic_store_n(&slot->sequence, prev, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&hdr->dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    slot->frame = n;
+    *data = r->data + (size_t)i * hdr->slot_size;
+    return slot;
+}
+
+void shm_ring_publish(ShmRing *r, ShmSlot *slot) {
+    ShmRingHeader *hdr = r->hdr;
+    uint32_t n = slot->frame;
+
+    __atomic_store_n(&slot->sequence, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->published, n + 1, __ATOMIC_RELEASE);
+    wake_consumers(hdr);
+}
+
+void shm_ring_shutdown(ShmRing *r) {
+    if (!r || !r->producer || __atomic_exchange_n(&r->shut_down, 1, __ATOMIC_ACQ_REL))
+        return;
+    __atomic_store_n(&r->hdr->closed, 1, __ATOMIC_RELEASE);
+    wake_consumers(r->hdr);
+    shm_unlink(r->name);
+}
+
+ShmRing *shm_ring_open(const char *name) {
+    const ShmRingHeader *hdr;
+    struct stat st;
+    ShmRing *r;
+    char magic[4];
+    int fd;
+
+    r = calloc(1, sizeof(ShmRing));
+    if (!r)
+        return NULL;
+    set_name(r, name);
+    fd = shm_open(r->name, O_RDWR, 0);
+    if (fd < 0) {
+        free(r);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ShmRingHeader)) {
+        close(fd);
+        free(r);
+        return NULL;
+    }
+    //readers count themselves in the slots, so the mapping is writable
+    r->map_size = st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        free(r);
+        return NULL;
+    }
+
+    //never trust the sizes read from the mapping
+    hdr = (const ShmRingHeader *)r->map;
+    memcpy(magic, hdr->magic, 4);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (memcmp(magic, SHM_RING_MAGIC, 4) || hdr->version != SHM_RING_VERSION ||
+        hdr->nb_slots < 2 || hdr->nb_slots > SHM_RING_MAX_SLOTS ||
+        hdr->data_offset < ALIGN_UP(sizeof(ShmRingHeader)) + hdr->nb_slots * sizeof(ShmSlot) ||
+        hdr->data_offset + (uint64_t)hdr->nb_slots * hdr->slot_size > r->map_size) {
+        munmap(r->map, r->map_size);
+        free(r);
+        return NULL;
+    }
+    map_layout(r);
+    r->next = __atomic_load_n(&r->hdr->published, __ATOMIC_ACQUIRE);
+    return r;
+}
+
+int shm_ring_acquire(ShmRing *r, const ShmSlot **slot, const uint8_t **data, int timeout_ms) {
+    ShmRingHeader *hdr = r->hdr;
+    int64_t deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : 0;
+
+    for (;;) {
+        uint32_t wakeups = __atomic_load_n(&hdr->wakeups, __ATOMIC_ACQUIRE);
+        uint32_t published = __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE);
+        uint32_t behind = published - r->next;
+        struct timespec ts, *timeout = NULL;
+
+        if (behind > 0) {
+            uint32_t i;
+            ShmSlot *s;
+
+            //the oldest frames are overwritten already
+            if (behind > hdr->nb_slots) {
+                r->lost += behind - hdr->nb_slots;
+                r->next = published - hdr->nb_slots;
+            }
+            i = r->next % hdr->nb_slots;
+            s = &r->slots[i];
+            __atomic_add_fetch(&s->readers, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&s->sequence, __ATOMIC_SEQ_CST) == 2 * r->next + 2) {
+                r->next++;
+                *slot = s;
+                *data = r->data + (size_t)i * hdr->slot_size;
+                return 0;
+            }
+            //the producer got there first
+            __atomic_sub_fetch(&s->readers, 1, __ATOMIC_RELEASE);
+            r->lost++;
+            r->next++;
+            continue;
+        }
+
+        if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE))
+            return -1;
+        if (timeout_ms >= 0) {
+            int64_t left = deadline - monotonic_ms();
+
+            if (left <= 0)
+                return 1;
+            ts.tv_sec = left / 1000;
+            ts.tv_nsec = left % 1000 * 1000000;
+            timeout = &ts;
+        }
+        __atomic_add_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait(&hdr->wakeups, wakeups, timeout);
+        __atomic_sub_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void shm_ring_release(ShmRing *r, const ShmSlot *slot) {
+    (void)r;
+    __atomic_sub_fetch(&((ShmSlot *)slot)->readers, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t shm_ring_lost(ShmRing *r) {
+    return r->lost;
+}
+
+uint32_t shm_ring_dropped(ShmRing *r) {
+    return __atomic_load_n(&r->hdr->dropped, __ATOMIC_RELAXED);
+}
+
+void shm_ring_close(ShmRing **r) {
+    if (!*r)
+        return;
+    shm_ring_shutdown(*r);
+    munmap((*r)->map, (*r)->map_size);
+    free(*r);
+    *r = NULL;
+}
@@ -0,0 +1,112 @@
+//shmring.h
+//A ring of fixed size picture slots in POSIX shared memory, written by
+//one process and read in place by any number of others on the same
+//host. The producer never waits for a consumer, a consumer sleeps on a
+//futex until the next frame is out. Nothing here needs FFmpeg, a
+//consumer only builds shmring.c.
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC      "FRSH"
+#define SHM_RING_VERSION    1
+#define SHM_RING_MAX_PLANES 4
+#define SHM_RING_MAX_SLOTS  64
+#define SHM_RING_ALIGN      64      //slots, planes and lines start on a cache line
+
+/*
+ * Shared layout, all fields in host byte order:
+ *   ShmRingHeader
+ *   ShmSlot[nb_slots]
+ *   picture data of every slot, slot_size bytes each, from data_offset
+ *
+ * Frame n goes to slot n % nb_slots. While it is written the slot's
+ * sequence is 2n + 1, once it is complete 2n + 2 and 'published' is
+ * n + 1. A consumer holds a slot by counting itself in 'readers' and
+ * then checking the sequence, the producer marks the slot and then
+ * checks 'readers'; one of them always sees the other, so a held slot
+ * is never written. The producer drops a frame rather than wait, a
+ * consumer that dies holding a slot stalls the ring until it is
+ * created again.
+ * Consumers sleep on 'wakeups', read before they look for a frame.
+ */
+typedef struct ShmRingHeader {
+    char        magic[4];           //written last, once the ring is ready
+    uint32_t    version;
+    uint32_t    nb_slots;
+    uint32_t    slot_size;          //bytes of picture data per slot
+    uint64_t    data_offset;        //of slot 0's data, slot i's follows i * slot_size later
+    uint32_t    published;          //frames so far
+    uint32_t    wakeups;            //bumped on every publish and at shutdown, the futex
+    uint32_t    waiters;            //consumers asleep, no wake up call without
+    uint32_t    closed;             //the producer has gone
+    uint32_t    dropped;            //frames whose slot was held
+}ShmRingHeader;
+
+typedef struct ShmSlot {
+    uint32_t    sequence;
+    uint32_t    readers;
+    uint32_t    frame;              //n
+    int32_t     width, height;
+    int32_t     format;             //enum AVPixelFormat
+    char        format_name[16];    //av_get_pix_fmt_name() of 'format'
+    int64_t     pts;                //microseconds on the producer's timeline
+    int32_t     linesize[SHM_RING_MAX_PLANES];
+    uint32_t    offset[SHM_RING_MAX_PLANES];    //of each plane in the slot's data
+}ShmSlot;
+
+typedef struct ShmRing ShmRing;
+
+/*
+ * Producer side. Create the ring "/name" for 'nb_slots' pictures of up
+ * to 'slot_size' bytes, replacing a ring of that name left behind by a
+ * process that died. Returns NULL on failure.
+ */
+ShmRing *shm_ring_create(const char *name, int nb_slots, size_t slot_size);
+
+/*
+ * The slot for the next frame and its picture data, which the producer
+ * fills in along with the slot's fields. NULL if a consumer still holds
+ * that slot, the frame is then counted as dropped.
+ */
+ShmSlot *shm_ring_begin(ShmRing *r, uint8_t **data);
+
+//make the frame started with shm_ring_begin() visible and wake consumers
+void shm_ring_publish(ShmRing *r, ShmSlot *slot);
+
+/*
+ * Producer: mark the ring closed, wake every consumer and remove its
+ * name, safe from another thread while frames are written. The mapping
+ * stays until shm_ring_close().
+ */
+void shm_ring_shutdown(ShmRing *r);
+
+/*
+ * Consumer side. Open the ring "/name" of a running producer, reading
+ * starts at the next frame published. Returns NULL if there is none.
+ */
+ShmRing *shm_ring_open(const char *name);
+
+/*
+ * Hold the slot of the next frame not read yet, waiting up to
+ * 'timeout_ms' for it, < 0 waits for ever. Frames overwritten before
+ * this consumer got to them are skipped and counted in shm_ring_lost().
+ * Returns 0 with 'slot' and 'data' set, 1 on timeout, -1 once the
+ * producer has closed the ring and every frame was read.
+ */
+int shm_ring_acquire(ShmRing *r, const ShmSlot **slot, const uint8_t **data, int timeout_ms);
+
+//let the producer reuse a slot from shm_ring_acquire()
+void shm_ring_release(ShmRing *r, const ShmSlot *slot);
+
+//frames this consumer missed, and the ring's frames dropped by the producer
+uint32_t shm_ring_lost(ShmRing *r);
+uint32_t shm_ring_dropped(ShmRing *r);
+
+//either side, the producer shuts the ring down first
+void shm_ring_close(ShmRing **r);
+
+#endif
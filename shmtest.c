@@ -0,0 +1,117 @@
+//shmtest.c
+//Stress test of shmring.c across processes. A producer publishes
+//frames as fast as it can while forked consumers, some of them slow,
+//read them in place. Every frame is filled with its number, a consumer
+//checks that no picture it holds changes under it and that frames come
+//in order. Fails if any consumer saw a torn or out of order frame or
+//did not see the ring close.
+//Use
+//gcc -o shmtest shmtest.c shmring.c -lrt
+//and run it: shmtest [FRAMES [CONSUMERS]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "shmring.h"
+
+#define TEST_SLOTS      8
+#define TEST_SLOT_SIZE  65536
+
+//a torn frame has bytes of two frame numbers
+static int frame_torn(const uint8_t *data, uint32_t frame) {
+    uint8_t v = frame & 0xff;
+    int i;
+
+    for (i = 0; i < TEST_SLOT_SIZE; i += 97)
+        if (data[i] != v)
+            return 1;
+    return data[TEST_SLOT_SIZE - 1] != v;
+}
+
+static int consumer(const char *name, int id) {
+    const ShmSlot *slot;
+    const uint8_t *data;
+    ShmRing *ring = NULL;
+    uint32_t last = 0;
+    int tries, frames = 0, bad = 0, ret;
+
+    for (tries = 0; tries < 1000 && !(ring = shm_ring_open(name)); tries++)
+        usleep(1000);
+    if (!ring) {
+        fprintf(stderr, "consumer %d: no ring\n", id);
+        return 1;
+    }
+
+    srand(id);
+    while ((ret = shm_ring_acquire(ring, &slot, &data, 2000)) == 0) {
+        if (frame_torn(data, slot->frame) || (frames && slot->frame <= last))
+            bad++;
+        last = slot->frame;
+        //the odd ones are slow, the producer has to drop frames for them
+        if (id & 1)
+            usleep(rand() % 300);
+        if (frame_torn(data, slot->frame))
+            bad++;
+        shm_ring_release(ring, slot);
+        frames++;
+    }
+
+    printf("consumer %d: %d frames, %u lost, %d bad, %s\n", id, frames,
+           shm_ring_lost(ring), bad, ret < 0 ? "closed" : "timed out");
+    shm_ring_close(&ring);
+    return bad || ret >= 0;
+}
+
+int main(int argc, char **argv) {
+    char name[64];
+    ShmRing *ring;
+    int nb_frames = argc > 1 ? atoi(argv[1]) : 20000;
+    int nb_consumers = argc > 2 ? atoi(argv[2]) : 3;
+    int i, published = 0, status, failed = 0;
+
+    snprintf(name, sizeof(name), "shmtest-%d", (int)getpid());
+    ring = shm_ring_create(name, TEST_SLOTS, TEST_SLOT_SIZE);
+    if (!ring) {
+        fprintf(stderr, "%s: could not create the ring\n", name);
+        return 1;
+    }
+    for (i = 0; i < nb_consumers; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0)
+            return consumer(name, i);
+        if (pid < 0)
+            failed = 1;
+    }
+    //let every consumer open the ring before the first frame
+    usleep(200000);
+
+    for (i = 0; i < nb_frames; i++) {
+        ShmSlot *slot;
+        uint8_t *data;
+
+        slot = shm_ring_begin(ring, &data);
+        if (!slot) {
+            usleep(20);
+            continue;
+        }
+        memset(data, slot->frame & 0xff, TEST_SLOT_SIZE);
+        slot->width = slot->height = 0;
+        slot->pts = i;
+        shm_ring_publish(ring, slot);
+        published++;
+        if (i % 7 == 0)
+            usleep(50);
+    }
+    printf("producer: %d frames published, %u dropped\n", published, shm_ring_dropped(ring));
+    shm_ring_close(&ring);
+
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            failed = 1;
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
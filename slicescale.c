@@ -0,0 +1,524 @@
+//slicescale.c
+//The workers sleep on a condition variable between pictures. A picture
+//bumps the job generation and every thread, the caller included, takes
+//slices off a shared counter until none are left. The caller waits for
+//the last one before returning, so the output is complete when the
+//picture is presented. A conversion that only drops bits from a high
+//bit depth format skips swscale and runs bitdepth.c on the same slices.
+//
+//A conversion that changes the height is cut at destination rows that
+//fall on a source row as well, so every slice scales by the frame's own
+//factor. Its context reads its source rows plus a margin on both sides
+//for the vertical filter and writes into a buffer of its own, and only
+//the rows the slice owns are copied out; the margins keep the rows next
+//to a boundary filtered from the same source rows as in one piece.
+//
+//The last few configurations stay set up, contexts, slice boundaries
+//and destination buffer, so a stream switching between a handful of
+//sizes stops allocating once each has been seen.
+
+#include <libswscale/swscale.h>
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bitdepth.h"
+#include "slicescale.h"
+
+typedef struct ScaleConfig {
+    //the key
+    int                 srcW, srcH, dstW, dstH, flags;
+    enum AVPixelFormat  srcFormat, dstFormat;
+
+    struct SwsContext   *sws[SLICE_SCALE_MAX_THREADS + 1];
+    int                 slice_y[SLICE_SCALE_MAX_THREADS + 2];
+    int                 nb_slices;      //0 for an unused entry
+    int                 sliced;         //0 when sws[0] does the whole frame
+    int                 scaled;         //sliced by destination rows, with margins
+    int                 reduce;         //bit_depth_reduce() instead of swscale
+    //a scaled slice: source rows it reads, rows of its own output above
+    //slice_y[s], and that output with the margin rows
+    int                 band_y[SLICE_SCALE_MAX_THREADS + 1];
+    int                 band_h[SLICE_SCALE_MAX_THREADS + 1];
+    int                 out_h[SLICE_SCALE_MAX_THREADS + 1];
+    int                 skip[SLICE_SCALE_MAX_THREADS + 1];
+    uint8_t             *tmp[SLICE_SCALE_MAX_THREADS + 1][4];
+    int                 tmp_linesize[SLICE_SCALE_MAX_THREADS + 1][4];
+    uint8_t             *buf[4];        //slice_scale_buffer(), on first use
+    int                 buf_linesize[4];
+    uint64_t            uses;
+    uint64_t            last_used;
+}ScaleConfig;
+
+struct SliceScale {
+    pthread_t           threads[SLICE_SCALE_MAX_THREADS];
+    int                 nb_threads;     //workers, not counting the caller
+
+    ScaleConfig         cache[SLICE_SCALE_CACHE_SIZE];
+    ScaleConfig         *cur;
+    uint64_t            clock;          //for the least recently used entry
+    uint64_t            hits, misses, evictions;
+    int                 dither;
+
+    //current job, all under mutex
+    ScaleConfig         *job;
+    int                 job_slices;
+    const uint8_t       *src[4];
+    int                 srcStride[4];
+    uint8_t             *dst[4];
+    int                 dstStride[4];
+    int                 generation;
+    int                 next_slice;
+    int                 slices_done;
+    int                 quit;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      work_cond;
+    pthread_cond_t      done_cond;
+};
+
+static int nb_planes(const AVPixFmtDescriptor *desc) {
+    int i, planes = 0;
+
+    for (i = 0; i < desc->nb_components; i++)
+        planes = FFMAX(planes, desc->comp[i].plane + 1);
+    return planes;
+}
+
+//row shift of plane 'plane', for offsetting into a slice
+static int plane_shift(const AVPixFmtDescriptor *desc, int plane) {
+    if ((plane == 1 || plane == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB))
+        return desc->log2_chroma_h;
+    return 0;
+}
+
+static void convert_slice(SliceScale *ss, const ScaleConfig *c, int s,
+                          const uint8_t *const src[4], const int srcStride[4],
+                          uint8_t *const dst[4], const int dstStride[4]) {
+    const AVPixFmtDescriptor *sdesc = av_pix_fmt_desc_get(c->srcFormat);
+    const AVPixFmtDescriptor *ddesc = av_pix_fmt_desc_get(c->dstFormat);
+    const uint8_t *sp[4], *tp[4];
+    uint8_t *dp[4];
+    int y = c->slice_y[s];
+    int h = c->slice_y[s + 1] - y;
+    int i, dls[4];
+
+    if (c->reduce) {
+        bit_depth_reduce(src, srcStride, c->srcFormat, y, h, dst, dstStride,
+                         c->srcW, ss->dither);
+        return;
+    }
+    if (c->scaled) {
+        for (i = 0; i < 4; i++) {
+            int band = c->band_y[s] >> plane_shift(sdesc, i);
+            int skip = c->skip[s] >> plane_shift(ddesc, i);
+
+            sp[i] = i < nb_planes(sdesc) ? src[i] + band * srcStride[i] : src[i];
+            dp[i] = i < nb_planes(ddesc) ? dst[i] + (y >> plane_shift(ddesc, i)) * dstStride[i] : dst[i];
+            tp[i] = i < nb_planes(ddesc) ? c->tmp[s][i] + skip * c->tmp_linesize[s][i] : NULL;
+            dls[i] = dstStride[i];
+        }
+        //the margin rows stay behind in the slice's buffer
+        sws_scale(c->sws[s], sp, srcStride, 0, c->band_h[s], c->tmp[s], c->tmp_linesize[s]);
+        av_image_copy(dp, dls, tp, c->tmp_linesize[s], c->dstFormat, c->dstW, h);
+        return;
+    }
+    //planes the formats don't have are passed on untouched
+    for (i = 0; i < 4; i++) {
+        sp[i] = i < nb_planes(sdesc) ? src[i] + (y >> plane_shift(sdesc, i)) * srcStride[i] : src[i];
+        dp[i] = i < nb_planes(ddesc) ? dst[i] + (y >> plane_shift(ddesc, i)) * dstStride[i] : dst[i];
+    }
+    sws_scale(c->sws[s], sp, srcStride, 0, h, dp, dstStride);
+}
+
+//take slices of the current job until there are none left
+static void run_slices(SliceScale *ss) {
+    const ScaleConfig *c;
+    const uint8_t *src[4];
+    uint8_t *dst[4];
+    int srcStride[4], dstStride[4];
+    int s;
+
+    for (;;) {
+        pthread_mutex_lock(&ss->mutex);
+        s = ss->next_slice < ss->job_slices ? ss->next_slice++ : -1;
+        c = ss->job;
+        memcpy(src, ss->src, sizeof(src));
+        memcpy(dst, ss->dst, sizeof(dst));
+        memcpy(srcStride, ss->srcStride, sizeof(srcStride));
+        memcpy(dstStride, ss->dstStride, sizeof(dstStride));
+        pthread_mutex_unlock(&ss->mutex);
+        if (s < 0)
+            return;
+
+        convert_slice(ss, c, s, src, srcStride, dst, dstStride);
+
+        pthread_mutex_lock(&ss->mutex);
+        if (++ss->slices_done == ss->job_slices)
+            pthread_cond_signal(&ss->done_cond);
+        pthread_mutex_unlock(&ss->mutex);
+    }
+}
+
+static void *slice_worker(void *arg) {
+    SliceScale *ss = (SliceScale *)arg;
+    int seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&ss->mutex);
+        while (!ss->quit && ss->generation == seen)
+            pthread_cond_wait(&ss->work_cond, &ss->mutex);
+        seen = ss->generation;
+        if (ss->quit) {
+            pthread_mutex_unlock(&ss->mutex);
+            return NULL;
+        }
+        pthread_mutex_unlock(&ss->mutex);
+        run_slices(ss);
+    }
+}
+
+SliceScale *slice_scale_alloc(int nb_threads) {
+    SliceScale *ss;
+    int i;
+
+    ss = av_mallocz(sizeof(SliceScale));
+    if (!ss)
+        return NULL;
+    if (nb_threads <= 0)
+        nb_threads = av_cpu_count();
+    nb_threads = av_clip(nb_threads, 1, SLICE_SCALE_MAX_THREADS);
+    ss->dither = 1;
+    pthread_mutex_init(&ss->mutex, NULL);
+    pthread_cond_init(&ss->work_cond, NULL);
+    pthread_cond_init(&ss->done_cond, NULL);
+
+    //fewer workers than asked for just means bigger slices
+    for (i = 0; i < nb_threads - 1; i++) {
+        if (pthread_create(&ss->threads[i], NULL, slice_worker, ss) != 0)
+            break;
+        ss->nb_threads++;
+    }
+    return ss;
+}
+
+static void free_config(ScaleConfig *c) {
+    int i;
+
+    for (i = 0; i <= SLICE_SCALE_MAX_THREADS; i++) {
+        sws_freeContext(c->sws[i]);
+        c->sws[i] = NULL;
+        av_freep(&c->tmp[i][0]);
+    }
+    av_freep(&c->buf[0]);
+    c->nb_slices = 0;
+    c->uses = 0;
+}
+
+void slice_scale_free(SliceScale **ss) {
+    SliceScale *s = *ss;
+    int i;
+
+    if (!s)
+        return;
+    pthread_mutex_lock(&s->mutex);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->work_cond);
+    pthread_mutex_unlock(&s->mutex);
+    for (i = 0; i < s->nb_threads; i++)
+        pthread_join(s->threads[i], NULL);
+
+    for (i = 0; i < SLICE_SCALE_CACHE_SIZE; i++)
+        free_config(&s->cache[i]);
+    pthread_cond_destroy(&s->done_cond);
+    pthread_cond_destroy(&s->work_cond);
+    pthread_mutex_destroy(&s->mutex);
+    av_freep(ss);
+}
+
+/*
+ * How a vertical scale from 'srcH' to 'dstH' rows is cut: into units of
+ * 'unit_src' source and 'unit_dst' destination rows, every boundary
+ * whole chroma rows on both sides, and 'margin' units read past every
+ * slice for the filter. Returns the number of slices, 1 if the heights
+ * share no such rows or the margins would cost more than the threads
+ * save.
+ */
+static int scaled_slices(int nb_threads, int srcH, int dstH, int salign, int dalign,
+                         int *unit_src, int *unit_dst, int *nb_units, int *margin) {
+    int g = av_gcd(srcH, dstH);
+    int k = 1, nb, per;
+
+    //a half chroma row at the bottom scales chroma by another factor
+    if (srcH % salign || dstH % dalign)
+        return 1;
+    while (k <= g && ((k * (srcH / g)) % salign || (k * (dstH / g)) % dalign))
+        k++;
+    if (k > g)
+        return 1;
+    *unit_src = k * (srcH / g);
+    *unit_dst = k * (dstH / g);
+    *nb_units = (g + k - 1) / k;
+    *margin = (SLICE_SCALE_MARGIN * ((srcH + dstH - 1) / dstH) + *unit_src - 1) / *unit_src;
+
+    nb = FFMIN3(nb_threads + 1, FFMAX(srcH, dstH) / SLICE_SCALE_MIN_ROWS, *nb_units);
+    //thinner than its margins, a slice mostly redoes its neighbours' rows
+    while (nb > 1 && (*nb_units + nb - 1) / nb < 2 * *margin)
+        nb--;
+    if (nb <= 1)
+        return 1;
+    //whole units per slice may leave the last ones nothing
+    per = (*nb_units + nb - 1) / nb;
+    return (*nb_units + per - 1) / per;
+}
+
+//set up the slices of a conversion that changes the height
+static int split_scaled(ScaleConfig *c, int nb_threads,
+                        const AVPixFmtDescriptor *sdesc, const AVPixFmtDescriptor *ddesc) {
+    int unit_src, unit_dst, nb_units, margin, per, nb, i;
+
+    nb = scaled_slices(nb_threads, c->srcH, c->dstH, 1 << plane_shift(sdesc, 1),
+                       1 << plane_shift(ddesc, 1), &unit_src, &unit_dst, &nb_units, &margin);
+    if (nb <= 1)
+        return 1;
+    per = (nb_units + nb - 1) / nb;
+    nb = (nb_units + per - 1) / per;
+
+    for (i = 0; i < nb; i++) {
+        int lo = FFMAX(i * per - margin, 0);
+        int hi = FFMIN((i + 1) * per + margin, nb_units);
+        int out_y = FFMIN(lo * unit_dst, c->dstH);
+
+        c->slice_y[i] = FFMIN(i * per * unit_dst, c->dstH);
+        c->band_y[i] = FFMIN(lo * unit_src, c->srcH);
+        c->band_h[i] = FFMIN(hi * unit_src, c->srcH) - c->band_y[i];
+        c->out_h[i] = FFMIN(hi * unit_dst, c->dstH) - out_y;
+        c->skip[i] = c->slice_y[i] - out_y;
+    }
+    c->slice_y[nb] = c->dstH;
+    return nb;
+}
+
+int slice_scale_height(int srcH, int dstH) {
+    int nb_threads = av_clip(av_cpu_count(), 1, SLICE_SCALE_MAX_THREADS) - 1;
+    int most = FFMIN(nb_threads + 1, FFMAX(srcH, dstH) / SLICE_SCALE_MIN_ROWS);
+    int h, best = dstH, best_nb = 1;
+    int unit_src, unit_dst, nb_units, margin;
+
+    //the closest with the most slices
+    for (h = dstH & ~1; h >= FFMAX(dstH - dstH / SLICE_SCALE_SHRINK, 2) && best_nb < most;
+         h -= 2) {
+        int nb = scaled_slices(nb_threads, srcH, h, 2, 2, &unit_src, &unit_dst,
+                               &nb_units, &margin);
+        if (nb > best_nb) {
+            best = h;
+            best_nb = nb;
+        }
+    }
+    return best;
+}
+
+static int configure(ScaleConfig *c, int nb_threads, int srcW, int srcH,
+                     enum AVPixelFormat srcFormat, int dstW, int dstH,
+                     enum AVPixelFormat dstFormat, int flags) {
+    const AVPixFmtDescriptor *sdesc = av_pix_fmt_desc_get(srcFormat);
+    const AVPixFmtDescriptor *ddesc = av_pix_fmt_desc_get(dstFormat);
+    int nb, rows, i;
+
+    if (!sdesc || !ddesc)
+        return -1;
+    c->srcW = srcW;
+    c->srcH = srcH;
+    c->srcFormat = srcFormat;
+    c->dstW = dstW;
+    c->dstH = dstH;
+    c->dstFormat = dstFormat;
+    c->flags = flags;
+
+    //palettes live in data[1] and must not be offset
+    c->sliced = !(sdesc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)) &&
+                !(ddesc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL));
+    c->scaled = c->sliced && srcH != dstH;
+    if (c->scaled) {
+        nb = split_scaled(c, nb_threads, sdesc, ddesc);
+        if (nb == 1)
+            c->sliced = c->scaled = 0;
+    } else {
+        nb = c->sliced ? FFMIN(nb_threads + 1, srcH / SLICE_SCALE_MIN_ROWS) : 1;
+        if (nb < 1)
+            nb = 1;
+
+        //equal slices, the boundaries aligned, the last one takes the rest
+        rows = FFALIGN((srcH + nb - 1) / nb, SLICE_SCALE_ALIGN);
+        c->slice_y[0] = 0;
+        for (i = 1; i < nb; i++)
+            c->slice_y[i] = FFMIN(i * rows, srcH);
+        c->slice_y[nb] = srcH;
+        //alignment may leave nothing for the last ones
+        while (nb > 1 && c->slice_y[nb - 1] >= srcH)
+            c->slice_y[--nb] = srcH;
+        if (nb == 1)
+            c->sliced = 0;
+    }
+
+    //needs no contexts, only the slice boundaries
+    c->reduce = srcW == dstW && srcH == dstH && bit_depth_supported(srcFormat, dstFormat);
+    for (i = 0; i < nb && !c->reduce; i++) {
+        int h = c->sliced ? c->slice_y[i + 1] - c->slice_y[i] : srcH;
+
+        if (c->scaled)
+            c->sws[i] = sws_getContext(srcW, c->band_h[i], srcFormat,
+                                       dstW, c->out_h[i], dstFormat,
+                                       flags, NULL, NULL, NULL);
+        else
+            c->sws[i] = sws_getContext(srcW, h, srcFormat,
+                                       dstW, c->sliced ? h : dstH, dstFormat,
+                                       flags, NULL, NULL, NULL);
+        if (!c->sws[i] || (c->scaled && av_image_alloc(c->tmp[i], c->tmp_linesize[i], dstW,
+                                                        c->out_h[i], dstFormat, 32) < 0)) {
+            free_config(c);
+            return -1;
+        }
+    }
+    c->nb_slices = nb;
+    return 0;
+}
+
+static int same_key(const ScaleConfig *c, int srcW, int srcH, enum AVPixelFormat srcFormat,
+                    int dstW, int dstH, enum AVPixelFormat dstFormat, int flags) {
+    return c->nb_slices && c->srcW == srcW && c->srcH == srcH && c->srcFormat == srcFormat &&
+           c->dstW == dstW && c->dstH == dstH && c->dstFormat == dstFormat && c->flags == flags;
+}
+
+//only the converting thread gets here, never while a picture is in flight
+int slice_scale_config(SliceScale *ss, int srcW, int srcH, enum AVPixelFormat srcFormat,
+                       int dstW, int dstH, enum AVPixelFormat dstFormat, int flags) {
+    ScaleConfig *c = ss->cur, *lru = NULL;
+    int i;
+
+    if (!c || !same_key(c, srcW, srcH, srcFormat, dstW, dstH, dstFormat, flags)) {
+        for (c = NULL, i = 0; i < SLICE_SCALE_CACHE_SIZE && !c; i++) {
+            if (same_key(&ss->cache[i], srcW, srcH, srcFormat, dstW, dstH, dstFormat, flags))
+                c = &ss->cache[i];
+            else if (!lru || !ss->cache[i].nb_slices ||
+                     (lru->nb_slices && ss->cache[i].last_used < lru->last_used))
+                lru = &ss->cache[i];
+        }
+        if (!c) {
+            if (lru->nb_slices)
+                ss->evictions++;
+            free_config(lru);
+            ss->misses++;
+            ss->cur = NULL;
+            if (configure(lru, ss->nb_threads, srcW, srcH, srcFormat,
+                          dstW, dstH, dstFormat, flags) < 0)
+                return -1;
+            c = lru;
+        } else {
+            ss->hits++;
+        }
+        ss->cur = c;
+    } else {
+        ss->hits++;
+    }
+    c->uses++;
+    c->last_used = ++ss->clock;
+    return 0;
+}
+
+int slice_scale_buffer(SliceScale *ss, uint8_t *data[4], int linesize[4]) {
+    ScaleConfig *c = ss->cur;
+
+    if (!c)
+        return -1;
+    if (!c->buf[0] && av_image_alloc(c->buf, c->buf_linesize, c->dstW, c->dstH,
+                                     c->dstFormat, 32) < 0)
+        return -1;
+    memcpy(data, c->buf, sizeof(c->buf));
+    memcpy(linesize, c->buf_linesize, sizeof(c->buf_linesize));
+    return 0;
+}
+
+void slice_scale_get_stats(SliceScale *ss, SliceScaleStats *stats) {
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->hits = ss->hits;
+    stats->misses = ss->misses;
+    stats->evictions = ss->evictions;
+    for (i = 0; i < SLICE_SCALE_CACHE_SIZE; i++)
+        stats->nb_configs += ss->cache[i].nb_slices > 0;
+}
+
+void slice_scale_print_stats(SliceScale *ss, const char *name) {
+    SliceScaleStats st;
+    int i;
+
+    if (!ss)
+        return;
+    slice_scale_get_stats(ss, &st);
+    fprintf(stderr, "%s: scaler cache %llu hits, %llu misses, %llu evictions, %d cached\n",
+            name, (unsigned long long)st.hits, (unsigned long long)st.misses,
+            (unsigned long long)st.evictions, st.nb_configs);
+    for (i = 0; i < SLICE_SCALE_CACHE_SIZE; i++) {
+        const ScaleConfig *c = &ss->cache[i];
+
+        if (c->nb_slices)
+            fprintf(stderr, "    %dx%d %s -> %dx%d %s: %llu uses\n",
+                    c->srcW, c->srcH, av_get_pix_fmt_name(c->srcFormat),
+                    c->dstW, c->dstH, av_get_pix_fmt_name(c->dstFormat),
+                    (unsigned long long)c->uses);
+    }
+}
+
+void slice_scale_set_dither(SliceScale *ss, int dither) {
+    ss->dither = dither;
+}
+
+int slice_scale(SliceScale *ss, const uint8_t *const src[], const int srcStride[],
+                uint8_t *const dst[], const int dstStride[]) {
+    ScaleConfig *c = ss->cur;
+    int i;
+
+    if (!c)
+        return -1;
+    if (!c->sliced && c->reduce) {
+        bit_depth_reduce(src, srcStride, c->srcFormat, 0, c->srcH, dst, dstStride,
+                         c->srcW, ss->dither);
+        return 0;
+    }
+    if (!c->sliced) {
+        sws_scale(c->sws[0], src, srcStride, 0, c->srcH, dst, dstStride);
+        return 0;
+    }
+
+    pthread_mutex_lock(&ss->mutex);
+    ss->job = c;
+    ss->job_slices = c->nb_slices;
+    for (i = 0; i < 4; i++) {
+        ss->src[i] = src[i];
+        ss->srcStride[i] = srcStride[i];
+        ss->dst[i] = dst[i];
+        ss->dstStride[i] = dstStride[i];
+    }
+    ss->next_slice = 0;
+    ss->slices_done = 0;
+    ss->generation++;
+    pthread_cond_broadcast(&ss->work_cond);
+    pthread_mutex_unlock(&ss->mutex);
+
+    run_slices(ss);
+
+    //every slice has to be written before the picture is shown
+    pthread_mutex_lock(&ss->mutex);
+    while (ss->slices_done < ss->job_slices)
+        pthread_cond_wait(&ss->done_cond, &ss->mutex);
+    pthread_mutex_unlock(&ss->mutex);
+    return 0;
+}
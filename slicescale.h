@@ -0,0 +1,87 @@
+//slicescale.h
+//Colorspace conversion and scaling split into horizontal slices that a
+//small pool of threads converts at the same time, each slice with its
+//own SwsContext. For large frames where one sws_scale() call per
+//picture is the bottleneck. The last SLICE_SCALE_CACHE_SIZE
+//configurations are kept, so streams that change resolution switch
+//back and forth cheaply.
+
+#ifndef SLICESCALE_H
+#define SLICESCALE_H
+
+#include <libavutil/pixfmt.h>
+
+#include <stdint.h>
+
+#define SLICE_SCALE_MAX_THREADS 16
+#define SLICE_SCALE_MIN_ROWS    128     //frames are not cut thinner than this
+#define SLICE_SCALE_ALIGN       16      //slice boundaries, keeps chroma rows whole
+#define SLICE_SCALE_MARGIN      4       //source rows read past a scaled slice, times the factor
+#define SLICE_SCALE_CACHE_SIZE  4       //configurations kept set up
+#define SLICE_SCALE_SHRINK      32      //up to 1/32 of the rows dropped for slices
+
+typedef struct SliceScaleStats {
+    uint64_t    hits;       //configurations found set up
+    uint64_t    misses;     //had to create contexts
+    uint64_t    evictions;  //least recently used configuration dropped
+    int         nb_configs; //set up right now
+}SliceScaleStats;
+
+typedef struct SliceScale SliceScale;
+
+/*
+ * 'nb_threads' <= 0 uses one thread per cpu, the calling thread included.
+ * One thread at a time may configure and convert with the result.
+ */
+SliceScale *slice_scale_alloc(int nb_threads);
+
+void slice_scale_free(SliceScale **ss);
+
+/*
+ * Select the conversion, set up unless one of the cached configurations
+ * has the same formats, sizes and flags. A new one replaces the least
+ * recently used. A conversion that scales vertically is sliced at
+ * destination rows that are also source rows; heights without enough
+ * of those in common, and palette formats, run in one piece on the
+ * calling thread. When the formats only differ in bit depth and the
+ * size stays, bitdepth.c does the work and 'flags' is ignored. Returns
+ * 0 on success, a negative value if swscale does not support it.
+ */
+int slice_scale_config(SliceScale *ss, int srcW, int srcH, enum AVPixelFormat srcFormat,
+                       int dstW, int dstH, enum AVPixelFormat dstFormat, int flags);
+
+/*
+ * For a caller free to pick the output size: the even height at or a
+ * little below 'dstH' (1/SLICE_SCALE_SHRINK at most) that a scale from
+ * 'srcH' rows is cut into the most slices at, the closest of those, or
+ * 'dstH' if none can be sliced. Assumes 4:2:0, which keeps it right for
+ * anything less subsampled. Safe from any thread.
+ */
+int slice_scale_height(int srcH, int dstH);
+
+/*
+ * A destination picture for the selected configuration, owned by the
+ * cache. It is allocated on first use and lives until its configuration
+ * is evicted or 'ss' is freed. Returns -1 when out of memory.
+ */
+int slice_scale_buffer(SliceScale *ss, uint8_t *data[4], int linesize[4]);
+
+void slice_scale_get_stats(SliceScale *ss, SliceScaleStats *stats);
+
+//cache statistics and the uses of every cached configuration on stderr
+void slice_scale_print_stats(SliceScale *ss, const char *name);
+
+//ordered dither when reducing the bit depth, on by default
+void slice_scale_set_dither(SliceScale *ss, int dither);
+
+/*
+ * Convert a whole picture, like sws_scale() from row 0 to srcH. Returns
+ * once every slice is done. When the height stays, rows next to a slice
+ * boundary are interpolated from their own slice only, which may move
+ * chroma by one step there compared to one sws_scale() over the frame.
+ * Scaled slices read past their boundaries and match it.
+ */
+int slice_scale(SliceScale *ss, const uint8_t *const src[], const int srcStride[],
+                uint8_t *const dst[], const int dstStride[]);
+
+#endif
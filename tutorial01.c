@@ -2,13 +2,30 @@
 //A small sample program that show how to use 
 //libavformat and libavcodec to read video from a file
 //Use
-//gcc -o tutorial01 tutorial01.c -lavformat -lavcodec -lswscale -lz
+//gcc -o tutorial01 tutorial01.c batch.c mosaic.c scenecut.c seekindex.c fastopen.c
+//    fileio.c uringio.c iobench.c slicescale.c bitdepth.c yuvrgb.c yuvbench.c
+//    framehash.c framepool.c phash.c -lavformat -lavcodec -lswscale -lavutil -lpthread -lz
 
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
+#include <libavutil/pixdesc.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "fastopen.h"
+#include "framehash.h"
+#include "iobench.h"
+#include "mosaic.h"
+#include "phash.h"
+#include "scenecut.h"
+#include "seekindex.h"
+#include "slicescale.h"
+#include "yuvbench.h"
+#include "yuvrgb.h"
 
 void SaveFrame(AVFrame *pFrame, int width, int height, int iFrame) {
     FILE *pFile;
@@ -32,6 +49,58 @@ void SaveFrame(AVFrame *pFrame, int width, int height, int iFrame) {
     fclose(pFile);
 }
 
+//To RGB24 at the frame's own size, into the scaler's buffer for that
+//size, with the yuvrgb.c kernels when the format allows, else swscale
+int ConvertFrame(AVCodecContext *pCodecCtx, SliceScale *scaler, AVFrame *pFrame,
+                 AVFrame *pFrameRGB) {
+    int matrix = pCodecCtx->colorspace == AVCOL_SPC_BT709 ? YUV_RGB_BT709 : YUV_RGB_BT601;
+
+    if (slice_scale_config(scaler, pFrame->width, pFrame->height, pFrame->format,
+                           pFrame->width, pFrame->height, AV_PIX_FMT_RGB24,
+                           SWS_BILINEAR) < 0 ||
+        slice_scale_buffer(scaler, pFrameRGB->data, pFrameRGB->linesize) < 0)
+        return -1;
+    pFrameRGB->width = pFrame->width;
+    pFrameRGB->height = pFrame->height;
+
+    if (yuv_rgb_convert((uint8_t const *const *)pFrame->data, pFrame->linesize,
+                        pFrame->format, pFrameRGB->data[0], pFrameRGB->linesize[0],
+                        AV_PIX_FMT_RGB24, pFrame->width, pFrame->height, matrix,
+                        pCodecCtx->color_range == AVCOL_RANGE_JPEG) < 0)
+        slice_scale(scaler, (uint8_t const *const *)pFrame->data,
+                    pFrame->linesize, pFrameRGB->data, pFrameRGB->linesize);
+    return 0;
+}
+
+//Whether data[0] of 'format' is an 8 bit luma plane on its own, not
+//packed YUV like YUYV422, palette indices or RGB
+int HasLumaPlane(int format) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+
+    return desc && !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)) &&
+           desc->comp[0].plane == 0 && desc->comp[0].step == 1 && desc->comp[0].depth == 8;
+}
+
+//Perceptual hash of the frame's luma, read in place when the frame is
+//planar 8 bit YUV, else converted to gray by the scaler first
+int HashFrame(SliceScale *scaler, AVFrame *pFrame, uint64_t *hash) {
+    uint8_t *gray[4];
+    int linesize[4];
+
+    if (HasLumaPlane(pFrame->format))
+        return phash_compute(pFrame->data[0], pFrame->linesize[0], pFrame->width,
+                             pFrame->height, hash);
+
+    if (slice_scale_config(scaler, pFrame->width, pFrame->height, pFrame->format,
+                           pFrame->width, pFrame->height, AV_PIX_FMT_GRAY8,
+                           SWS_BILINEAR) < 0 ||
+        slice_scale_buffer(scaler, gray, linesize) < 0)
+        return -1;
+    slice_scale(scaler, (uint8_t const *const *)pFrame->data, pFrame->linesize,
+                gray, linesize);
+    return phash_compute(gray[0], linesize[0], pFrame->width, pFrame->height, hash);
+}
+
 int main(int argc, char **argv) {
     //Initalizing these to NULL prevents segfaults!
     AVFormatContext *pFormatCtx = NULL;
@@ -43,25 +112,175 @@ int main(int argc, char **argv) {
     AVFrame         *pFrameRGB = NULL;
     AVPacket        packet;
     int             frameFinished;
-    int             numBytes;
-    uint8_t         *buffer = NULL;
-    struct SwsContext *sws_ctx = NULL;
+    SliceScale      *scaler = NULL;
+    const char      *filename;
+    int             nb_files = 0;
+    int             mosaic_cols = 0, mosaic_rows = 0;
+    int             nb_scenes = 0;
+    int             build_index = 0;
+    int             bench_io = 0;
+    int             bench_yuv = 0;
+    const char      *hash_out = NULL, *hash_ref = NULL;
+    int             decode_threads = 1;
+    int             phash = 0, phash_flags = 0, phash_distance = -1;
+    PHashList       phash_list = { 0 };
+    const char      *batch_list = NULL;
+    int             batch_cores = 0;
+    SeekIndex       *seek_index = NULL;
+    FastOpenOptions fo_opts;
+    FastOpenStats   fo_stats;
+    SceneCut        *sc = NULL;
+    AVFrame         *pBest = NULL;  //best frame of the current shot
+    double          bestDetail = 0;
+
+    //parse the command line, the input files are packed at the
+    //front of argv as we go
+    fast_open_default_options(&fo_opts);
+    for (i = 1; i < argc; i++) {
+        if (fast_open_parse_option(&fo_opts, argc, argv, &i)) {
+            continue;
+        } else if (!strcmp(argv[i], "-mosaic") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &mosaic_cols, &mosaic_rows) != 2 ||
+                mosaic_cols <= 0 || mosaic_rows <= 0) {
+                fprintf(stderr, "-mosaic expects COLSxROWS, e.g. 4x4\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "-iobench")) {
+            bench_io = 1;
+        } else if (!strcmp(argv[i], "-yuvbench")) {
+            bench_yuv = 1;
+        } else if (!strcmp(argv[i], "-framemd5") && i + 1 < argc) {
+            hash_out = argv[++i];
+        } else if (!strcmp(argv[i], "-ref") && i + 1 < argc) {
+            hash_ref = argv[++i];
+        } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            decode_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-index")) {
+            build_index = 1;
+        } else if (!strcmp(argv[i], "-batch") && i + 1 < argc) {
+            batch_list = argv[++i];
+        } else if (!strcmp(argv[i], "-cores") && i + 1 < argc) {
+            batch_cores = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-phash")) {
+            phash = 1;
+        } else if (!strcmp(argv[i], "-keyframes")) {
+            phash_flags |= PHASH_FLAG_KEYFRAMES;
+        } else if (!strcmp(argv[i], "-phsearch") && i + 1 < argc) {
+            phash_distance = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-scenes") && i + 1 < argc) {
+            nb_scenes = atoi(argv[++i]);
+        } else {
+            argv[nb_files++] = argv[i];
+        }
+    }
+
+    //batch mode: decode every file of the list on one pool of threads
+    if (batch_list) {
+        BatchStats stats;
+        char **files;
+        int failed;
 
-    if (argc < 2) {
+        nb_files = batch_read_list(batch_list, &files);
+        if (nb_files < 0) {
+            fprintf(stderr, "%s: could not read the file list\n", batch_list);
+            return -1;
+        }
+        failed = batch_run(files, nb_files, batch_cores, &stats);
+        batch_print_stats(&stats, batch_list);
+        batch_free_list(&files, nb_files);
+        return failed ? 1 : 0;
+    }
+
+    if (nb_files < 1) {
         printf("Please provide a movie file\n");    
+        printf("Usage: tutorial01 [-fast] [-probesize BYTES] [-analyzeduration USEC]\n"
+               "                  [-iobench] [-yuvbench] [-index] [-mosaic COLSxROWS] [-scenes N]\n"
+               "                  [-framemd5 OUT|-] [-ref FRAMEMD5] [-threads N]\n"
+               "                  [-phash [-keyframes]] [-phsearch BITS] file [file...]\n"
+               "       tutorial01 -batch LIST|- [-cores N]\n");
         return -1;
     }
+    filename = argv[0];
 
-    //open video file
-    if (avformat_open_input(&pFormatCtx, argv[1], NULL, NULL) != 0)
-        return -1;  //couldn't open file
+    //compare the input backends on every input file
+    if (bench_io) {
+        for (i = 0; i < nb_files; i++) {
+            if (io_bench(argv[i]) < 0)
+                fprintf(stderr, "%s: could not benchmark\n", argv[i]);
+        }
+        return 0;
+    }
+
+    //time the RGB conversion kernels against swscale
+    if (bench_yuv) {
+        for (i = 0; i < nb_files; i++) {
+            if (yuv_bench(argv[i], 16) < 0)
+                fprintf(stderr, "%s: could not benchmark or kernel mismatch\n", argv[i]);
+        }
+        return 0;
+    }
+
+    //verification mode: hash every decoded frame, check against a reference
+    if (hash_out || hash_ref) {
+        int failed = 0;
+
+        for (i = 0; i < nb_files; i++) {
+            if (frame_hash(argv[i], hash_out, hash_ref, decode_threads, 0) < 0) {
+                fprintf(stderr, "%s: verification failed\n", argv[i]);
+                failed = 1;
+            }
+        }
+        return failed ? 1 : 0;
+    }
+
+    //search mode: the first file is the query signature, the rest the corpus
+    if (phash_distance >= 0) {
+        if (nb_files < 2) {
+            fprintf(stderr, "-phsearch needs a query and at least one signature file\n");
+            return -1;
+        }
+        return phash_search(argv[0], argv + 1, nb_files - 1, phash_distance) < 0 ? 1 : 0;
+    }
+
+    //signatures are written next to the one file the decode loop reads
+    if (phash && nb_files > 1) {
+        fprintf(stderr, "-phash takes one file, run it once per file\n");
+        return -1;
+    }
+
+    //index mode: write the keyframe sidecar of every input file
+    if (build_index) {
+        for (i = 0; i < nb_files; i++) {
+            int nb_entries = seek_index_build(argv[i]);
+            if (nb_entries < 0)
+                fprintf(stderr, "%s: could not build index\n", argv[i]);
+            else
+                printf("%s: %d index entries\n", argv[i], nb_entries);
+        }
+        return 0;
+    }
+
+    //contact sheet mode: one mosaic image per input file
+    if (mosaic_cols > 0) {
+        char szFilename[32];
+
+        for (i = 0; i < nb_files; i++) {
+            sprintf(szFilename, "mosaic%d.ppm", i + 1);
+            if (mosaic_generate(argv[i], mosaic_cols, mosaic_rows, 0, 0,
+                                &fo_opts, szFilename) < 0)
+                fprintf(stderr, "%s: could not build mosaic\n", argv[i]);
+        }
+        return 0;
+    }
+
+    seek_index = seek_index_open(filename);
 
-    //retrieve stream information
-    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
-        return -1;  //couldn't find stream information
+    //open video file and retrieve stream information
+    if (fast_open_input(&pFormatCtx, filename, &fo_opts, &fo_stats) < 0)
+        return -1;  //couldn't open file
 
     //Dump information about file onto standard error
-    av_dump_format(pFormatCtx, 0, argv[1], 0);
+    av_dump_format(pFormatCtx, 0, filename, 0);
 
     //Find the first video stream
     videoStream = -1;
@@ -89,6 +308,22 @@ int main(int argc, char **argv) {
         return -1;//Error copying codec context
     }
 
+    //the detector needs an 8 bit luma plane, else fall back to five frames
+    if (nb_scenes > 0) {
+        if (HasLumaPlane(pCodecCtx->pix_fmt))
+            sc = scenecut_alloc(pCodecCtx->width, pCodecCtx->height, 0);
+        if (!sc)
+            fprintf(stderr, "No scene detection for this format, saving the first frames\n");
+        pBest = av_frame_alloc();
+    }
+
+    //hashing only the keyframes, the decoder can skip everything else
+    if (phash && (phash_flags & PHASH_FLAG_KEYFRAMES))
+        pCodecCtx->skip_frame = AVDISCARD_NONKEY;
+
+    //scene mode holds on to decoded frames, so they have to be refcounted
+    pCodecCtx->refcounted_frames = sc != NULL;
+
     //open codec
     if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
         return -1;  //could not open codec
@@ -101,45 +336,82 @@ int main(int argc, char **argv) {
     if (pFrameRGB == NULL)
         return -1;
 
-    //Determine required buffer size and allocate buffer
-    numBytes = avpicture_get_size(AV_PIX_FMT_RGB24, pCodecCtx->width, pCodecCtx->height);
-    buffer = (uint8_t *)av_malloc(numBytes * sizeof(uint8_t));
-
-    //Assign appropriate parts of buffer to image planes in pFrameRGB
-    //Note that pFrameRGB is an AVFrame, but AVFrame is a superset
-    //of AVPicture
-    avpicture_fill((AVPicture *)pFrameRGB, buffer, AV_PIX_FMT_RGB24, pCodecCtx->width, pCodecCtx->height);
-
-    //initialize SWS context for software scaling
-    sws_ctx = sws_getContext(pCodecCtx->width,
-                             pCodecCtx->height,
-                             pCodecCtx->pix_fmt,
-                             pCodecCtx->width,
-                             pCodecCtx->height,
-                             AV_PIX_FMT_RGB24,
-                             SWS_BILINEAR,
-                             NULL,
-                             NULL,
-                             NULL);
-
-    //Read frames and save first five five frames to disk
+    //initialize the conversion to RGB, sliced over a thread per cpu. The
+    //RGB picture's buffer comes from the scaler, one for each frame size
+    //the stream uses, so a resolution change mid-stream is no problem.
+    scaler = slice_scale_alloc(0);
+    if (!scaler || slice_scale_config(scaler, pCodecCtx->width, pCodecCtx->height,
+                                      pCodecCtx->pix_fmt, pCodecCtx->width,
+                                      pCodecCtx->height, AV_PIX_FMT_RGB24,
+                                      SWS_BILINEAR) < 0)
+        return -1;
+
+    //Read frames and save first five five frames to disk, or in scene
+    //mode the most detailed frame of each of the first nb_scenes shots
     i = 0;
-    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+    while ((!sc || i < nb_scenes) && av_read_frame(pFormatCtx, &packet) >= 0) {
         //Is this a packet from the video stream?
         if (packet.stream_index == videoStream) {
             //Decode video frame
             avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
 
-            //Did we get a video frame?
-            if (frameFinished) {
-                //Convert the image from its native format to RGB
-                sws_scale(sws_ctx, (uint8_t const *const *)pFrame->data,
-                          pFrame->linesize, 0, pCodecCtx->height,
-                          pFrameRGB->data, pFrameRGB->linesize);
+            if (frameFinished)
+                fast_open_first_frame(&fo_stats, filename);
+
+            //the detector is sized for the plane, a stream that changes
+            //resolution gets a new one; frames it cannot read are skipped
+            if (frameFinished && sc) {
+                SceneCut *resized = NULL;
 
-                //Save the frame to disk
-                if (++i <= 5)
-                    SaveFrame(pFrameRGB, pCodecCtx->width, pCodecCtx->height, i);
+                if (HasLumaPlane(pFrame->format) &&
+                    (pFrame->width != sc->width || pFrame->height != sc->height) &&
+                    (resized = scenecut_alloc(pFrame->width, pFrame->height, 0))) {
+                    scenecut_free(&sc);
+                    sc = resized;
+                }
+                if (!HasLumaPlane(pFrame->format) ||
+                    pFrame->width != sc->width || pFrame->height != sc->height) {
+                    av_frame_unref(pFrame);
+                    frameFinished = 0;
+                }
+            }
+
+            if (frameFinished && sc) {
+                double detail;
+
+                if (scenecut_feed(sc, pFrame->data[0], pFrame->linesize[0], &detail) &&
+                    pBest->buf[0]) {
+                    //a new shot starts here, save the pick of the last one
+                    if (ConvertFrame(pCodecCtx, scaler, pBest, pFrameRGB) == 0)
+                        SaveFrame(pFrameRGB, pFrameRGB->width, pFrameRGB->height, ++i);
+                    av_frame_unref(pBest);
+                }
+                if (!pBest->buf[0] || detail > bestDetail) {
+                    av_frame_unref(pBest);
+                    av_frame_ref(pBest, pFrame);
+                    bestDetail = detail;
+                }
+                av_frame_unref(pFrame);
+            } else if (frameFinished && phash) {
+                AVStream *st = pFormatCtx->streams[videoStream];
+                int64_t pts = av_frame_get_best_effort_timestamp(pFrame);
+                uint64_t hash;
+
+                if (pts == AV_NOPTS_VALUE)
+                    pts = 0;
+                else if (st->start_time != AV_NOPTS_VALUE)
+                    pts -= st->start_time;
+                if (HashFrame(scaler, pFrame, &hash) == 0 &&
+                    phash_list_add(&phash_list, hash,
+                                   av_rescale_q(pts, st->time_base, (AVRational){ 1, 1000 }),
+                                   i) < 0)
+                    break;
+                i++;
+            } else if (frameFinished) {
+                //Convert the image from its native format to RGB and
+                //save the frame to disk
+                if (ConvertFrame(pCodecCtx, scaler, pFrame, pFrameRGB) == 0 && ++i <= 5)
+                    SaveFrame(pFrameRGB, pFrameRGB->width, pFrameRGB->height, i);
             }
         }
 
@@ -147,9 +419,27 @@ int main(int argc, char **argv) {
         av_free_packet(&packet);
     }
 
-    //Free the RGB image
-    av_free(buffer);
-    av_frame_free(&pFrame);
+    //the file ended in the middle of a shot
+    if (sc && i < nb_scenes && pBest->buf[0]) {
+        if (ConvertFrame(pCodecCtx, scaler, pBest, pFrameRGB) == 0)
+            SaveFrame(pFrameRGB, pFrameRGB->width, pFrameRGB->height, ++i);
+    }
+    //hash mode: the signature goes next to the file
+    if (phash) {
+        if (phash_save(filename, &phash_list, phash_flags) < 0)
+            fprintf(stderr, "%s: could not write signature\n", filename);
+        else
+            printf("%s: %d signatures\n", filename, phash_list.nb_entries);
+        phash_list_free(&phash_list);
+    }
+    av_frame_free(&pBest);
+    scenecut_free(&sc);
+    seek_index_close(&seek_index);
+    slice_scale_print_stats(scaler, filename);
+    slice_scale_free(&scaler);
+
+    //Free the RGB image, its buffer went with the scaler
+    av_frame_free(&pFrameRGB);
 
     //Free the YUV frame
     av_frame_free(&pFrame);
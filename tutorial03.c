@@ -12,20 +12,41 @@
 #include <SDL_thread.h>
 
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "fastopen.h"
+#include "framepool.h"
+#include "present.h"
+#include "slicescale.h"
 #include <assert.h>
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
 #define MAX_AUDIO_FRAME_SIZE 192000
 
+#define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
+#define MAX_VIDEOQ_SIZE (5 * 256 * 1024)
+
+#define FF_WAKE_EVENT (SDL_USEREVENT)
+
 typedef struct PacketQueue {
     AVPacketList *first_pkt, *last_pkt;
     int nb_packets;
     int size;
+    int eof;    //the demuxer is done with it
+    int wake;   //the reader sleeps on the event queue, wake it on the next put
     SDL_mutex *mutex;
     SDL_cond  *cond;
 }PacketQueue;
 
+//what the demux thread reads from
+typedef struct Demuxer {
+    AVFormatContext *pFormatCtx;
+    int             videoStream, audioStream;
+}Demuxer;
+
 PacketQueue audioq;
+PacketQueue videoq;
 
 int quit = 0;
 
@@ -35,6 +56,17 @@ void packet_queue_init(PacketQueue *q) {
     q->cond  = SDL_CreateCond();
 }
 
+//interrupt the main thread's wait for events
+static void packet_queue_wake(PacketQueue *q) {
+    SDL_Event event;
+
+    if (q->wake) {
+        q->wake = 0;
+        event.type = FF_WAKE_EVENT;
+        SDL_PushEvent(&event);
+    }
+}
+
 int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
     AVPacketList *pktl;
     if (av_dup_packet(pkt) < 0) {
@@ -56,12 +88,28 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
     q->nb_packets++;
     q->size += pktl->pkt.size;
     SDL_CondSignal(q->cond);
+    packet_queue_wake(q);
 
     SDL_UnlockMutex(q->mutex);
 
     return 0;
 }
 
+//no more packets will be put
+static void packet_queue_end(PacketQueue *q) {
+    SDL_LockMutex(q->mutex);
+    q->eof = 1;
+    SDL_CondSignal(q->cond);
+    packet_queue_wake(q);
+    SDL_UnlockMutex(q->mutex);
+}
+
+/*
+ * Returns 1 with a packet, -1 on quit or once the queue is empty after
+ * packet_queue_end(). When not blocking and there is nothing yet, 0 is
+ * returned and the next put pushes FF_WAKE_EVENT, so the caller can
+ * sleep in SDL_WaitEvent instead of polling.
+ */
 static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
 {
     AVPacketList *pktl;
@@ -86,7 +134,11 @@ static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
             av_free(pktl);
             ret = 1;
             break;
+        } else if (q->eof) {
+            ret = -1;
+            break;
         } else if (!block) {
+            q->wake = 1;
             ret = 0;
             break;
         } else {
@@ -178,6 +230,32 @@ void audio_callback(void *userdata, uint8_t *stream, int len) {
     }
 }
 
+//read packets into the queues, independently of the event loop
+static int demux_thread(void *arg) {
+    Demuxer *d = (Demuxer *)arg;
+    AVPacket packet;
+
+    while (!quit) {
+        //don't read the whole file ahead
+        if (audioq.size > MAX_AUDIOQ_SIZE || videoq.size > MAX_VIDEOQ_SIZE) {
+            SDL_Delay(10);
+            continue;
+        }
+        if (av_read_frame(d->pFormatCtx, &packet) < 0)
+            break;
+        if (packet.stream_index == d->videoStream) {
+            packet_queue_put(&videoq, &packet);
+        } else if (packet.stream_index == d->audioStream) {
+            packet_queue_put(&audioq, &packet);
+        } else {
+            av_free_packet(&packet);
+        }
+    }
+    packet_queue_end(&videoq);
+    packet_queue_end(&audioq);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     //Initalizing these to NULL prevents segfaults!
     AVFormatContext *pFormatCtx = NULL;
@@ -191,22 +269,36 @@ int main(int argc, char **argv) {
     int             frameFinished;
     int             numBytes;
     uint8_t         *buffer = NULL;
-    struct SwsContext *sws_ctx = NULL;
+    SliceScale      *scaler = NULL;
+    int             dither = 1;
 
     AVCodecContext *aCodecCtxOrig = NULL;
     AVCodecContext *aCodecCtx = NULL;
     AVCodec        *aCodec = NULL;
 
-    SDL_Event   event;
+    Presenter   presenter;
+    int         stop = 0;
+    int         ret;
+    Demuxer     demuxer;
+    SDL_Thread  *demux_tid;
     SDL_Window *screen;
     SDL_Renderer *renderer;
-    SDL_Texture *texture;
-    uint8_t *yPlane, *uPlane, *vPlane;
-    size_t yPlaneSz, uvPlaneSz;
-    int uvPitch;
+    FramePool *pool = NULL;
+    const char *filename = NULL;
+    FastOpenOptions fo_opts;
+    FastOpenStats fo_stats;
     SDL_AudioSpec wanted_spec, spec;
 
-    if (argc < 2) {
+    fast_open_default_options(&fo_opts);
+    for (i = 1; i < argc; i++) {
+        if (fast_open_parse_option(&fo_opts, argc, argv, &i))
+            continue;
+        if (!strcmp(argv[i], "-nodither"))
+            dither = 0;
+        else
+            filename = argv[i];
+    }
+    if (!filename) {
         printf("Please provide a movie file\n");    
         return -1;
     }
@@ -216,16 +308,12 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    //open video file
-    if (avformat_open_input(&pFormatCtx, argv[1], NULL, NULL) != 0)
+    //open video file and retrieve stream information
+    if (fast_open_input(&pFormatCtx, filename, &fo_opts, &fo_stats) < 0)
         return -1;  //couldn't open file
 
-    //retrieve stream information
-    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
-        return -1;  //couldn't find stream information
-
     //Dump information about file onto standard error
-    av_dump_format(pFormatCtx, 0, argv[1], 0);
+    av_dump_format(pFormatCtx, 0, filename, 0);
 
     //Find the first video stream
     videoStream = -1;
@@ -292,6 +380,10 @@ int main(int argc, char **argv) {
         return -1;//Error copying codec context
     }
 
+    //decoded frames come from a pool of reused buffers
+    pool = frame_pool_alloc();
+    frame_pool_attach(pool, pCodecCtx);
+
     //open codec
     if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
         return -1;  //could not open codec
@@ -318,99 +410,99 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    //Allocate a place to put our YUV image on that screen
-    texture = SDL_CreateTexture(
-                renderer,
-                SDL_PIXELFORMAT_YV12,
-                SDL_TEXTUREACCESS_STREAMING,
-                pCodecCtx->width,
-                pCodecCtx->height);
-    if (!texture) {
+    //Allocate places to put our YUV images on that screen
+    if (presenter_init(&presenter, renderer, pCodecCtx->width, pCodecCtx->height) < 0) {
         fprintf(stderr, "SDL: could not create texture - exiting\n");
         exit(1);
     }
 
-    //initialize SWS context for software scaling
-    sws_ctx = sws_getContext(pCodecCtx->width,
-                             pCodecCtx->height,
-                             pCodecCtx->pix_fmt,
-                             pCodecCtx->width,
-                             pCodecCtx->height,
-                             AV_PIX_FMT_YUV420P,
-                             SWS_BILINEAR,
-                             NULL,
-                             NULL,
-                             NULL);
-
-    //set up YV12 pixel array(12 bits per pixel)
-    yPlaneSz = pCodecCtx->width * pCodecCtx->height;
-    uvPlaneSz = yPlaneSz >> 2;
-    yPlane = (uint8_t *)malloc(yPlaneSz);
-    uPlane = (uint8_t *)malloc(uvPlaneSz);
-    vPlane = (uint8_t *)malloc(uvPlaneSz);
-    if (!yPlane || !uPlane || !vPlane) {
-        fprintf(stderr, "Could not allocate pixel buffers - exiting\n");
+    //convert in slices on a thread per cpu, 4K frames are too much for one
+    scaler = slice_scale_alloc(0);
+    if (!scaler || slice_scale_config(scaler, pCodecCtx->width, pCodecCtx->height,
+                                      pCodecCtx->pix_fmt, pCodecCtx->width,
+                                      pCodecCtx->height, AV_PIX_FMT_YUV420P,
+                                      SWS_BILINEAR) < 0) {
+        fprintf(stderr, "Could not initialize the conversion - exiting\n");
+        exit(1);
+    }
+    //only used when a 10 or 12 bit source is cut down to 8 bits
+    slice_scale_set_dither(scaler, dither);
+
+    //Packets are read on their own thread, this one decodes and sleeps
+    //on the event queue until a packet or a picture's deadline is due
+    packet_queue_init(&videoq);
+    demuxer.pFormatCtx = pFormatCtx;
+    demuxer.videoStream = videoStream;
+    demuxer.audioStream = audioStream;
+    demux_tid = SDL_CreateThread(demux_thread, "demux", &demuxer);
+    if (!demux_tid) {
+        fprintf(stderr, "SDL: could not create demux thread - exiting\n");
         exit(1);
     }
 
-    //Read frames and save first five five frames to disk
-    uvPitch = pCodecCtx->width >> 1;
-    while (av_read_frame(pFormatCtx, &packet) >= 0) {
-        //Is this a packet from the video stream?
-        if (packet.stream_index == videoStream) {
-            //Decode video frame
-            avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
-
-            //Did we get a video frame?
-            if (frameFinished) {
-                AVPicture pict;
-                pict.data[0] = yPlane;
-                pict.data[1] = uPlane;
-                pict.data[2] = vPlane;
-
-                pict.linesize[0] = pCodecCtx->width;
-                pict.linesize[1] = uvPitch;
-                pict.linesize[2] = uvPitch;
-
-                //Convert the image from its native format to RGB
-                sws_scale(sws_ctx, (uint8_t const *const *)pFrame->data,
-                          pFrame->linesize, 0, pCodecCtx->height,
-                          pict.data, pict.linesize);
-
-                SDL_UpdateYUVTexture(
-                                     texture,
-                                     NULL,
-                                     yPlane,
-                                     pCodecCtx->width,
-                                     uPlane,
-                                     uvPitch,
-                                     vPlane,
-                                     uvPitch);
-                SDL_RenderClear(renderer);
-                SDL_RenderCopy(renderer, texture, NULL, NULL);
-                SDL_RenderPresent(renderer);
-            }
-        } else if (packet.stream_index == audioStream) {
-            packet_queue_put(&audioq, &packet);
-        } else {
-            av_free_packet(&packet);
+    while (!stop) {
+        ret = packet_queue_get(&videoq, &packet, 0);
+        if (ret < 0)
+            break;  //end of file
+        if (ret == 0) {
+            //the demuxer has not caught up, wait for it or the user
+            stop = presenter_wait(&presenter, -1) < 0;
+            continue;
         }
 
-        //Free the packet that was allocated by av_read_frame
-        //av_packet_unref(&packet);
-        SDL_PollEvent(&event);
-        switch(event.type) {
-            case SDL_QUIT:
-                SDL_Quit();
-                exit(0);
-                break;
-            default:
-                break;
+        //Decode video frame
+        avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+        av_free_packet(&packet);
+
+        //Did we get a video frame?
+        if (frameFinished) {
+            int64_t ts = av_frame_get_best_effort_timestamp(pFrame);
+            int64_t due;
+            double pts = NAN;
+            uint8_t *data[4];
+            int linesize[4];
+
+            //Convert the image straight into the next texture. A stream
+            //that changes resolution is scaled to the window's size, each
+            //size it switches to is set up once.
+            if (slice_scale_config(scaler, pFrame->width, pFrame->height, pFrame->format,
+                                   presenter.width, presenter.height, AV_PIX_FMT_YUV420P,
+                                   SWS_BILINEAR) < 0 ||
+                presenter_lock(&presenter, data, linesize) < 0)
+                continue;
+            slice_scale(scaler, (uint8_t const *const *)pFrame->data,
+                        pFrame->linesize, data, linesize);
+            presenter_unlock(&presenter);
+
+            //hold the picture back until it is due, handling events
+            if (ts != AV_NOPTS_VALUE)
+                pts = ts * av_q2d(pFormatCtx->streams[videoStream]->time_base);
+            due = presenter_due(&presenter, pts);
+            while ((ret = presenter_wait(&presenter, due)) > 0)
+                ;
+            if (ret < 0) {
+                stop = 1;
+            } else {
+                presenter_present(&presenter);
+                fast_open_first_frame(&fo_stats, filename);
+            }
         }
     }
+    if (stop) {
+        quit = 1;
+        frame_pool_print_stats(pool, filename);
+        slice_scale_print_stats(scaler, filename);
+        SDL_Quit();
+        exit(0);
+    }
+
+    SDL_WaitThread(demux_tid, NULL);
 
     //Free the YUV frame
     av_frame_free(&pFrame);
+    presenter_close(&presenter);
+    slice_scale_print_stats(scaler, filename);
+    slice_scale_free(&scaler);
 
     //Close the codecs
     avcodec_close(pCodecCtx);
@@ -421,5 +513,8 @@ int main(int argc, char **argv) {
     //Close the video file
     avformat_close_input(&pFormatCtx);
 
+    frame_pool_print_stats(pool, filename);
+    frame_pool_free(&pool);
+
     return 0;
 }
@@ -7,6 +7,9 @@
 #include <assert.h>
 #include <math.h>
 
+#include "fastopen.h"
+#include "slicescale.h"
+
 #define SDL_AUDIO_BUFFER_SIZE 1024
 #define MAX_AUDIO_FRAME_SIZE  192000
 
@@ -48,16 +51,20 @@ typedef struct VideoState {
     AVStream        *video_st;
     AVCodecContext  *video_ctx;
     PacketQueue     videoq;
-    struct SwsContext *sws_ctx;
+    SliceScale      *scaler;
 
     VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
     int             pictq_size, pictq_rindex, pictq_windex;
     SDL_mutex       *pictq_mutex;
     SDL_cond        *pictq_cond;
+    int             refresh_idle;   //waiting for queue_picture() to restart refreshing
 
     SDL_Thread      *parse_tid;
     SDL_Thread      *video_tid;
 
+    FastOpenOptions fast_open;
+    FastOpenStats   open_stats;
+
     char            filename[1024];
     int             quit;
 }VideoState;
@@ -224,6 +231,19 @@ static void schedule_refresh(VideoState *is, int delay) {
     SDL_AddTimer(delay, sdl_refresh_timer_sb, is);
 }
 
+//restart refreshing right away if it stopped for lack of pictures,
+//called with pictq_mutex held
+static void refresh_wake_locked(VideoState *is) {
+    SDL_Event event;
+
+    if (is->refresh_idle) {
+        is->refresh_idle = 0;
+        event.type = FF_REFRESH_EVENT;
+        event.user.data1 = is;
+        SDL_PushEvent(&event);
+    }
+}
+
 void video_display(VideoState *is) {
     SDL_Rect rect;
     VideoPicture *vp;
@@ -259,6 +279,7 @@ void video_display(VideoState *is) {
         SDL_LockMutex(screen_mutex);
         SDL_DisplayYUOverlay(vp->bmp, &rect);
         SDL_UnlockMutex(screen_mutex);
+        fast_open_first_frame(&is->open_stats, is->filename);
     }
 }
 
@@ -268,7 +289,14 @@ void video_refresh_timer(void *userdata) {
 
     if (is->video_st) {
         if (is->pictq_size == 0) {
-            schedule_refresh(is, 1);
+            //nothing to show, sleep until the next picture is queued
+            //instead of polling for it
+            SDL_LockMutex(is->pictq_mutex);
+            if (is->pictq_size == 0)
+                is->refresh_idle = 1;
+            else
+                schedule_refresh(is, 1);
+            SDL_UnlockMutex(is->pictq_mutex);
         } else {
             vp = &is->pictq[is->pictq_rindex];
             /*
@@ -367,9 +395,8 @@ int queue_picture(VideoState *is, AVFrame *pFrame) {
         pict.linesize[2] = vp->bmp->pitches[1];
 
         //Convert the image into YUV format that SDL uses
-        sws_scale(is->sws_ctx, (uint8_t const *const *)pFrame->data,
-                  pFrame->linesize, 0, is->video_ctx->height,
-                  pict.data, pict.linesize);
+        slice_scale(is->scaler, (uint8_t const *const *)pFrame->data,
+                    pFrame->linesize, pict.data, pict.linesize);
 
         SDL_UnlockYUVOverlay(vp->bmp);
 
@@ -379,6 +406,7 @@ int queue_picture(VideoState *is, AVFrame *pFrame) {
         }
         SDL_LockMutext(is->pictq_mutex);
         is->pictq_size++;
+        refresh_wake_locked(is);
         SDL_UnlockMutex(is->pictq_mutex);
     }
 
@@ -473,10 +501,11 @@ int stream_component_open(VideoState *is, int stream_index) {
             is->video_ctx = codecCtx;
             packet_queue_init(&is->videoq);
             is->video_tid = SDL_CreateThread(video_thread, is);
-            is->sws_ctx = sws_getContext(is->video_ctx->width, is->video_ctx->height,
-                                         is->video_ctx->pix_fmt, is->video_ctx->width,
-                                         is->video_ctx->heights, PIX_FMT_YUV420P,
-                                         SWS_BILINEAR, NULL, NULL, NULL);
+            //4K pictures take too long to convert on one thread
+            is->scaler = slice_scale_alloc(0);
+            slice_scale_config(is->scaler, is->video_ctx->width, is->video_ctx->height,
+                               is->video_ctx->pix_fmt, is->video_ctx->width,
+                               is->video_ctx->height, PIX_FMT_YUV420P, SWS_BILINEAR);
             break;
         default:
             break;
@@ -485,7 +514,7 @@ int stream_component_open(VideoState *is, int stream_index) {
 
 int decode_thread(void *arg) {
     VideoState *is = (VideoState *)arg;
-    AVFormatContext *pFormatCtx;
+    AVFormatContext *pFormatCtx = NULL;
     AVPacket pkt1, *packet = &pkt1;
 
     int video_index = -1;
@@ -497,16 +526,12 @@ int decode_thread(void *arg) {
 
     global_video_state = is;
 
-    // Open video file
-    if (avformat_open_input(&pFormatCtx, is->filename, NULL, NULL) != 0)
+    // Open video file and retrieve stream information
+    if (fast_open_input(&pFormatCtx, is->filename, &is->fast_open, &is->open_stats) < 0)
         return -1;  //couldnot open file
 
     is->pFormatCtx = pFormatCtx;
 
-    // Retrieve stream information
-    if (avformat_find_stream_info(pFromatCtx, NULL) < 0)
-        return -1;  //couldnot find stream information
-
     // Dump information about file onto standard error
     av_dump_format(pFormatCtx, 0, is->filename, 0);
 
@@ -582,11 +607,18 @@ fail:
 int main(int argc, char **argv) {
     SDL_Event event;
     VideoState *is;
+    const char *filename = NULL;
+    int i;
 
     is = av_mallocz(sizeof(VideoState));
 
-    if (argc < 2) {
-        frpintf(stderr, "Usage: test <file>\n");
+    fast_open_default_options(&is->fast_open);
+    for (i = 1; i < argc; i++) {
+        if (!fast_open_parse_option(&is->fast_open, argc, argv, &i))
+            filename = argv[i];
+    }
+    if (!filename) {
+        fprintf(stderr, "Usage: test [-fast] [-probesize BYTES] [-analyzeduration USEC] <file>\n");
         exit(1);
     }
     //Register all formats and codecs
@@ -608,7 +640,7 @@ int main(int argc, char **argv) {
     }
 
     screen_mutex = SDL_CreateMutex();
-    av_strlcpy(is->filename, argv[1], sizeof(is->filename));
+    av_strlcpy(is->filename, filename, sizeof(is->filename));
 
     is->pictq_mutex = SDL_CreateMutex();
     is->pictq_cond  = SDL_CreateCond();
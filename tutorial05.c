@@ -1,6 +1,8 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
 
 #include <SDL.h>
 #include <SDL_thread.h>
@@ -9,7 +11,17 @@
 #include <assert.h>
 #include <math.h>
 
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 28.1)
+#include "fastopen.h"
+#include "fileio.h"
+#include "uringio.h"
+#include "seekindex.h"
+#include "gopcache.h"
+#include "framepool.h"
+#include "slicescale.h"
+#include "loudness.h"
+#include "framesink.h"
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
 #define av_frame_alloc avcodec_alloc_frame
 #define av_frame_free  avcodec_free_frame
 #endif
@@ -28,26 +40,92 @@
 
 #define VIDEO_PICTURE_QUEUE_SIZE 1
 
+//trick play: up to this speed every frame is decoded and only some are
+//shown, beyond it (and for any rewind) the demuxer jumps keyframe to
+//keyframe, one jump per TRICK_JUMP_INTERVAL of wall clock
+#define TRICK_DECODE_ALL_MAX 4
+#define TRICK_JUMP_INTERVAL  0.25
+
+//packets the preload thread reads ahead of the handover
+#define PLAYLIST_PREROLL_PACKETS 64
+
+//a new window size (us) has to last this long before pictures are
+//converted for it, dragging the border doesn't rebuild anything
+#define RESIZE_SETTLE (200 * 1000)
+
+//-remux: the streams copied, and how far (s) the demuxer reads past the
+//end of the range for packets muxed out of order
+#define REMUX_VIDEO     1
+#define REMUX_AUDIO     2
+#define REMUX_END_SLACK 2.0
+
+//how decode_thread reads the input
+enum {
+    INPUT_IO_DEFAULT,   //libavformat's file protocol
+    INPUT_IO_MMAP,      //fileio.c, local files only
+    INPUT_IO_URING,     //uringio.c, falls back to mmap without io_uring
+};
+
+typedef struct PacketList {
+    AVPacket pkt;
+    int serial;     //queue generation the packet belongs to
+    struct PlaylistItem *item;  //file it was read from
+    struct PacketList *next;
+}PacketList;
+
 typedef struct PacketQueue {
-    AVPacketList *first_pkt, *last_pkt;
+    PacketList *first_pkt, *last_pkt;
     int nb_packets;
     int size;
+    int serial;     //bumped by every flush
+    struct PlaylistItem *item;  //stamped on every put, only the demuxer sets it
     SDL_mutex *mutex;
     SDL_cond  *cond;
 }PacketQueue;
 
+//one file of the playlist, with everything needed to demux and decode it
+typedef struct PlaylistItem {
+    char            filename[1024];
+    AVFormatContext *pFormatCtx;
+    int             videoStream, audioStream;
+    AVCodecContext  *video_ctx, *audio_ctx;
+    SeekIndex       *seek_index;    //keyframe sidecar, NULL if there is none
+    AVIOContext     *io;            //custom input, NULL for the default
+    void            (*io_close)(AVIOContext **pb);
+    FastOpenStats   open_stats;
+    PacketList      *preroll;       //read ahead by the preload thread
+    double          offset;         //seconds added to its timestamps
+    int             refs;           //the demuxer and the two decoders
+}PlaylistItem;
+
 typedef struct VideoPicture {
     SDL_Overlay *bmp;
-    int width, height;  //source height & width
+    int width, height;  //overlay size, the source's or the smaller one shown
+    SDL_Overlay *spare; //the previous size, for streams that switch back
+    int spare_width, spare_height;
     int allocated;
     double pts;
+    int64_t frame_pts;  //best effort pts in stream time base, the cache key
+    int serial;         //videoq generation it was decoded from
 }VideoPicture;
 
 typedef struct VideoState {
-    AVFormatContext *pFormatCtx;
-    int videoStream, audioStream;
+    PlaylistItem    *item;          //the file being demuxed
+    char            **playlist;
+    int             nb_playlist, playlist_pos;
+    int             loop;
+    int             no_dither;      //plain rounding from 10/12 bit sources
+    PlaylistItem    *next_item;     //opened by preload_thread
+    int             preload_pos;
+    SDL_Thread      *preload_tid;
+    SDL_mutex       *item_mutex;    //item refcounts
+    double          demux_audio_end;    //timeline end of the audio read so far
 
     double audio_clock;
+    PlaylistItem    *audio_item;    //the file the audio decoder is on
+    PlaylistItem    *audio_next_item;   //waiting for the old decoder to drain
+    SDL_AudioSpec   audio_spec;
+    enum AVSampleFormat audio_fmt;  //of the first file, every later one must match
     AVStream        *audio_st;
     AVCodecContext  *audio_ctx;
     PacketQueue     audioq;
@@ -59,23 +137,72 @@ typedef struct VideoState {
     uint8_t         *audio_pkt_data;
     int             audio_pkt_size;
     int             audio_hw_buf_size;
+    int             audio_pkt_serial;
+    int             audio_dec_serial;   //generation the decoder state is from
+    int             loudness_on;
+    LoudnessMeter   *loudness;      //fed from audio_callback, never blocks it
     double          frame_timer;
     double          frame_last_pts;
     double          frame_last_delay;
     double          video_clock;    ///<pts of last decoded frame / predicted pts of next 
+    PlaylistItem    *video_item;
     AVStream        *video_st;
     AVCodecContext  *video_ctx;
     PacketQueue     videoq;
-    struct SwsContext *sws_ctx;
+    int             video_dec_serial;
+    int             frame_serial;       //generation of the last shown picture
+    SliceScale      *scaler;        //video thread only
+    const char      *shm_name;      //publish frames to this shared memory ring
+    enum AVPixelFormat shm_format;  //AV_PIX_FMT_NONE keeps the decoder's
+    FrameSink       *frame_sink;    //written by the video thread
 
     VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
     int             pictq_size, pictq_rindex, pictq_windex;
     SDL_mutex       *pictq_mutex;
     SDL_cond        *pictq_cond;
+    int             refresh_idle;   //no refresh scheduled, see refresh_wake()
 
     SDL_Thread      *parse_tid;
     SDL_Thread      *video_tid;
 
+    GopCache        *gop_cache;     //recently decoded frames, for stepping
+    FramePool       *frame_pool;    //video frame buffers of every item
+    int             paused;
+    int             reverse;        //playing backwards out of the cache
+    int             step_next;      //show one queued picture while paused
+    int             stepped;        //the picture on screen is not where audio is
+    int64_t         shown_pts;      //frame_pts of the picture on screen
+    double          shown_time;
+    VideoPicture    still;          //a cached frame being shown
+    struct SwsContext *still_sws;
+
+    //window size pictures are converted for, and the latest one, all
+    //under screen_mutex
+    int             display_w, display_h;
+    int             resize_w, resize_h;
+    int64_t         resize_time;
+
+    int             speed;          //1 is normal, negative rewinds
+    double          trick_pos;      //seconds, where the next keyframe jump aims
+    double          trick_last;     //time of the last keyframe jumped to
+    double          trick_next;     //next pts to show when decoding everything
+
+    int             seek_req;
+    int64_t         seek_pos;       //AV_TIME_BASE units
+    int64_t         seek_start;     //av_gettime() of the request, for latency
+    double          seek_target;    //seconds, decoders discard up to here
+    int             audio_seek_serial, video_seek_serial;
+
+    FastOpenOptions fast_open;
+    FastOpenStats   open_stats;
+    int             input_io;
+
+    //stream copy instead of playback, see remux()
+    const char      *remux_out;
+    int             remux_streams;  //REMUX_VIDEO | REMUX_AUDIO
+    double          remux_start, remux_end; //seconds into the file, end 0 for all of it
+    int             demux_eof;      //under videoq.mutex
+
     char            filename[1024];
     int             quit;
 }VideoState;
@@ -89,27 +216,1020 @@ SDL_mutex           *screen_mutex;
  * */
 VideoState *global_video_state;
 
-int stream_component_open(VideoState *is, int stream_index) {
-    AVFormatContext *pFormatCtx = is->pFormatCtx;
-    AVCodecContext *codecCtx = NULL;
-    AVCodec *codec = NULL;
-    SDL_AudioSpec wanted_spec, spec;
+void packet_queue_init(PacketQueue *q) {
+    memset(q, 0, sizeof(PacketQueue));
+    q->mutex = SDL_CreateMutex();
+    q->cond  = SDL_CreateCond();
+}
 
-    if (stream_index < 0 || stream_index >= pFormatCtx->nb_streams) {
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+    PacketList *pktl;
+
+    if (av_dup_packet(pkt) < 0)
         return -1;
+    pktl = av_malloc(sizeof(PacketList));
+    if (!pktl)
+        return -1;
+    pktl->pkt  = *pkt;
+    pktl->next = NULL;
+
+    SDL_LockMutex(q->mutex);
+
+    //stamp the packet with the queue's generation, under the lock so
+    //it cannot race with a flush
+    pktl->serial = q->serial;
+    pktl->item = q->item;
+    if (!q->last_pkt)
+        q->first_pkt = pktl;
+    else
+        q->last_pkt->next = pktl;
+    q->last_pkt = pktl;
+    q->nb_packets++;
+    q->size += pktl->pkt.size;
+    SDL_CondSignal(q->cond);
+
+    SDL_UnlockMutex(q->mutex);
+
+    return 0;
+}
+
+//'serial' and 'item' (if not NULL) get the generation the packet was
+//queued in and the file it came from
+static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *serial,
+                            PlaylistItem **item)
+{
+    PacketList *pktl;
+    int ret;
+
+    SDL_LockMutex(q->mutex);
+
+    for (;;) {
+        if (global_video_state->quit) {
+            ret = -1;
+            break;
+        }
+
+        pktl = q->first_pkt;
+        if (pktl) {
+            q->first_pkt = pktl->next;
+            if (!q->first_pkt)
+                q->last_pkt = NULL;
+            q->nb_packets--;
+            q->size -= pktl->pkt.size;
+            *pkt = pktl->pkt;
+            if (serial)
+                *serial = pktl->serial;
+            if (item)
+                *item = pktl->item;
+            av_free(pktl);
+            ret = 1;
+            break;
+        } else if (!block) {
+            ret = 0;
+            break;
+        } else {
+            SDL_CondWait(q->cond, q->mutex);
+        }
+    }
+
+    SDL_UnlockMutex(q->mutex);
+    return ret;
+}
+
+/*
+ * Drop everything queued and start a new generation. Only the queue
+ * lock is taken: the decoders notice the new serial on their next
+ * packet and flush themselves, and pictures of older generations are
+ * skipped by the display.
+ */
+static void packet_queue_flush(PacketQueue *q) {
+    PacketList *pktl, *pktl1;
+
+    SDL_LockMutex(q->mutex);
+    for (pktl = q->first_pkt; pktl != NULL; pktl = pktl1) {
+        pktl1 = pktl->next;
+        av_free_packet(&pktl->pkt);
+        av_freep(&pktl);
+    }
+    q->last_pkt = NULL;
+    q->first_pkt = NULL;
+    q->nb_packets = 0;
+    q->size = 0;
+    q->serial++;
+    SDL_CondSignal(q->cond);
+    SDL_UnlockMutex(q->mutex);
+}
+
+static void playlist_item_free(PlaylistItem *item) {
+    PacketList *pktl;
+
+    while ((pktl = item->preroll)) {
+        item->preroll = pktl->next;
+        av_free_packet(&pktl->pkt);
+        av_free(pktl);
+    }
+    if (item->video_ctx) {
+        avcodec_close(item->video_ctx);
+        av_free(item->video_ctx);
+    }
+    if (item->audio_ctx) {
+        avcodec_close(item->audio_ctx);
+        av_free(item->audio_ctx);
+    }
+    if (item->pFormatCtx)
+        avformat_close_input(&item->pFormatCtx);
+    if (item->io)
+        item->io_close(&item->io);
+    seek_index_close(&item->seek_index);
+    av_free(item);
+}
+
+//the demuxer and each decoder drop their reference when they move on
+static void playlist_item_unref(VideoState *is, PlaylistItem *item) {
+    int refs;
+
+    SDL_LockMutex(is->item_mutex);
+    refs = --item->refs;
+    SDL_UnlockMutex(is->item_mutex);
+    if (refs == 0)
+        playlist_item_free(item);
+}
+
+double get_audio_clock(VideoState *is) {
+    double pts;
+    int hw_buf_size, bytes_per_sec, n;
+
+    pts = is->audio_clock;  //maintained in the audio thread
+    hw_buf_size = is->audio_buf_size - is->audio_buf_index;
+    bytes_per_sec = 0;
+    n = is->audio_ctx->channels * 2;
+    if (is->audio_st) {
+        bytes_per_sec = is->audio_ctx->sample_rate * n;
+    }
+    if (bytes_per_sec) {
+        pts -= (double)hw_buf_size / bytes_per_sec;
+    }
+    return pts;
+}
+
+//set up is->audio_pkt for decoding, it was just taken off the queue
+static void audio_start_packet(VideoState *is) {
+    AVPacket *pkt = &is->audio_pkt;
+
+    //first packet after a seek, forget what the decoder buffered
+    if (is->audio_pkt_serial != is->audio_dec_serial) {
+        avcodec_flush_buffers(is->audio_ctx);
+        is->audio_dec_serial = is->audio_pkt_serial;
+    }
+    is->audio_pkt_data = pkt->data;
+    is->audio_pkt_size = pkt->size;
+    //if update, update the audio clock w/pts
+    if (pkt->pts != AV_NOPTS_VALUE) {
+        is->audio_clock = av_q2d(is->audio_st->time_base) * pkt->pts +
+                          is->audio_item->offset;
+    }
+}
+
+//measure what is played, from the decoded frame itself: audio_buf only
+//gets its first plane, which for planar formats is one channel's worth
+static void loudness_tap(VideoState *is, int skip_samples) {
+    AVFrame *frame = &is->audio_frame;
+    const uint8_t *data[LOUDNESS_MAX_CHANNELS];
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int channels = av_frame_get_channels(frame);
+    int bps = av_get_bytes_per_sample(frame->format);
+    int i;
+
+    if (!is->loudness || skip_samples >= frame->nb_samples ||
+        channels > LOUDNESS_MAX_CHANNELS)
+        return;
+    for (i = 0; i < (planar ? channels : 1); i++)
+        data[i] = frame->extended_data[i] + skip_samples * bps * (planar ? 1 : channels);
+    //the copy into the ring is all this thread does for it
+    loudness_push(is->loudness, data, frame->format, frame->nb_samples - skip_samples, 0);
+}
+
+//samples a decoder with delay still holds at the end of a file
+static int audio_drain(VideoState *is, uint8_t *audio_buf, double *pts_ptr) {
+    AVPacket drain;
+    int got_frame = 0, data_size, n;
+
+    if (!(is->audio_ctx->codec->capabilities & CODEC_CAP_DELAY))
+        return 0;
+    av_init_packet(&drain);
+    drain.data = NULL;
+    drain.size = 0;
+    if (avcodec_decode_audio4(is->audio_ctx, &is->audio_frame, &got_frame, &drain) < 0 ||
+        !got_frame)
+        return 0;
+
+    data_size = av_samples_get_buffer_size(NULL, is->audio_ctx->channels,
+                                           is->audio_frame.nb_samples,
+                                           is->audio_ctx->sample_fmt, 1);
+    if (data_size <= 0)
+        return 0;
+    n = 2 * is->audio_ctx->channels;
+    loudness_tap(is, 0);
+    memcpy(audio_buf, is->audio_frame.data[0], data_size);
+    *pts_ptr = is->audio_clock;
+    is->audio_clock += (double)data_size / (double)(n * is->audio_ctx->sample_rate);
+    return data_size;
+}
+
+int audio_decode_frame(VideoState *is, uint8_t *audio_buf, int buf_size, double *pts_ptr) {
+    int len1, data_size = 0;
+    AVPacket *pkt = &is->audio_pkt;
+    PlaylistItem *item;
+    double pts;
+    int n;
+
+    for (;;) {
+        //the next file's first packet is waiting: play out the old
+        //decoder, then carry on with the new one without a gap
+        if (is->audio_next_item) {
+            if ((data_size = audio_drain(is, audio_buf, pts_ptr)) > 0)
+                return data_size;
+            playlist_item_unref(is, is->audio_item);
+            is->audio_item = is->audio_next_item;
+            is->audio_next_item = NULL;
+            is->audio_ctx = is->audio_item->audio_ctx;
+            is->audio_st = is->audio_item->pFormatCtx->streams[is->audio_item->audioStream];
+            audio_start_packet(is);
+        }
+        //a seek made the rest of this packet stale
+        if (is->audio_pkt_serial != is->audioq.serial)
+            is->audio_pkt_size = 0;
+
+        while (is->audio_pkt_size > 0) {
+            int got_frame = 0;
+            int skip = 0;
+
+            len1 = avcodec_decode_audio4(is->audio_ctx, &is->audio_frame, &got_frame, pkt);
+            if (len1 < 0) {
+                //if error, skip frame
+                is->audio_pkt_size = 0;
+                break;
+            }
+            data_size = 0;
+            if (got_frame) {
+                data_size = av_samples_get_buffer_size(NULL,
+                                                       is->audio_ctx->channels,
+                                                       is->audio_frame.nb_samples,
+                                                       is->audio_ctx->sample_fmt,
+                                                       1);
+                assert(data_size <= buf_size);
+            }
+            is->audio_pkt_data += len1;
+            is->audio_pkt_size -= len1;
+            if (data_size <= 0) {
+                //No data yet, get more frames
+                continue;
+            }
+
+            n = 2 * is->audio_ctx->channels;
+
+            //after a seek, drop the samples that are before the target
+            if (is->audio_pkt_serial == is->audio_seek_serial &&
+                is->audio_clock < is->seek_target) {
+                skip = (int)((is->seek_target - is->audio_clock) *
+                             is->audio_ctx->sample_rate) * n;
+                if (skip > data_size)
+                    skip = data_size;
+            }
+            pts = is->audio_clock;
+            is->audio_clock += (double)data_size / (double)(n * is->audio_ctx->sample_rate);
+            if (skip == data_size)
+                continue;
+
+            loudness_tap(is, skip / n);
+            memcpy(audio_buf, is->audio_frame.data[0] + skip, data_size - skip);
+            *pts_ptr = pts + (double)skip / (double)(n * is->audio_ctx->sample_rate);
+            // we have data, return it and come back for more later
+            return data_size - skip;
+        }
+        if (pkt->data)
+            av_free_packet(pkt);
+
+        if (is->quit) {
+            return -1;
+        }
+        //next packet
+        if (packet_queue_get(&is->audioq, pkt, 1, &is->audio_pkt_serial, &item) < 0) {
+            return -1;
+        }
+        if (item != is->audio_item) {
+            is->audio_next_item = item;
+            continue;
+        }
+        audio_start_packet(is);
     }
+}
+
+void audio_callback(void *userdata, uint8_t *stream, int len) {
+    VideoState *is = (VideoState *)userdata;
+    int len1, audio_size;
+    double pts;
+
+    while (len > 0) {
+        if (is->audio_buf_index >= is->audio_buf_size) {
+            //we have already sent all our data; get more
+            audio_size = audio_decode_frame(is, is->audio_buf, sizeof(is->audio_buf), &pts);
+            if (audio_size < 0) {
+                //If error, output silence
+                is->audio_buf_size = 1024;
+                memset(is->audio_buf, 0, is->audio_buf_size);
+            } else {
+                is->audio_buf_size = audio_size;
+            }
+            is->audio_buf_index = 0;
+        }
+        len1 = is->audio_buf_size - is->audio_buf_index;
+        if (len1 > len)
+            len1 = len;
+        memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
+        len -= len1;
+        stream += len1;
+        is->audio_buf_index += len1;
+    }
+}
+
+static Uint32 sdl_refresh_timer_cb(Uint32 interval, void *opaque) {
+    SDL_Event event;
+    event.type = FF_REFRESH_EVENT;
+    event.user.data1 = opaque;
+    SDL_PushEvent(&event);
+    return 0;   //0 means stop timer
+}
+
+//schedule a video refresh in 'delay' ms
+static void schedule_refresh(VideoState *is, int delay) {
+    SDL_AddTimer(delay, sdl_refresh_timer_cb, is);
+}
+
+/*
+ * With nothing to show until a picture is decoded or the user does
+ * something, the refresh loop stops instead of polling: the main thread
+ * sleeps in SDL_WaitEvent. queue_picture() and the key handlers restart
+ * it. Called with pictq_mutex held.
+ */
+static void refresh_wake_locked(VideoState *is) {
+    if (is->refresh_idle) {
+        is->refresh_idle = 0;
+        sdl_refresh_timer_cb(0, is);
+    }
+}
+
+static void refresh_wake(VideoState *is) {
+    SDL_LockMutex(is->pictq_mutex);
+    refresh_wake_locked(is);
+    SDL_UnlockMutex(is->pictq_mutex);
+}
+
+//go idle, unless a picture came in while playing
+static void refresh_sleep(VideoState *is) {
+    SDL_LockMutex(is->pictq_mutex);
+    if (is->pictq_size > 0 && !is->paused)
+        sdl_refresh_timer_cb(0, is);
+    else
+        is->refresh_idle = 1;
+    SDL_UnlockMutex(is->pictq_mutex);
+}
+
+//the aspect correct rectangle the picture takes in a sw x sh window
+static void display_rect(VideoState *is, int sw, int sh, SDL_Rect *rect) {
+    float aspect_ratio;
+    int w, h;
+
+    if (is->video_ctx->sample_aspect_ratio.num == 0) {
+        aspect_ratio = 0;
+    } else {
+        aspect_ratio = av_q2d(is->video_ctx->sample_aspect_ratio) *
+            is->video_ctx->width / is->video_ctx->height;
+    }
+    if (aspect_ratio <= 0.0) {
+        aspect_ratio = (float)is->video_ctx->width / (float)is->video_ctx->height;
+    }
+    h = sh;
+    w = ((int)rint(h * aspect_ratio)) & -3;
+    if (w > sw) {
+        w = sw;
+        h = ((int)rint(w / aspect_ratio)) & -3;
+    }
+    rect->x = (sw - w) / 2;
+    rect->y = (sh - h) / 2;
+    rect->w = w;
+    rect->h = h;
+}
+
+static void display_overlay(VideoState *is, SDL_Overlay *bmp) {
+    SDL_Rect rect;
+
+    //an overlay of another size than the window wants is scaled by SDL
+    SDL_LockMutex(screen_mutex);
+    display_rect(is, screen->w, screen->h, &rect);
+    SDL_DisplayYUVOverlay(bmp, &rect);
+    SDL_UnlockMutex(screen_mutex);
+}
+
+/*
+ * The size to convert a width x height frame to: what the window shows
+ * of it once the window size has settled, or the frame's own size when
+ * that is smaller, since scaling up is left to the display.
+ */
+static void picture_size(VideoState *is, int width, int height, int *w, int *h) {
+    SDL_Rect rect;
+
+    SDL_LockMutex(screen_mutex);
+    if ((is->resize_w != is->display_w || is->resize_h != is->display_h) &&
+        av_gettime() - is->resize_time >= RESIZE_SETTLE) {
+        is->display_w = is->resize_w;
+        is->display_h = is->resize_h;
+    }
+    display_rect(is, is->display_w, is->display_h, &rect);
+    SDL_UnlockMutex(screen_mutex);
+
+    *w = width;
+    *h = height;
+    if (rect.w < width || rect.h < height) {
+        //YV12 wants even sizes
+        *w = FFMAX(rect.w & ~1, 2);
+        *h = FFMAX(rect.h & ~1, 2);
+        //a few rows less so the scaler can slice it, SDL stretches the
+        //overlay to the window anyway
+        *h = slice_scale_height(height, *h);
+    }
+}
+
+void video_display(VideoState *is) {
+    VideoPicture *vp;
+
+    vp = &is->pictq[is->pictq_rindex];
+    if (vp->bmp) {
+        display_overlay(is, vp->bmp);
+        is->shown_pts = vp->frame_pts;
+        is->shown_time = vp->pts;
+
+        fast_open_first_frame(&is->open_stats, is->filename);
+        if (is->seek_start && vp->serial == is->video_seek_serial) {
+            fprintf(stderr, "seek to %.3f: first frame after %.1f ms\n",
+                    vp->pts, (av_gettime() - is->seek_start) / 1000.0);
+            is->seek_start = 0;
+        }
+    }
+}
+
+//ask decode_thread to seek to 'pos' (AV_TIME_BASE units)
+static void stream_seek(VideoState *is, int64_t pos) {
+    if (!is->seek_req) {
+        is->seek_pos = pos;
+        is->seek_start = av_gettime();
+        is->seek_req = 1;
+        //when paused, still show where we landed
+        is->step_next = 1;
+        refresh_wake(is);
+    }
+}
+
+//release the picture at the read index back to the video thread
+static void pictq_next(VideoState *is) {
+    if (++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+        is->pictq_rindex = 0;
+    }
+    SDL_LockMutex(is->pictq_mutex);
+    is->pictq_size--;
+    SDL_CondSignal(is->pictq_cond);
+    SDL_UnlockMutex(is->pictq_mutex);
+}
+
+//pictures decoded before the last seek are never shown
+static void pictq_drop_stale(VideoState *is) {
+    while (is->pictq_size > 0 &&
+           is->pictq[is->pictq_rindex].serial != is->videoq.serial) {
+        pictq_next(is);
+    }
+}
+
+static double frame_duration(VideoState *is) {
+    AVRational rate = is->video_st->avg_frame_rate;
+
+    return rate.num && rate.den ? 1.0 / av_q2d(rate) : 0.04;
+}
+
+//too fast to decode everything, read keyframes only
+static int trick_keyframes(VideoState *is) {
+    return is->speed < 0 || is->speed > TRICK_DECODE_ALL_MAX;
+}
+
+//at low trick speeds every frame is decoded but only about one in
+//'speed' is converted and shown
+static int trick_skip(VideoState *is, double pts) {
+    if (is->speed <= 1 || trick_keyframes(is))
+        return 0;
+    if (pts < is->trick_next)
+        return 1;
+    is->trick_next = pts + (is->speed - 0.5) * frame_duration(is);
+    return 0;
+}
+
+static void set_speed(VideoState *is, int speed) {
+    if (speed == is->speed || !is->video_st)
+        return;
+    is->speed = speed;
+    //audio is not stretched, it is muted and not even queued
+    SDL_PauseAudio(is->paused || speed != 1);
+    //restart reading at the picture on screen in the new mode, going
+    //back to 1x this also brings audio back in sync
+    stream_seek(is, (int64_t)(is->shown_time * AV_TIME_BASE));
+}
+
+//convert a frame from the cache into the still overlay and show it
+static void show_frame(VideoState *is, AVFrame *frame) {
+    VideoPicture *vp = &is->still;
+    AVPicture pict;
+    int w, h;
+
+    picture_size(is, frame->width, frame->height, &w, &h);
+    if (!vp->bmp || vp->width != w || vp->height != h) {
+        if (vp->bmp)
+            SDL_FreeYUVOverlay(vp->bmp);
+        SDL_LockMutex(screen_mutex);
+        vp->bmp = SDL_CreateYUVOverlay(w, h, SDL_YV12_OVERLAY, screen);
+        SDL_UnlockMutex(screen_mutex);
+        vp->width = w;
+        vp->height = h;
+        if (!vp->bmp)
+            return;
+    }
+    //the video thread owns is->scaler, this runs on the main thread
+    is->still_sws = sws_getCachedContext(is->still_sws, frame->width, frame->height,
+                                         frame->format, w, h,
+                                         PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!is->still_sws)
+        return;
+
+    SDL_LockYUVOverlay(vp->bmp);
+    pict.data[0] = vp->bmp->pixels[0];
+    pict.data[1] = vp->bmp->pixels[2];
+    pict.data[2] = vp->bmp->pixels[1];
+    pict.linesize[0] = vp->bmp->pitches[0];
+    pict.linesize[1] = vp->bmp->pitches[2];
+    pict.linesize[2] = vp->bmp->pitches[1];
+    sws_scale(is->still_sws, (uint8_t const *const *)frame->data, frame->linesize,
+              0, frame->height, pict.data, pict.linesize);
+    SDL_UnlockYUVOverlay(vp->bmp);
+
+    display_overlay(is, vp->bmp);
+}
+
+//show the cached frame after (dir > 0) or before the one on screen
+static int step_cached(VideoState *is, int dir) {
+    AVFrame *frame;
+    int ret;
+
+    frame = av_frame_alloc();
+    if (!frame)
+        return 0;
+    ret = gop_cache_get(is->gop_cache, is->shown_pts, dir, frame);
+    if (ret > 0) {
+        show_frame(is, frame);
+        is->shown_pts = av_frame_get_best_effort_timestamp(frame);
+        is->shown_time = is->shown_pts * av_q2d(is->video_st->time_base) +
+                         is->video_item->offset;
+        is->stepped = 1;
+    }
+    av_frame_free(&frame);
+    return ret > 0;
+}
+
+static void toggle_pause(VideoState *is) {
+    is->paused = !is->paused;
+    is->reverse = 0;
+    is->step_next = 0;
+    SDL_PauseAudio(is->paused || is->speed != 1);
+    if (!is->paused) {
+        //carry on from the picture on screen, not from where audio stopped
+        if (is->stepped)
+            stream_seek(is, (int64_t)(is->shown_time * AV_TIME_BASE));
+        is->stepped = 0;
+        is->frame_timer = (double)av_gettime() / 1000000.0;
+        refresh_wake(is);
+    }
+}
+
+/*
+ * Single frame step, pausing first. The cache answers most steps. A
+ * forward miss takes the next decoded picture when it is the right one,
+ * anything else becomes an accurate seek to the neighbouring frame,
+ * which also refills the cache around it.
+ */
+static void step_frame(VideoState *is, int dir) {
+    VideoPicture *vp;
+    double target;
+
+    if (!is->video_st)
+        return;
+    if (!is->paused)
+        toggle_pause(is);
+    is->reverse = 0;
+    if (step_cached(is, dir))
+        return;
+
+    pictq_drop_stale(is);
+    vp = &is->pictq[is->pictq_rindex];
+    if (dir > 0 && is->pictq_size > 0 && vp->frame_pts > is->shown_pts) {
+        is->step_next = 1;
+        refresh_wake(is);
+        return;
+    }
+    //decoders drop frames ending before the target, aim mid frame
+    target = is->shown_time + (dir > 0 ? 1.5 : -0.5) * frame_duration(is);
+    if (target < 0)
+        target = 0;
+    stream_seek(is, (int64_t)(target * AV_TIME_BASE));
+    is->stepped = 1;
+}
+
+//while paused only steps, seeks and reverse playback update the screen
+static void video_refresh_paused(VideoState *is) {
+    if (is->reverse) {
+        if (!step_cached(is, -1))
+            is->reverse = 0;    //ran off the start of the cache
+        schedule_refresh(is, (int)(frame_duration(is) * 1000 + 0.5));
+        return;
+    }
+    pictq_drop_stale(is);
+    if (is->step_next && is->pictq_size > 0) {
+        video_display(is);
+        pictq_next(is);
+        is->step_next = 0;
+    }
+    refresh_sleep(is);
+}
+
+void video_refresh_timer(void *userdata) {
+    VideoState *is = (VideoState *)userdata;
+    VideoPicture *vp;
+    double actual_delay, delay, sync_threshold, ref_clock, diff;
+
+    if (is->video_st && is->paused) {
+        video_refresh_paused(is);
+    } else if (is->video_st) {
+        pictq_drop_stale(is);
+
+        if (is->pictq_size == 0) {
+            refresh_sleep(is);
+        } else {
+            vp = &is->pictq[is->pictq_rindex];
+
+            //restart the timing at the first picture after a seek
+            if (vp->serial != is->frame_serial) {
+                is->frame_serial = vp->serial;
+                is->frame_timer = (double)av_gettime() / 1000000.0;
+                is->frame_last_pts = vp->pts;
+            }
+
+            //the pts from last time, trick play shows it 'speed' times faster
+            delay = (vp->pts - is->frame_last_pts) / is->speed;
+            if (delay <= 0 || delay >= 1.0) {
+                //if incorrect delay, use previous one
+                delay = is->frame_last_delay;
+            }
+            //save for next time
+            is->frame_last_delay = delay;
+            is->frame_last_pts = vp->pts;
+
+            //update delay to sync to audio, muted during trick play
+            if (is->speed == 1) {
+                ref_clock = get_audio_clock(is);
+                diff = vp->pts - ref_clock;
+
+                //skip or repeat the frame. Take delay into account
+                //FFPlay still doesn't "know if this is the best guess."
+                sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
+                if (fabs(diff) < AV_NOSYNC_THRESHOLD) {
+                    if (diff <= -sync_threshold) {
+                        delay = 0;
+                    } else if (diff >= sync_threshold) {
+                        delay = 2 * delay;
+                    }
+                }
+            }
+            is->frame_timer += delay;
+            //computer the REAL delay
+            actual_delay = is->frame_timer - (av_gettime() / 1000000.0);
+            if (actual_delay < 0.010) {
+                //Really it should skip the picture instead
+                actual_delay = 0.010;
+            }
+            schedule_refresh(is, (int)(actual_delay * 1000 + 0.5));
+
+            //show the picture
+            video_display(is);
+
+            //update queue for next picture!
+            pictq_next(is);
+        }
+    } else {
+        //the first picture wakes it
+        refresh_sleep(is);
+    }
+}
+
+//the window lost its contents, redraw the picture on screen if no
+//refresh is coming to do it
+static void video_expose(VideoState *is) {
+    AVFrame *frame;
+    int idle;
+
+    SDL_LockMutex(is->pictq_mutex);
+    idle = is->refresh_idle;
+    SDL_UnlockMutex(is->pictq_mutex);
+    if (!is->video_st || !idle)
+        return;
+
+    //the overlay it was shown from may already hold the next picture
+    frame = av_frame_alloc();
+    if (frame && gop_cache_get(is->gop_cache, is->shown_pts, 0, frame) > 0)
+        show_frame(is, frame);
+    av_frame_free(&frame);
+}
+
+void alloc_picture(VideoState *is, int width, int height) {
+    VideoPicture *vp;
+    SDL_Overlay *bmp = NULL;
+
+    vp = &is->pictq[is->pictq_windex];
+    //switching back to the size before costs nothing
+    if (vp->spare && vp->spare_width == width && vp->spare_height == height) {
+        bmp = vp->spare;
+        vp->spare = NULL;
+    }
+    //keep the one we have for the next switch, drop the older one
+    if (vp->spare)
+        SDL_FreeYUVOverlay(vp->spare);
+    vp->spare = vp->bmp;
+    vp->spare_width = vp->width;
+    vp->spare_height = vp->height;
+
+    //Allocate a place to put our YUV image on that screen
+    if (!bmp) {
+        SDL_LockMutex(screen_mutex);
+        bmp = SDL_CreateYUVOverlay(width, height, SDL_YV12_OVERLAY, screen);
+        SDL_UnlockMutex(screen_mutex);
+    }
+
+    vp->bmp = bmp;
+    vp->width = width;
+    vp->height = height;
+    vp->allocated = 1;
+}
+
+int queue_picture(VideoState *is, AVFrame *pFrame, double pts, int serial) {
+    VideoPicture *vp;
+    AVPicture pict;
+    int w, h;
+
+    //wait until we have space for a new pic
+    SDL_LockMutex(is->pictq_mutex);
+    while (is->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE && !is->quit) {
+        SDL_CondWait(is->pictq_cond, is->pictq_mutex);
+    }
+    SDL_UnlockMutex(is->pictq_mutex);
+
+    if (is->quit)
+        return -1;
+
+    // windex is set to 0 initially
+    vp = &is->pictq[is->pictq_windex];
+
+    //allocate or resize the buffer. The frame is converted once, straight
+    //to the size it is shown at, so a 4K stream in a small window never
+    //fills a 4K overlay.
+    picture_size(is, pFrame->width, pFrame->height, &w, &h);
+    if (!vp->bmp ||
+        vp->width != w ||
+        vp->height != h) {
+        vp->allocated = 0;
+        alloc_picture(is, w, h);
+        if (is->quit) {
+            return -1;
+        }
+    }
+
+    // We have a place to put our picture on the queue
+    if (vp->bmp) {
+        SDL_LockYUVOverlay(vp->bmp);
+        vp->pts = pts;
+        vp->frame_pts = av_frame_get_best_effort_timestamp(pFrame);
+        vp->serial = serial;
+
+        //point pict at the queue
+        pict.data[0] = vp->bmp->pixels[0];
+        pict.data[1] = vp->bmp->pixels[2];
+        pict.data[2] = vp->bmp->pixels[1];
+
+        pict.linesize[0] = vp->bmp->pitches[0];
+        pict.linesize[1] = vp->bmp->pitches[2];
+        pict.linesize[2] = vp->bmp->pitches[1];
 
-    codec = avcodec_find_decoder(pFormatCtx->streams[stream_index]->codec->codec_id);
+        //Convert the image into YUV format that SDL uses, in slices on
+        //a thread per cpu. The next file of a playlist or the stream
+        //itself may bring another size or format, the scaler keeps the
+        //last few set up.
+        if (!is->scaler) {
+            is->scaler = slice_scale_alloc(0);
+            if (is->scaler)
+                slice_scale_set_dither(is->scaler, !is->no_dither);
+        }
+        if (is->scaler &&
+            slice_scale_config(is->scaler, pFrame->width, pFrame->height,
+                               pFrame->format, w, h, PIX_FMT_YUV420P, SWS_BILINEAR) == 0)
+            slice_scale(is->scaler, (uint8_t const *const *)pFrame->data,
+                        pFrame->linesize, pict.data, pict.linesize);
+
+        SDL_UnlockYUVOverlay(vp->bmp);
+
+        // now we inform our display thread that we have a pic ready
+        if (++is->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
+            is->pictq_windex = 0;
+        }
+        SDL_LockMutex(is->pictq_mutex);
+        is->pictq_size++;
+        refresh_wake_locked(is);
+        SDL_UnlockMutex(is->pictq_mutex);
+    }
+
+    return 0;
+}
+
+double synchronize_video(VideoState *is, AVFrame *src_frame, double pts) {
+    double frame_delay;
+
+    if (pts != 0) {
+        //if we have pts, set video clock to it
+        is->video_clock = pts;
+    } else {
+        //if we aren't given a pts, set it to the clock
+        pts = is->video_clock;
+    }
+    //update the video clock
+    frame_delay = av_q2d(is->video_ctx->time_base);
+    //if we are repeating a frame, adjust clock accordingly
+    frame_delay += src_frame->repeat_pict * (frame_delay * 0.5);
+    is->video_clock += frame_delay;
+    return pts;
+}
+
+//cache, trim to the seek target or skip for trick play, then queue
+static int video_output_frame(VideoState *is, AVFrame *pFrame, int serial) {
+    int64_t frame_pts = av_frame_get_best_effort_timestamp(pFrame);
+    double pts = 0;
+    int ret = 0;
+
+    if (frame_pts != AV_NOPTS_VALUE) {
+        pts = frame_pts * av_q2d(is->video_st->time_base) + is->video_item->offset;
+    }
+    pts = synchronize_video(is, pFrame, pts);
+    //frames skipped for a seek are cached too, they are what
+    //stepping backwards from the target needs. Keyframes from
+    //trick play are not neighbours, keep them out.
+    if (!trick_keyframes(is))
+        gop_cache_add(is->gop_cache, pFrame, frame_pts);
+    //decode and discard up to the exact seek target: the
+    //frame is shown if it is on screen at the target time.
+    //Trick play takes whatever it lands on.
+    if (!(is->speed == 1 ? serial == is->video_seek_serial &&
+                           is->video_clock <= is->seek_target
+                         : trick_skip(is, pts))) {
+        //consumers get what is shown, never held up by them
+        if (is->frame_sink)
+            frame_sink_write(is->frame_sink, pFrame, pts);
+        ret = queue_picture(is, pFrame, pts, serial);
+    }
+    //the cache holds its own reference
+    if (is->video_ctx->refcounted_frames)
+        av_frame_unref(pFrame);
+    return ret;
+}
+
+//decode whatever the decoder still holds back, before it is flushed
+//or before the next file's decoder takes over
+static int video_drain(VideoState *is, AVFrame *pFrame, int serial) {
+    AVPacket drain;
+    int frameFinished;
+
+    if (!(is->video_ctx->codec->capabilities & CODEC_CAP_DELAY))
+        return 0;
+    av_init_packet(&drain);
+    drain.data = NULL;
+    drain.size = 0;
+    for (;;) {
+        frameFinished = 0;
+        if (avcodec_decode_video2(is->video_ctx, pFrame, &frameFinished, &drain) < 0 ||
+            !frameFinished)
+            return 0;
+        if (video_output_frame(is, pFrame, serial) < 0)
+            return -1;
+    }
+}
+
+int video_thread(void *arg) {
+    VideoState *is = (VideoState *)arg;
+    AVPacket pkt1, *packet = &pkt1;
+    int frameFinished;
+    AVFrame *pFrame;
+    PlaylistItem *item;
+    int serial;
+
+    pFrame = av_frame_alloc();
+
+    for (;;) {
+        if (packet_queue_get(&is->videoq, packet, 1, &serial, &item) < 0) {
+            //means we quit getting packets
+            break;
+        }
+        //first packet of the next file, the last frames of this one
+        //come out of the old decoder first so none are lost
+        if (item != is->video_item) {
+            if (serial == is->video_dec_serial && video_drain(is, pFrame, serial) < 0) {
+                av_free_packet(packet);
+                break;
+            }
+            playlist_item_unref(is, is->video_item);
+            is->video_item = item;
+            is->video_ctx = item->video_ctx;
+            is->video_st = item->pFormatCtx->streams[item->videoStream];
+            gop_cache_clear(is->gop_cache);
+        }
+        //first packet after a seek, forget the reference frames
+        if (serial != is->video_dec_serial) {
+            avcodec_flush_buffers(is->video_ctx);
+            gop_cache_clear(is->gop_cache);
+            is->video_dec_serial = serial;
+            is->trick_next = 0;
+        }
+
+        //Decode video frame
+        avcodec_decode_video2(is->video_ctx, pFrame, &frameFinished, packet);
+        av_free_packet(packet);
+        if (frameFinished) {
+            if (video_output_frame(is, pFrame, serial) < 0)
+                break;
+        } else if (trick_keyframes(is)) {
+            //every packet is a lone keyframe, drain it past the decoder's
+            //reorder delay instead of waiting for a next one
+            if (video_drain(is, pFrame, serial) < 0)
+                break;
+            avcodec_flush_buffers(is->video_ctx);
+        }
+    }
+    av_frame_free(&pFrame);
+    return 0;
+}
+
+static AVCodecContext *open_codec(VideoState *is, AVStream *st) {
+    AVCodecContext *codecCtx = NULL;
+    AVCodec *codec = NULL;
+
+    codec = avcodec_find_decoder(st->codec->codec_id);
     if (!codec) {
         fprintf(stderr, "Unsupported codec!\n");
-        return -1;
+        return NULL;
     }
 
     codecCtx = avcodec_alloc_context3(codec);
-    if (avcodec_copy_context(codecCtx, pFormatCtx->streams[stream_index]->codec) != 0) {
+    if (avcodec_copy_context(codecCtx, st->codec) != 0) {
         fprintf(stderr, "Couldnot copy codec context");
+        av_free(codecCtx);
+        return NULL;
+    }
+
+    if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) {
+        //let the GOP cache share decoded frames instead of copying them
+        codecCtx->refcounted_frames = is->gop_cache != NULL;
+        //the cache and the decoder recycle the same pooled buffers, across
+        //playlist items too
+        frame_pool_attach(is->frame_pool, codecCtx);
+    }
+
+    if (avcodec_open2(codecCtx, codec, NULL) < 0) {
+        fprintf(stderr, "Unsupported codec!\n");
+        av_free(codecCtx);
+        return NULL;
+    }
+    return codecCtx;
+}
+
+//start audio output or the video thread on the first item's decoder
+int stream_component_open(VideoState *is, PlaylistItem *item, int stream_index) {
+    AVFormatContext *pFormatCtx = item->pFormatCtx;
+    AVCodecContext *codecCtx = NULL;
+    SDL_AudioSpec wanted_spec;
+
+    if (stream_index < 0 || stream_index >= pFormatCtx->nb_streams) {
         return -1;
     }
+    codecCtx = stream_index == item->audioStream ? item->audio_ctx : item->video_ctx;
 
     if (codecCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
         // set audio settings from codec info
@@ -121,129 +1241,457 @@ int stream_component_open(VideoState *is, int stream_index) {
         wanted_spec.callback    =   audio_callback;
         wanted_spec.userdata    =   is;
 
-        if (SDL_OpenAudio(&wanted_spce, &spec) < 0) {
+        if (SDL_OpenAudio(&wanted_spec, &is->audio_spec) < 0) {
             fprintf(stderr, "SDL_OpenAudio: %s\n", SDL_GetError());
             return -1;
         }
-        is->audio_hw_buf_size = spec.size;
-    }
+        is->audio_hw_buf_size = is->audio_spec.size;
+        is->audio_fmt = codecCtx->sample_fmt;
 
-    if (avcodec_open2(codecCtx, codec, NULL) < 0) {
-        fprintf(stderr, "Unsupported codec!\n");
-        return -1;
+        if (is->loudness_on) {
+            is->loudness = loudness_alloc(codecCtx->sample_rate, codecCtx->channels);
+            if (!is->loudness)
+                fprintf(stderr, "No loudness meter for %d channels\n", codecCtx->channels);
+        }
     }
 
     switch (codecCtx->codec_type) {
         case AVMEDIA_TYPE_AUDIO:
-            is->audioStream = stream_index;
+            is->audio_item  = item;
             is->audio_st    = pFormatCtx->streams[stream_index];
             is->audio_ctx   = codecCtx;
             is->audio_buf_size = 0;
             is->audio_buf_index = 0;
             memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
             packet_queue_init(&is->audioq);
+            is->audioq.item = item;
             SDL_PauseAudio(0);
             break;
         case AVMEDIA_TYPE_VIDEO:
-            is->videoSteam  = stream_index;
+            is->video_item  = item;
             is->video_st    = pFormatCtx->streams[stream_index];
             is->video_ctx   = codecCtx;
 
-            is->frame_timer = (double)av_gettime() / 10000000.0;
+            is->frame_timer = (double)av_gettime() / 1000000.0;
             is->frame_last_delay = 40e-3;
 
+            //the first file's size and format, later frames are scaled to it
+            if (is->shm_name) {
+                is->frame_sink = frame_sink_alloc(is->shm_name, codecCtx->width,
+                                                  codecCtx->height,
+                                                  is->shm_format != AV_PIX_FMT_NONE ?
+                                                  is->shm_format : codecCtx->pix_fmt, 0);
+                if (!is->frame_sink)
+                    fprintf(stderr, "%s: could not publish frames\n", is->shm_name);
+            }
+
             packet_queue_init(&is->videoq);
+            is->videoq.item = item;
             is->video_tid = SDL_CreateThread(video_thread, is);
-            is->sws_ctx = sws_getContext(is->video_ctx->width, is->video_ctx->height,
-                                         is->video_ctx->pix_fmt, is->video_ctx->width,
-                                         is->video_ctx->height, PIX_FMT_YUV420P,
-                                         SWS_BILINEAR, NULL, NULL, NULL);
             break;
         default:
             break;
     }
+    return 0;
 }
 
-int decode_thread(void *arg) {
-    VideoState *is = (VideoState *)arg;
-    AVFormatContext *pFormatCtx;
-    AVPacket pkt1, *packet = &pkt1;
+/*
+ * Position the demuxer on the keyframe before is->seek_pos and start a
+ * new queue generation. The decoders drop everything up to the target
+ * themselves, so the first picture shown is the one at seek_pos rather
+ * than at the keyframe.
+ */
+static void seek_to_target(VideoState *is) {
+    PlaylistItem *item = is->item;
+    int stream = item->videoStream;
+    int64_t pos, ts;
 
-    int video_index = -1;
-    int audio_index = -1;
-    int i;
+    //the timeline position within the file being demuxed, seeks do not
+    //cross into earlier files of the playlist
+    pos = is->seek_pos - (int64_t)(item->offset * AV_TIME_BASE);
+    if (pos < 0) {
+        pos = 0;
+        is->seek_pos = (int64_t)(item->offset * AV_TIME_BASE);
+    }
+    ts = av_rescale_q(pos, AV_TIME_BASE_Q, item->pFormatCtx->streams[stream]->time_base);
 
-    is->videoStream = -1;
-    is->audioStream = -1;
+    //publish the target before the new generation exists so that no
+    //decoder can see the new serial with a stale target
+    is->seek_target = (double)is->seek_pos / AV_TIME_BASE;
+    is->video_seek_serial = is->videoq.serial + 1;
+    is->audio_seek_serial = is->audioq.serial + 1;
 
-    global_video_state = is;
+    if (seek_index_seek(item->pFormatCtx, item->seek_index, stream, ts) == AV_NOPTS_VALUE &&
+        av_seek_frame(item->pFormatCtx, stream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        fprintf(stderr, "%s: error while seeking\n", is->filename);
+        is->seek_start = 0;
+    }
+    //flush even on failure, the seek serials must exist
+    packet_queue_flush(&is->audioq);
+    packet_queue_flush(&is->videoq);
+    is->trick_pos = is->trick_last = is->seek_target;
+}
+
+/*
+ * Fast forward/rewind beyond what decoding every frame can keep up
+ * with: seek 'speed' jumps worth of media ahead (or back) through the
+ * demuxer index and queue only the keyframe found there. CPU use is one
+ * keyframe decode per jump whatever the speed.
+ * Returns 1 if a keyframe was queued, 0 if not, -1 at the end or on error.
+ */
+static int trick_jump(VideoState *is, AVPacket *packet) {
+    PlaylistItem *item = is->item;
+    AVStream *st = item->pFormatCtx->streams[item->videoStream];
+    double kf;
+    int64_t ts;
 
-    //Open vidoe file
-    if (avformat_open_input(&pFormatCtx, is->filename, NULL, NULL) != 0)
-        return -1;  //Couldn't open file
+    if (is->speed < 0 && is->trick_pos <= item->offset)
+        return -1;  //rewound to the start of this file
+    is->trick_pos += is->speed * TRICK_JUMP_INTERVAL;
+    if (is->trick_pos < item->offset)
+        is->trick_pos = item->offset;
+    ts = (int64_t)((is->trick_pos - item->offset) / av_q2d(st->time_base));
 
-    is->pFormatCtx = pFormatCtx;
+    //forward takes the keyframe after the target so a long GOP does not
+    //hold us back, rewind the one before it
+    if (av_seek_frame(item->pFormatCtx, item->videoStream, ts,
+                      is->speed < 0 ? AVSEEK_FLAG_BACKWARD : 0) < 0)
+        return -1;
+    for (;;) {
+        if (av_read_frame(item->pFormatCtx, packet) < 0)
+            return -1;
+        if (packet->stream_index == item->videoStream && (packet->flags & AV_PKT_FLAG_KEY))
+            break;
+        av_free_packet(packet);
+    }
 
-    // Retrieve stream information
-    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
-        return -1;  //Couldn't find stream information
+    kf = (packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) * av_q2d(st->time_base) +
+         item->offset;
+    //rewinding inside a long GOP lands on the same keyframe again
+    if (is->speed > 0 ? kf <= is->trick_last : kf >= is->trick_last) {
+        av_free_packet(packet);
+        return 0;
+    }
+    if (is->speed > 0 && kf > is->trick_pos)
+        is->trick_pos = kf;
+    is->trick_last = kf;
+    packet_queue_put(&is->videoq, packet);
+    return 1;
+}
+
+/*
+ * Open 'filename' and its decoders. Every file of the playlist needs an
+ * audio and a video stream, and its audio must match the device opened
+ * for the first one: there is no resampler, and reopening the device
+ * would leave a gap.
+ */
+static PlaylistItem *playlist_item_open(VideoState *is, const char *filename) {
+    FastOpenOptions opts = is->fast_open;
+    PlaylistItem *item;
+    AVFormatContext *pFormatCtx = NULL;
+    int i;
+
+    item = av_mallocz(sizeof(PlaylistItem));
+    if (!item)
+        return NULL;
+    av_strlcpy(item->filename, filename, sizeof(item->filename));
+    item->videoStream = -1;
+    item->audioStream = -1;
+    item->refs = 3;
+
+    item->seek_index = seek_index_open(filename);
+
+    //local files are read through io_uring or our own mapping, both
+    //with large read ahead
+    if (is->input_io == INPUT_IO_URING)
+        item->io = uring_io_open(filename);
+    if (item->io)
+        item->io_close = uring_io_close;
+    else if (is->input_io != INPUT_IO_DEFAULT && (item->io = file_io_open(filename)))
+        item->io_close = file_io_close;
+    if (item->io) {
+        pFormatCtx = avformat_alloc_context();
+        pFormatCtx->pb = item->io;
+        pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    //Open vidoe file and retrieve stream information
+    if (fast_open_input(&pFormatCtx, filename, &opts, &item->open_stats) < 0) {
+        goto fail;  //Couldn't open file
+    }
+    item->pFormatCtx = pFormatCtx;
 
     //Dump information about file onto standard error
-    av_dump_format(pFormatCtx, 0, is->filename, 0);
+    av_dump_format(pFormatCtx, 0, filename, 0);
 
     //Find the first video stream
     for (i = 0; i < pFormatCtx->nb_streams; i++) {
         if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO &&
-            video_index < 0) {
-            video_index = i;
+            item->videoStream < 0) {
+            item->videoStream = i;
         }
         if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
-            audio_index < 0) {
-            audio_index= i;
+            item->audioStream < 0) {
+            item->audioStream = i;
         }
     }
-    if (audio_index >= 0) {
-        stream_component_open(is, audio_index);
+    //a remux copies packets and never decodes
+    if (is->remux_out) {
+        if (!(is->remux_streams & REMUX_VIDEO))
+            item->videoStream = -1;
+        if (!(is->remux_streams & REMUX_AUDIO))
+            item->audioStream = -1;
+        return item;
     }
-    if (video_index >= 0) {
-        stream_component_open(is, video_index);
+    if (item->videoStream >= 0)
+        item->video_ctx = open_codec(is, pFormatCtx->streams[item->videoStream]);
+    if (item->audioStream >= 0)
+        item->audio_ctx = open_codec(is, pFormatCtx->streams[item->audioStream]);
+    if (!item->video_ctx || !item->audio_ctx) {
+        fprintf(stderr, "%s: could not open codecs\n", filename);
+        goto fail;
     }
 
-    if (is->videoStream < 0 || is->audioStream < 0) {
-        printf(stderr, "%s: could not open codecs\n", is->filename);
+    //this is the preload thread, the audio callback may be freeing the
+    //old item's decoder, so compare with what the device was opened for
+    if (is->audio_spec.freq &&
+        (item->audio_ctx->sample_rate != is->audio_spec.freq ||
+         item->audio_ctx->channels != is->audio_spec.channels ||
+         item->audio_ctx->sample_fmt != is->audio_fmt)) {
+        fprintf(stderr, "%s: audio format differs from the playlist's, skipped\n", filename);
         goto fail;
     }
+    return item;
+
+fail:
+    playlist_item_free(item);
+    return NULL;
+}
+
+//read the first packets ahead, so the handover does not wait on the disk
+static void playlist_item_preroll(PlaylistItem *item) {
+    PacketList **tail = &item->preroll;
+    AVPacket pkt;
+    int got_video = 0, got_audio = 0;
+    int i;
+
+    for (i = 0; i < PLAYLIST_PREROLL_PACKETS && !(got_video && got_audio); i++) {
+        if (av_read_frame(item->pFormatCtx, &pkt) < 0)
+            break;
+        if (pkt.stream_index != item->videoStream && pkt.stream_index != item->audioStream) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        if (av_dup_packet(&pkt) < 0 || !(*tail = av_mallocz(sizeof(PacketList)))) {
+            av_free_packet(&pkt);
+            break;
+        }
+        (*tail)->pkt = pkt;
+        tail = &(*tail)->next;
+        got_video |= pkt.stream_index == item->videoStream;
+        got_audio |= pkt.stream_index == item->audioStream;
+    }
+}
+
+//index of the file after 'pos', -1 at the end of the playlist
+static int playlist_next_pos(VideoState *is, int pos) {
+    if (++pos < is->nb_playlist)
+        return pos;
+    return is->loop ? 0 : -1;
+}
+
+//open and preroll the next file while the current one plays
+static int preload_thread(void *arg) {
+    VideoState *is = (VideoState *)arg;
+    PlaylistItem *item = NULL;
+    int i;
+
+    //files that fail to open are skipped, each of them once
+    for (i = 0; i < is->nb_playlist && is->preload_pos >= 0 && !is->quit; i++) {
+        item = playlist_item_open(is, is->playlist[is->preload_pos]);
+        if (item)
+            break;
+        is->preload_pos = playlist_next_pos(is, is->preload_pos);
+    }
+    if (item)
+        playlist_item_preroll(item);
+    is->next_item = item;
+    return 0;
+}
+
+static void start_preload(VideoState *is) {
+    is->preload_pos = playlist_next_pos(is, is->playlist_pos);
+    if (is->preload_pos >= 0)
+        is->preload_tid = SDL_CreateThread(preload_thread, is);
+}
+
+/*
+ * The current file is done, move the demuxer on to the preloaded one.
+ * Its timestamps are shifted to start where the audio read so far ends,
+ * so the audio clock and the pictures carry on without a jump and the
+ * decoders switch over sample and frame exact.
+ * Returns -1 at the end of the playlist.
+ */
+static int playlist_advance(VideoState *is) {
+    PlaylistItem *next;
+    PacketList *pktl;
+    AVFormatContext *ic = is->item->pFormatCtx;
+    double end = is->demux_audio_end;
+
+    if (!is->preload_tid)
+        return -1;
+    SDL_WaitThread(is->preload_tid, NULL);
+    is->preload_tid = NULL;
+    next = is->next_item;
+    is->next_item = NULL;
+    if (!next)
+        return -1;
+
+    //trick play does not read audio, take the end from the duration
+    if (is->speed != 1 && ic->duration != AV_NOPTS_VALUE) {
+        end = is->item->offset + (double)ic->duration / AV_TIME_BASE;
+        if (ic->start_time != AV_NOPTS_VALUE)
+            end += (double)ic->start_time / AV_TIME_BASE;
+    }
+    next->offset = end;
+    if (next->pFormatCtx->start_time != AV_NOPTS_VALUE)
+        next->offset -= (double)next->pFormatCtx->start_time / AV_TIME_BASE;
+
+    playlist_item_unref(is, is->item);
+    is->item = next;
+    is->playlist_pos = is->preload_pos;
+    is->demux_audio_end = next->offset;
+    av_strlcpy(is->filename, next->filename, sizeof(is->filename));
+
+    //everything queued from here on belongs to the new file
+    is->audioq.item = next;
+    is->videoq.item = next;
+    while ((pktl = next->preroll)) {
+        next->preroll = pktl->next;
+        if (pktl->pkt.stream_index == next->videoStream)
+            packet_queue_put(&is->videoq, &pktl->pkt);
+        else if (is->speed == 1)
+            packet_queue_put(&is->audioq, &pktl->pkt);
+        else
+            av_free_packet(&pktl->pkt);
+        av_free(pktl);
+    }
+
+    start_preload(is);
+    return 0;
+}
+
+//whether the demuxer has read far enough for the remux range
+static int remux_past_end(VideoState *is, AVPacket *packet) {
+    AVFormatContext *ic = is->item->pFormatCtx;
+    int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    double t;
+
+    if (is->remux_end <= 0 || ts == AV_NOPTS_VALUE ||
+        (packet->stream_index != is->item->videoStream &&
+         packet->stream_index != is->item->audioStream))
+        return 0;
+    t = ts * av_q2d(ic->streams[packet->stream_index]->time_base);
+    if (ic->start_time != AV_NOPTS_VALUE)
+        t -= (double)ic->start_time / AV_TIME_BASE;
+    return t > is->remux_end + REMUX_END_SLACK;
+}
+
+int decode_thread(void *arg) {
+    VideoState *is = (VideoState *)arg;
+    PlaylistItem *item;
+    AVStream *st;
+    AVPacket pkt1, *packet = &pkt1;
+    double end;
+
+    global_video_state = is;
+
+    //remux() has opened the file and the queues already, the packets
+    //go to it instead of to decoders
+    if (!is->remux_out) {
+        is->gop_cache = gop_cache_alloc(GOP_CACHE_BUDGET);
+        is->frame_pool = frame_pool_alloc();
+
+        item = playlist_item_open(is, is->playlist[is->playlist_pos]);
+        if (!item) {
+            goto fail;
+        }
+        is->item = item;
+        is->open_stats = item->open_stats;
+        av_strlcpy(is->filename, item->filename, sizeof(is->filename));
+
+        if (stream_component_open(is, item, item->audioStream) < 0 ||
+            stream_component_open(is, item, item->videoStream) < 0) {
+            fprintf(stderr, "%s: could not open codecs\n", is->filename);
+            goto fail;
+        }
+        start_preload(is);
+    }
 
     //main decode loop
     for (;;) {
         if (is->quit) {
             break;
         }
-        //seek stuff goes here
+        if (is->seek_req) {
+            seek_to_target(is);
+            is->seek_req = 0;
+        }
+        if (trick_keyframes(is)) {
+            //pace the jumps by the display, one keyframe in flight
+            if (is->videoq.nb_packets > 0)
+                SDL_Delay(10);
+            else if (trick_jump(is, packet) < 0 &&
+                     (is->speed < 0 || playlist_advance(is) < 0))
+                SDL_Delay(100); //start or end of the playlist
+            continue;
+        }
         if (is->audioq.size > MAX_AUDIOQ_SIZE ||
-            is->audioq.size > MAX_VIDEOQ_SIZE) {
+            is->videoq.size > MAX_VIDEOQ_SIZE) {
             SDL_Delay(10);
             continue;
         }
-        if (av_read_frame(is->pFormatCtx, packet) < 0) {
-            if (is->pFormatCtx->pb->error == 0) {
-                SDL_Delay(100); //no error, wait for user input
+        if (av_read_frame(is->item->pFormatCtx, packet) < 0) {
+            if (is->remux_out) {
+                break;  //one file, no waiting for the user
+            } else if (is->item->pFormatCtx->pb->error == 0) {
+                //carry straight on with the next file, if there is one
+                if (playlist_advance(is) < 0)
+                    SDL_Delay(100); //no error, wait for user input
                 continue;
             } else {
                 break;
             }
         }
 
+        if (is->remux_out && remux_past_end(is, packet)) {
+            av_free_packet(packet);
+            break;
+        }
+
         //Is this a packet from the video stream?
-        if (packet->stream_index == is->videoStream) {
+        if (packet->stream_index == is->item->videoStream) {
             packet_queue_put(&is->videoq, packet);
-        } else if (packet->stream_index == is->audioStream) {
+        } else if (packet->stream_index == is->item->audioStream && is->speed == 1) {
+            st = is->item->pFormatCtx->streams[packet->stream_index];
+            if (packet->pts != AV_NOPTS_VALUE) {
+                end = (packet->pts + packet->duration) * av_q2d(st->time_base) +
+                      is->item->offset;
+                if (end > is->demux_audio_end)
+                    is->demux_audio_end = end;
+            }
             packet_queue_put(&is->audioq, packet);
         } else {
             av_free_packet(packet);
         }
     }
 
+    if (is->remux_out) {
+        SDL_LockMutex(is->videoq.mutex);
+        is->demux_eof = 1;
+        SDL_UnlockMutex(is->videoq.mutex);
+    }
+
     //all done -- wait for it
     while (!is->quit) {
         SDL_Delay(100);
@@ -260,20 +1708,298 @@ fail:
     return 0;
 }
 
+//time of the first packet queued (AV_TIME_BASE), INT64_MAX if there is none
+static int64_t packet_queue_head_time(PacketQueue *q) {
+    int64_t t = INT64_MAX;
+
+    SDL_LockMutex(q->mutex);
+    if (q->first_pkt) {
+        AVPacket *pkt = &q->first_pkt->pkt;
+        AVStream *st = q->first_pkt->item->pFormatCtx->streams[pkt->stream_index];
+        int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+        //nothing to order it by, send it on right away
+        t = ts != AV_NOPTS_VALUE ? av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q) : INT64_MIN;
+    }
+    SDL_UnlockMutex(q->mutex);
+    return t;
+}
+
+/*
+ * The queue to write from next: the one whose head is earlier, or the
+ * only one with packets once the demuxer has finished, or once that one
+ * is filling up and would stall the demuxer. NULL when there is
+ * nothing to write yet, 'done' is set when there will be nothing more.
+ */
+static PacketQueue *remux_next_queue(VideoState *is, int *done) {
+    int64_t tv = is->item->videoStream >= 0 ? packet_queue_head_time(&is->videoq) : INT64_MAX;
+    int64_t ta = is->item->audioStream >= 0 ? packet_queue_head_time(&is->audioq) : INT64_MAX;
+    int eof;
+
+    SDL_LockMutex(is->videoq.mutex);
+    eof = is->demux_eof;
+    SDL_UnlockMutex(is->videoq.mutex);
+
+    *done = 0;
+    if (tv != INT64_MAX && ta != INT64_MAX)
+        return tv <= ta ? &is->videoq : &is->audioq;
+    if (tv != INT64_MAX && (eof || is->item->audioStream < 0 || is->videoq.size > MAX_VIDEOQ_SIZE / 2))
+        return &is->videoq;
+    if (ta != INT64_MAX && (eof || is->item->videoStream < 0 || is->audioq.size > MAX_AUDIOQ_SIZE / 2))
+        return &is->audioq;
+    //a packet may have come in between looking at the queues and at
+    //eof, look again before giving up
+    *done = eof && tv == INT64_MAX && ta == INT64_MAX &&
+            packet_queue_head_time(&is->videoq) == INT64_MAX &&
+            packet_queue_head_time(&is->audioq) == INT64_MAX;
+    return NULL;
+}
+
+/*
+ * Stream copy the first video and audio stream of the file into
+ * is->remux_out, trimmed to is->remux_start - is->remux_end. The cut
+ * starts at the keyframe before remux_start, since nothing before a
+ * keyframe can be decoded. decode_thread demuxes into the packet
+ * queues as for playback, this thread writes them out in dts order.
+ * No decoder is ever opened.
+ */
+static int remux(VideoState *is) {
+    PlaylistItem *item;
+    AVFormatContext *ic, *oc = NULL;
+    AVPacket pkt;
+    int map[2], in[2];
+    int64_t start_time, cut_pts = AV_NOPTS_VALUE, cut_dts = 0, end = INT64_MAX;
+    int64_t started = av_gettime(), nb_packets = 0, bytes = 0;
+    int i, nb_out = 0, done = 0, ret = -1;
+
+    global_video_state = is;
+    item = playlist_item_open(is, is->playlist[0]);
+    if (!item)
+        return -1;
+    is->item = item;
+    ic = item->pFormatCtx;
+    av_strlcpy(is->filename, item->filename, sizeof(is->filename));
+    if (item->videoStream < 0 && item->audioStream < 0) {
+        fprintf(stderr, "%s: none of the requested streams\n", is->filename);
+        goto end;
+    }
+    start_time = ic->start_time != AV_NOPTS_VALUE ? ic->start_time : 0;
+
+    avformat_alloc_output_context2(&oc, NULL, NULL, is->remux_out);
+    if (!oc) {
+        fprintf(stderr, "%s: unknown output format\n", is->remux_out);
+        goto end;
+    }
+    in[0] = item->videoStream;
+    in[1] = item->audioStream;
+    for (i = 0; i < 2; i++) {
+        AVStream *ist, *ost;
+
+        map[i] = -1;
+        if (in[i] < 0)
+            continue;
+        ist = ic->streams[in[i]];
+        ost = avformat_new_stream(oc, NULL);
+        if (!ost || avcodec_copy_context(ost->codec, ist->codec) < 0)
+            goto end;
+        //the input container's tag may mean nothing in the output one
+        ost->codec->codec_tag = 0;
+        if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+            ost->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+        ost->time_base = ist->time_base;
+        map[i] = nb_out++;
+    }
+    if (!(oc->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&oc->pb, is->remux_out, AVIO_FLAG_WRITE) < 0) {
+        fprintf(stderr, "%s: could not open for writing\n", is->remux_out);
+        goto end;
+    }
+    if (avformat_write_header(oc, NULL) < 0)
+        goto end;
+
+    //onto the keyframe at or before the start
+    if (is->remux_start > 0) {
+        int stream = item->videoStream >= 0 ? item->videoStream : item->audioStream;
+        int64_t ts = av_rescale_q(start_time + (int64_t)(is->remux_start * AV_TIME_BASE),
+                                  AV_TIME_BASE_Q, ic->streams[stream]->time_base);
+
+        if (seek_index_seek(ic, item->seek_index, stream, ts) == AV_NOPTS_VALUE &&
+            av_seek_frame(ic, stream, ts, AVSEEK_FLAG_BACKWARD) < 0)
+            fprintf(stderr, "%s: could not seek, copying from the start\n", is->filename);
+    }
+    if (is->remux_end > 0)
+        end = start_time + (int64_t)(is->remux_end * AV_TIME_BASE);
+    //without video any packet can start the cut
+    if (item->videoStream < 0)
+        cut_pts = start_time + (int64_t)(is->remux_start * AV_TIME_BASE);
+    cut_dts = cut_pts != AV_NOPTS_VALUE ? cut_pts : 0;
+
+    packet_queue_init(&is->videoq);
+    packet_queue_init(&is->audioq);
+    is->videoq.item = is->audioq.item = item;
+    is->parse_tid = SDL_CreateThread(decode_thread, is);
+    if (!is->parse_tid)
+        goto end;
+
+    while (!done) {
+        PacketQueue *q = remux_next_queue(is, &done);
+        AVStream *ist, *ost;
+        int64_t pts, dts;
+        int video;
+
+        if (!q) {
+            if (!done)
+                SDL_Delay(5);
+            continue;
+        }
+        packet_queue_get(q, &pkt, 0, NULL, NULL);
+        video = q == &is->videoq;
+        ist = ic->streams[pkt.stream_index];
+        pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+        pts = pts != AV_NOPTS_VALUE ? av_rescale_q(pts, ist->time_base, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+        dts = pkt.dts != AV_NOPTS_VALUE ? av_rescale_q(pkt.dts, ist->time_base, AV_TIME_BASE_Q) : pts;
+
+        //the output starts with the first video keyframe, everything
+        //is shifted so its dts is 0
+        if (cut_pts == AV_NOPTS_VALUE && video && (pkt.flags & AV_PKT_FLAG_KEY) &&
+            pts != AV_NOPTS_VALUE) {
+            cut_pts = pts;
+            cut_dts = dts;
+        }
+        //video ends on decode order, a reference always decodes before
+        //the frames using it, so a kept packet never needs a dropped one
+        //even if the last frames kept show after the end
+        if (cut_pts == AV_NOPTS_VALUE || pts == AV_NOPTS_VALUE ||
+            pts < cut_pts || (video ? dts : pts) >= end) {
+            av_free_packet(&pkt);
+            continue;
+        }
+
+        ost = oc->streams[map[!video]];
+        if (pkt.pts != AV_NOPTS_VALUE)
+            pkt.pts = av_rescale_q(pts - cut_dts, AV_TIME_BASE_Q, ost->time_base);
+        pkt.dts = av_rescale_q(dts - cut_dts, AV_TIME_BASE_Q, ost->time_base);
+        pkt.duration = av_rescale_q(pkt.duration, ist->time_base, ost->time_base);
+        pkt.stream_index = map[!video];
+        pkt.pos = -1;
+        nb_packets++;
+        bytes += pkt.size;
+        if (av_interleaved_write_frame(oc, &pkt) < 0) {
+            fprintf(stderr, "%s: error while writing\n", is->remux_out);
+            av_free_packet(&pkt);
+            break;
+        }
+        av_free_packet(&pkt);
+    }
+    if (done && av_write_trailer(oc) == 0)
+        ret = 0;
+    fprintf(stderr, "%s: %lld packets, %lld KiB copied in %.1f ms\n", is->remux_out,
+            (long long)nb_packets, (long long)(bytes / 1024),
+            (av_gettime() - started) / 1000.0);
+
+end:
+    is->quit = 1;
+    if (is->parse_tid)
+        SDL_WaitThread(is->parse_tid, NULL);
+    if (is->videoq.mutex) {
+        packet_queue_flush(&is->videoq);
+        packet_queue_flush(&is->audioq);
+    }
+    if (oc && !(oc->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    playlist_item_free(item);
+    return ret;
+}
+
 int main(int argc, char **argv) {
     SDL_Event event;
+    SDL_Surface *resized;
     VideoState *is;
+    double incr, pos;
+    int i, analyze = 0;
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: test <file>\n");
+    is = av_mallocz(sizeof(VideoState));
+
+    fast_open_default_options(&is->fast_open);
+    is->input_io = INPUT_IO_MMAP;
+    is->audio_seek_serial = is->video_seek_serial = -1;
+    is->speed = 1;
+    is->remux_streams = REMUX_VIDEO | REMUX_AUDIO;
+    is->shm_format = AV_PIX_FMT_NONE;
+    for (i = 1; i < argc; i++) {
+        if (fast_open_parse_option(&is->fast_open, argc, argv, &i))
+            continue;
+        if (!strcmp(argv[i], "-io") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "mmap"))
+                is->input_io = INPUT_IO_MMAP;
+            else if (!strcmp(argv[i], "uring"))
+                is->input_io = INPUT_IO_URING;
+            else
+                is->input_io = INPUT_IO_DEFAULT;
+        } else if (!strcmp(argv[i], "-loop")) {
+            is->loop = 1;
+        } else if (!strcmp(argv[i], "-nodither")) {
+            is->no_dither = 1;
+        } else if (!strcmp(argv[i], "-loudness")) {
+            is->loudness_on = 1;
+        } else if (!strcmp(argv[i], "-shm") && i + 1 < argc) {
+            is->shm_name = argv[++i];
+        } else if (!strcmp(argv[i], "-shmfmt") && i + 1 < argc) {
+            is->shm_format = av_get_pix_fmt(argv[++i]);
+            if (is->shm_format == AV_PIX_FMT_NONE) {
+                fprintf(stderr, "%s: unknown pixel format\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-analyze")) {
+            analyze = 1;
+        } else if (!strcmp(argv[i], "-remux") && i + 1 < argc) {
+            is->remux_out = argv[++i];
+        } else if (!strcmp(argv[i], "-ss") && i + 1 < argc) {
+            is->remux_start = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-to") && i + 1 < argc) {
+            is->remux_end = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-streams") && i + 1 < argc) {
+            i++;
+            is->remux_streams = (strchr(argv[i], 'v') ? REMUX_VIDEO : 0) |
+                                (strchr(argv[i], 'a') ? REMUX_AUDIO : 0);
+        } else {
+            //files play back to back, gapless
+            argv[is->nb_playlist++] = argv[i];
+        }
+    }
+    if (is->nb_playlist < 1) {
+        fprintf(stderr, "Usage: test [-fast] [-probesize BYTES] [-analyzeduration USEC]\n"
+                        "            [-io default|mmap|uring] [-loop] [-nodither] [-loudness]\n"
+                        "            [-shm NAME [-shmfmt FORMAT]]\n"
+                        "            <file> [<file> ...]\n"
+                        "       test -remux OUT [-ss START] [-to END] [-streams va] <file>\n"
+                        "       test -analyze <file> [<file> ...]\n");
         exit(1);
     }
-
-    is = av_mallocz(sizeof(VideoState));
+    is->playlist = argv;
 
     //register all formats and codecs
     av_register_all();
 
+    //cut a clip without decoding, no window or audio device needed
+    if (is->remux_out)
+        return remux(is) < 0 ? 1 : 0;
+
+    //loudness of whole files, decoded as fast as they go
+    if (analyze) {
+        int failed = 0;
+
+        for (i = 0; i < is->nb_playlist; i++) {
+            if (loudness_analyze(is->playlist[i]) < 0) {
+                fprintf(stderr, "%s: could not analyze\n", is->playlist[i]);
+                failed = 1;
+            }
+        }
+        return failed;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
         fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
         exit(1);
@@ -281,9 +2007,9 @@ int main(int argc, char **argv) {
 
     //make a screen to put our video
 #ifndef __DARWIN__
-    screen = SDL_SetVideoMode(640, 480, 0, 0);
+    screen = SDL_SetVideoMode(640, 480, 0, SDL_RESIZABLE);
 #else
-    screen = SDL_SetVideoMode(640, 480, 24, 0);
+    screen = SDL_SetVideoMode(640, 480, 24, SDL_RESIZABLE);
 #endif
     if (!screen) {
         fprintf(stderr, "SDL: could not set video mode - exiting\n");
@@ -291,9 +2017,10 @@ int main(int argc, char **argv) {
     }
 
     screen_mutex = SDL_CreateMutex();
+    is->display_w = is->resize_w = screen->w;
+    is->display_h = is->resize_h = screen->h;
 
-    av_strlcpy(is->filename, argv[1], sizeof(is->filename));
-
+    is->item_mutex  = SDL_CreateMutex();
     is->pictq_mutex = SDL_CreateMutex();
     is->pictq_cond  = SDL_CreateCond();
 
@@ -310,13 +2037,104 @@ int main(int argc, char **argv) {
         switch(event.type) {
         case FF_QUIT_EVENT:
         case SDL_QUIT:
+            frame_pool_print_stats(is->frame_pool, is->filename);
+            slice_scale_print_stats(is->scaler, is->filename);
+            loudness_print_stats(is->loudness, is->filename);
+            frame_sink_print_stats(is->frame_sink, is->filename);
+            //consumers see the end, the video thread may still write, so
+            //the sink and its mapping are left to the process exit like
+            //everything else the threads use
+            frame_sink_close(is->frame_sink);
             is->quit = 1;
             SDL_Quit();
             return 0;
             break;
+        case SDL_KEYDOWN:
+            switch (event.key.keysym.sym) {
+            case SDLK_LEFT:
+                incr = -10.0;
+                goto do_seek;
+            case SDLK_RIGHT:
+                incr = 10.0;
+                goto do_seek;
+            case SDLK_UP:
+                incr = 60.0;
+                goto do_seek;
+            case SDLK_DOWN:
+                incr = -60.0;
+                goto do_seek;
+            case SDLK_SPACE:
+                if (global_video_state)
+                    toggle_pause(global_video_state);
+                break;
+            case SDLK_PERIOD:
+            case SDLK_COMMA:
+                if (global_video_state)
+                    step_frame(global_video_state,
+                               event.key.keysym.sym == SDLK_PERIOD ? 1 : -1);
+                break;
+            case SDLK_RIGHTBRACKET:
+            case SDLK_LEFTBRACKET:
+                //']' and '[' walk the speeds, '=' is back to 1x
+                if (global_video_state) {
+                    static const int speeds[] = { -32, -16, -8, -4, -2, 1, 2, 4, 8, 16, 32 };
+                    int n = sizeof(speeds) / sizeof(speeds[0]);
+                    int k;
+
+                    for (k = 0; k < n - 1 && speeds[k] != global_video_state->speed; k++)
+                        ;
+                    k += event.key.keysym.sym == SDLK_RIGHTBRACKET ? 1 : -1;
+                    if (k >= 0 && k < n)
+                        set_speed(global_video_state, speeds[k]);
+                }
+                break;
+            case SDLK_EQUALS:
+                if (global_video_state)
+                    set_speed(global_video_state, 1);
+                break;
+            case SDLK_b:
+                //short reverse playback, as far back as the cache goes
+                if (global_video_state && global_video_state->video_st) {
+                    if (!global_video_state->paused)
+                        toggle_pause(global_video_state);
+                    global_video_state->reverse = 1;
+                    refresh_wake(global_video_state);
+                }
+                break;
+            do_seek:
+                if (global_video_state && global_video_state->audio_st) {
+                    pos = get_audio_clock(global_video_state) + incr;
+                    if (pos < 0)
+                        pos = 0;
+                    stream_seek(global_video_state, (int64_t)(pos * AV_TIME_BASE));
+                }
+                break;
+            default:
+                break;
+            }
+            break;
         case FF_REFRESH_EVENT:
             video_refresh_timer(event.user.data1);
             break;
+        case SDL_VIDEORESIZE:
+            //pictures already queued are scaled by SDL until the new
+            //size settles and the next ones are converted for it
+            SDL_LockMutex(screen_mutex);
+            resized = SDL_SetVideoMode(event.resize.w, event.resize.h,
+                                       screen->format->BitsPerPixel, SDL_RESIZABLE);
+            if (resized)
+                screen = resized;
+            is->resize_w = screen->w;
+            is->resize_h = screen->h;
+            is->resize_time = av_gettime();
+            SDL_UnlockMutex(screen_mutex);
+            if (global_video_state)
+                video_expose(global_video_state);
+            break;
+        case SDL_VIDEOEXPOSE:
+            if (global_video_state)
+                video_expose(global_video_state);
+            break;
         default:
             break;
         }
@@ -0,0 +1,397 @@
+//uringio.c
+//io_uring input for local files. The file is read in URING_IO_BLOCK_SIZE
+//blocks and the URING_IO_DEPTH blocks from the reader's position on are
+//kept submitted, so by the time the demuxer gets to a block it has
+//usually completed and av_read_frame only pays for a memcpy.
+//The ring is driven with the raw system calls, no liburing needed.
+
+#include <libavformat/avio.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "uringio.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+#include <linux/io_uring.h>
+
+enum {
+    BLOCK_FREE,
+    BLOCK_PENDING,
+    BLOCK_DONE,
+};
+
+typedef struct UringBlock {
+    uint8_t     *data;
+    int64_t     offset;     //file offset of the block, -1 if unused
+    int         len;        //bytes read, or a negative errno
+    int         state;
+    struct iovec iov;
+}UringBlock;
+
+typedef struct UringIO {
+    int         fd;
+    int64_t     size;
+    int64_t     pos;
+
+    int         ring_fd;
+    void        *sq_ring, *cq_ring;
+    size_t      sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t      sqes_size;
+    unsigned    *sq_tail, *sq_mask, *sq_array;
+    unsigned    *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    UringBlock  blocks[URING_IO_DEPTH];
+    int         nb_pending;     //blocks queued, submitted or not
+    int         nb_unsubmitted; //SQEs the kernel has not taken yet
+}UringIO;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int64_t block_start(int64_t pos) {
+    return pos & ~(int64_t)(URING_IO_BLOCK_SIZE - 1);
+}
+
+static UringBlock *find_block(UringIO *u, int64_t offset) {
+    int i;
+    for (i = 0; i < URING_IO_DEPTH; i++) {
+        if (u->blocks[i].offset == offset)
+            return &u->blocks[i];
+    }
+    return NULL;
+}
+
+//a block can be reused once it is complete and outside the window
+static UringBlock *free_block(UringIO *u, int64_t window) {
+    int i;
+    for (i = 0; i < URING_IO_DEPTH; i++) {
+        UringBlock *b = &u->blocks[i];
+        if (b->state != BLOCK_PENDING &&
+            (b->offset < window ||
+             b->offset >= window + URING_IO_DEPTH * (int64_t)URING_IO_BLOCK_SIZE))
+            return b;
+    }
+    return NULL;
+}
+
+static void queue_read(UringIO *u, UringBlock *b, int64_t offset) {
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+
+    b->offset = offset;
+    b->state = BLOCK_PENDING;
+    b->len = 0;
+    b->iov.iov_base = b->data;
+    b->iov.iov_len = FFMIN(URING_IO_BLOCK_SIZE, u->size - offset);
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;  //READV works from 5.1 on, READ needs 5.6
+    sqe->fd = u->fd;
+    sqe->off = offset;
+    sqe->addr = (unsigned long)&b->iov;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)b;
+
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->nb_pending++;
+    u->nb_unsubmitted++;
+}
+
+static int nb_in_flight(UringIO *u) {
+    return u->nb_pending - u->nb_unsubmitted;
+}
+
+//collect completions, blocking for at least one if 'wait' is set and
+//any read is in flight. Returns 0 or an AVERROR.
+static int reap(UringIO *u, int wait) {
+    unsigned head;
+
+    if (wait && nb_in_flight(u) > 0) {
+        while (uring_enter(u->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno != EINTR)
+                return AVERROR(errno);
+        }
+    }
+
+    head = *u->cq_head;
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        UringBlock *b = (UringBlock *)(unsigned long)cqe->user_data;
+
+        b->len = cqe->res;
+        b->state = BLOCK_DONE;
+        u->nb_pending--;
+        head++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//hand the queued SQEs to the kernel. A partial submit leaves the rest
+//in the ring and is retried, EAGAIN/EBUSY waits for a completion first
+//when there is one to wait for. Returns 0 or an AVERROR.
+static int submit(UringIO *u) {
+    while (u->nb_unsubmitted > 0) {
+        int ret = uring_enter(u->ring_fd, u->nb_unsubmitted, 0, 0);
+
+        if (ret > 0) {
+            u->nb_unsubmitted -= FFMIN(ret, u->nb_unsubmitted);
+            continue;
+        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && (errno == EAGAIN || errno == EBUSY) && nb_in_flight(u) > 0) {
+            ret = reap(u, 1);
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+        return ret < 0 ? AVERROR(errno) : AVERROR(EAGAIN);
+    }
+    return 0;
+}
+
+//queue every block of the window that is neither read nor in flight and
+//submit. Returns 0 or an AVERROR.
+static int fill_window(UringIO *u) {
+    int64_t window = block_start(u->pos);
+    int64_t offset;
+
+    for (offset = window;
+         offset < window + URING_IO_DEPTH * (int64_t)URING_IO_BLOCK_SIZE && offset < u->size;
+         offset += URING_IO_BLOCK_SIZE) {
+        UringBlock *b;
+
+        if (find_block(u, offset))
+            continue;
+        b = free_block(u, window);
+        if (!b)
+            break;
+        queue_read(u, b, offset);
+    }
+    return submit(u);
+}
+
+static int uring_io_read(void *opaque, uint8_t *buf, int buf_size) {
+    UringIO *u = (UringIO *)opaque;
+    int64_t offset = block_start(u->pos);
+    UringBlock *b;
+    ssize_t len;
+
+    if (u->pos >= u->size)
+        return AVERROR_EOF;
+
+    for (;;) {
+        int ret;
+
+        b = find_block(u, offset);
+        if (b && b->state == BLOCK_DONE)
+            break;
+        //also resubmits what an earlier call could not
+        ret = fill_window(u);
+        if (ret < 0)
+            return ret;
+        //only blocks if the demuxer caught up with the reads in flight
+        ret = reap(u, 1);
+        if (ret < 0)
+            return ret;
+    }
+
+    len = b->len - (u->pos - b->offset);
+    if (len > 0) {
+        len = FFMIN(len, buf_size);
+        memcpy(buf, b->data + (u->pos - b->offset), len);
+    } else {
+        //failed or short read, do this one synchronously
+        len = pread(u->fd, buf, buf_size, u->pos);
+        if (len <= 0)
+            return len == 0 ? AVERROR_EOF : AVERROR(errno);
+    }
+    u->pos += len;
+
+    //pick up whatever finished meanwhile and slide the window, a failure
+    //here shows up again on the next read
+    reap(u, 0);
+    fill_window(u);
+    return (int)len;
+}
+
+static int64_t uring_io_seek(void *opaque, int64_t offset, int whence) {
+    UringIO *u = (UringIO *)opaque;
+    int64_t pos;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return u->size;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = u->pos + offset;
+        break;
+    case SEEK_END:
+        pos = u->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > u->size)
+        return AVERROR(EINVAL);
+
+    //blocks still inside the new window are kept, the rest is reused
+    u->pos = pos;
+    return pos;
+}
+
+static void uring_free(UringIO *u) {
+    int i;
+
+    //SQEs never submitted are dropped with the ring
+    while (nb_in_flight(u) > 0 && reap(u, 1) == 0)
+        ;
+
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->ring_fd >= 0)
+        close(u->ring_fd);
+    if (u->fd >= 0)
+        close(u->fd);
+    for (i = 0; i < URING_IO_DEPTH; i++)
+        free(u->blocks[i].data);
+    av_free(u);
+}
+
+static int map_rings(UringIO *u, const struct io_uring_params *p) {
+    u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_ring_size = u->cq_ring_size = FFMAX(u->sq_ring_size, u->cq_ring_size);
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = NULL;
+            return -1;
+        }
+    }
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    u->sq_tail  = (unsigned *)((uint8_t *)u->sq_ring + p->sq_off.tail);
+    u->sq_mask  = (unsigned *)((uint8_t *)u->sq_ring + p->sq_off.ring_mask);
+    u->sq_array = (unsigned *)((uint8_t *)u->sq_ring + p->sq_off.array);
+    u->cq_head  = (unsigned *)((uint8_t *)u->cq_ring + p->cq_off.head);
+    u->cq_tail  = (unsigned *)((uint8_t *)u->cq_ring + p->cq_off.tail);
+    u->cq_mask  = (unsigned *)((uint8_t *)u->cq_ring + p->cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)((uint8_t *)u->cq_ring + p->cq_off.cqes);
+    return 0;
+}
+
+AVIOContext *uring_io_open(const char *filename) {
+    struct io_uring_params params;
+    struct stat st;
+    AVIOContext *pb;
+    uint8_t *buffer;
+    UringIO *u;
+    int i;
+
+    u = av_mallocz(sizeof(UringIO));
+    if (!u)
+        return NULL;
+    u->ring_fd = -1;
+    for (i = 0; i < URING_IO_DEPTH; i++)
+        u->blocks[i].offset = -1;
+
+    u->fd = open(filename, O_RDONLY);
+    if (u->fd < 0 || fstat(u->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        goto fail;
+    u->size = st.st_size;
+    posix_fadvise(u->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    //ENOSYS on kernels before 5.1, EPERM where it is disabled
+    memset(&params, 0, sizeof(params));
+    u->ring_fd = uring_setup(URING_IO_DEPTH, &params);
+    if (u->ring_fd < 0 || map_rings(u, &params) < 0)
+        goto fail;
+
+    for (i = 0; i < URING_IO_DEPTH; i++) {
+        if (posix_memalign((void **)&u->blocks[i].data, 4096, URING_IO_BLOCK_SIZE) != 0) {
+            u->blocks[i].data = NULL;
+            goto fail;
+        }
+    }
+
+    buffer = av_malloc(URING_IO_BUFFER_SIZE);
+    pb = buffer ? avio_alloc_context(buffer, URING_IO_BUFFER_SIZE, 0, u,
+                                     uring_io_read, NULL, uring_io_seek) : NULL;
+    if (!pb) {
+        av_free(buffer);
+        goto fail;
+    }
+    pb->seekable = AVIO_SEEKABLE_NORMAL;
+
+    fill_window(u);
+    return pb;
+
+fail:
+    uring_free(u);
+    return NULL;
+}
+
+void uring_io_close(AVIOContext **pb) {
+    if (!*pb)
+        return;
+    uring_free((UringIO *)(*pb)->opaque);
+    av_freep(&(*pb)->buffer);
+    av_freep(pb);
+}
+
+#else
+
+AVIOContext *uring_io_open(const char *filename) {
+    return NULL;    //no io_uring on this platform
+}
+
+void uring_io_close(AVIOContext **pb) {
+}
+
+#endif
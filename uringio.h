@@ -0,0 +1,26 @@
+//uringio.h
+//AVIOContext for local files that keeps several large reads in flight
+//through io_uring ahead of the demuxer's position.
+
+#ifndef URINGIO_H
+#define URINGIO_H
+
+#include <libavformat/avio.h>
+
+#define URING_IO_BLOCK_SIZE (1024 * 1024)   //bytes per read
+#define URING_IO_DEPTH      8               //reads kept in flight
+#define URING_IO_BUFFER_SIZE (256 * 1024)   //AVIOContext buffer
+
+/*
+ * Open 'filename' for reading through io_uring. Returns NULL if the
+ * kernel has no io_uring (or it is not permitted) or the file is not a
+ * regular local file, in which case the caller should fall back to a
+ * synchronous path. Attach the result as the pb of an AVFormatContext
+ * with AVFMT_FLAG_CUSTOM_IO set, like file_io_open().
+ */
+AVIOContext *uring_io_open(const char *filename);
+
+//free a context from uring_io_open(), waiting for reads still in flight
+void uring_io_close(AVIOContext **pb);
+
+#endif
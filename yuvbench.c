@@ -0,0 +1,270 @@
+//yuvbench.c
+//Converts the same decoded pictures over and over with each backend so
+//decoding stays out of the timings. The sources are copied to YUV420P
+//and NV12 first, whatever the decoder outputs.
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "yuvbench.h"
+#include "yuvrgb.h"
+
+#define BENCH_PASSES    10  //conversions of every picture per backend
+
+typedef struct BenchPicture {
+    uint8_t *data[4];
+    int     linesize[4];
+}BenchPicture;
+
+typedef struct Bench {
+    int             width, height;
+    int             matrix, full_range;
+    BenchPicture    *pics[2];   //YUV420P, NV12
+    int             nb_pics;
+    uint8_t         *out;       //one RGB picture, tightly packed
+    uint8_t         *ref;       //swscale's output for the accuracy check
+}Bench;
+
+static const enum AVPixelFormat src_formats[2] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+static const enum AVPixelFormat dst_formats[2] = { AV_PIX_FMT_RGB24, AV_PIX_FMT_BGRA };
+
+static int decode_pictures(Bench *b, const char *filename, int nb_frames) {
+    AVFormatContext *pFormatCtx = NULL;
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec;
+    AVFrame *pFrame;
+    AVPacket packet;
+    struct SwsContext *sws_ctx[2] = { NULL, NULL };
+    int videoStream = -1, frameFinished, i, ret = -1;
+
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
+        goto end;
+    for (i = 0; i < pFormatCtx->nb_streams; i++) {
+        if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            videoStream = i;
+            break;
+        }
+    }
+    if (videoStream == -1)
+        goto end;
+    pCodec = avcodec_find_decoder(pFormatCtx->streams[videoStream]->codec->codec_id);
+    if (!pCodec)
+        goto end;
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    if (avcodec_copy_context(pCodecCtx, pFormatCtx->streams[videoStream]->codec) != 0 ||
+        avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
+        goto end;
+
+    b->width = pCodecCtx->width;
+    b->height = pCodecCtx->height;
+    b->matrix = pCodecCtx->colorspace == AVCOL_SPC_BT709 ? YUV_RGB_BT709 : YUV_RGB_BT601;
+    b->full_range = pCodecCtx->color_range == AVCOL_RANGE_JPEG ||
+                    pCodecCtx->pix_fmt == AV_PIX_FMT_YUVJ420P;
+    for (i = 0; i < 2; i++) {
+        b->pics[i] = av_mallocz_array(nb_frames, sizeof(BenchPicture));
+        if (!b->pics[i])
+            goto end;
+    }
+
+    pFrame = av_frame_alloc();
+    while (b->nb_pics < nb_frames && av_read_frame(pFormatCtx, &packet) >= 0) {
+        if (packet.stream_index == videoStream) {
+            avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+            for (i = 0; frameFinished && i < 2; i++) {
+                BenchPicture *pic = &b->pics[i][b->nb_pics];
+
+                //plain copies for a decoder that already outputs these
+                sws_ctx[i] = sws_getCachedContext(sws_ctx[i], b->width, b->height, pCodecCtx->pix_fmt,
+                                                  b->width, b->height, src_formats[i],
+                                                  SWS_POINT, NULL, NULL, NULL);
+                if (!sws_ctx[i] ||
+                    av_image_alloc(pic->data, pic->linesize, b->width, b->height, src_formats[i], 32) < 0)
+                    break;
+                sws_scale(sws_ctx[i], (uint8_t const *const *)pFrame->data, pFrame->linesize,
+                          0, b->height, pic->data, pic->linesize);
+            }
+            if (frameFinished && i == 2)
+                b->nb_pics++;
+            else if (frameFinished)
+                av_freep(&b->pics[0][b->nb_pics].data[0]);
+        }
+        av_free_packet(&packet);
+    }
+    av_frame_free(&pFrame);
+
+    b->out = av_malloc(b->width * b->height * 4);
+    b->ref = av_mallocz(b->width * b->height * 4);
+    if (b->nb_pics > 0 && b->out && b->ref)
+        ret = 0;
+
+end:
+    sws_freeContext(sws_ctx[0]);
+    sws_freeContext(sws_ctx[1]);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFormatCtx);
+    return ret;
+}
+
+static void free_pictures(Bench *b) {
+    int i, j;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; b->pics[i] && j < b->nb_pics; j++)
+            av_freep(&b->pics[i][j].data[0]);
+        av_freep(&b->pics[i]);
+    }
+    av_freep(&b->out);
+    av_freep(&b->ref);
+}
+
+static int clip_round(double v) {
+    v = floor(v + 0.5);
+    return v < 0 ? 0 : v > 255 ? 255 : (int)v;
+}
+
+//largest difference of b->out to the exact conversion of 'pic'
+static int exact_diff(const Bench *b, const BenchPicture *pic, int nv12, int bgra) {
+    double kr = b->matrix == YUV_RGB_BT709 ? 0.2126 : 0.299;
+    double kb = b->matrix == YUV_RGB_BT709 ? 0.0722 : 0.114;
+    double kg = 1 - kr - kb;
+    double ys = b->full_range ? 1.0 : 255.0 / 219;
+    double cs = b->full_range ? 1.0 : 255.0 / 224;
+    int yoff = b->full_range ? 0 : 16;
+    int bpp = bgra ? 4 : 3;
+    int x, y, k, max = 0;
+
+    for (y = 0; y < b->height; y++) {
+        const uint8_t *py = pic->data[0] + y * pic->linesize[0];
+        const uint8_t *pu = pic->data[1] + (y >> 1) * pic->linesize[1];
+        const uint8_t *pv = nv12 ? pu + 1 : pic->data[2] + (y >> 1) * pic->linesize[2];
+        const uint8_t *d = b->out + y * b->width * bpp;
+
+        for (x = 0; x < b->width; x++) {
+            int c = nv12 ? x & ~1 : x >> 1;
+            double yy = (py[x] - yoff) * ys;
+            double u = (pu[c] - 128) * cs;
+            double v = (pv[c] - 128) * cs;
+            int rgb[3];
+
+            rgb[0] = clip_round(yy + 2 * (1 - kr) * v);
+            rgb[1] = clip_round(yy - 2 * (1 - kb) * kb / kg * u - 2 * (1 - kr) * kr / kg * v);
+            rgb[2] = clip_round(yy + 2 * (1 - kb) * u);
+            for (k = 0; k < 3; k++) {
+                int got = d[x * bpp + (bgra ? 2 - k : k)];
+                max = FFMAX(max, abs(got - rgb[k]));
+            }
+        }
+    }
+    return max;
+}
+
+static int max_diff(const uint8_t *a, const uint8_t *b, int size) {
+    int i, max = 0;
+
+    for (i = 0; i < size; i++)
+        max = FFMAX(max, abs(a[i] - b[i]));
+    return max;
+}
+
+static void print_time(const char *name, const Bench *b, int64_t elapsed) {
+    double ms = elapsed / 1000.0 / (b->nb_pics * BENCH_PASSES);
+
+    printf("  %-8s %8.3f ms/frame %8.1f Mpix/s", name, ms,
+           ms > 0 ? b->width * b->height / ms / 1000.0 : 0.0);
+}
+
+static int run_swscale(Bench *b, int s, int d) {
+    struct SwsContext *sws_ctx;
+    uint8_t *dst[4] = { b->ref, NULL, NULL, NULL };
+    int dstStride[4] = { b->width * (d ? 4 : 3), 0, 0, 0 };
+    int64_t start;
+    int i, j;
+
+    sws_ctx = sws_getContext(b->width, b->height, src_formats[s],
+                             b->width, b->height, dst_formats[d],
+                             SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws_ctx)
+        return -1;
+    sws_setColorspaceDetails(sws_ctx, sws_getCoefficients(b->matrix == YUV_RGB_BT709 ?
+                                                          SWS_CS_ITU709 : SWS_CS_ITU601),
+                             b->full_range, sws_getCoefficients(SWS_CS_DEFAULT), 1,
+                             0, 1 << 16, 1 << 16);
+
+    start = av_gettime();
+    for (i = 0; i < BENCH_PASSES; i++) {
+        for (j = 0; j < b->nb_pics; j++)
+            sws_scale(sws_ctx, (uint8_t const *const *)b->pics[s][j].data,
+                      b->pics[s][j].linesize, 0, b->height, dst, dstStride);
+    }
+    print_time("swscale", b, av_gettime() - start);
+    sws_freeContext(sws_ctx);
+    printf("\n");
+    return 0;
+}
+
+//returns 1 if the kernels are off by more than 1 somewhere
+static int run_kernel(Bench *b, int s, int d, int isa) {
+    int stride = b->width * (d ? 4 : 3);
+    int64_t start;
+    int i, j, exact = 0;
+
+    yuv_rgb_select_isa(isa);
+    start = av_gettime();
+    for (i = 0; i < BENCH_PASSES; i++) {
+        for (j = 0; j < b->nb_pics; j++)
+            yuv_rgb_convert((uint8_t const *const *)b->pics[s][j].data, b->pics[s][j].linesize,
+                            src_formats[s], b->out, stride, dst_formats[d],
+                            b->width, b->height, b->matrix, b->full_range);
+    }
+    print_time(yuv_rgb_isa_name(isa), b, av_gettime() - start);
+
+    //check every picture, ending on the last one like swscale did
+    for (j = 0; j < b->nb_pics; j++) {
+        yuv_rgb_convert((uint8_t const *const *)b->pics[s][j].data, b->pics[s][j].linesize,
+                        src_formats[s], b->out, stride, dst_formats[d],
+                        b->width, b->height, b->matrix, b->full_range);
+        exact = FFMAX(exact, exact_diff(b, &b->pics[s][j], s == 1, d == 1));
+    }
+    printf("  max diff %d, %d to swscale%s\n", exact,
+           max_diff(b->out, b->ref, stride * b->height), exact > 1 ? "  FAIL" : "");
+    return exact > 1;
+}
+
+int yuv_bench(const char *filename, int nb_frames) {
+    Bench b = { 0 };
+    int s, d, isa, best, failed = 0;
+
+    if (decode_pictures(&b, filename, nb_frames) < 0) {
+        free_pictures(&b);
+        return -1;
+    }
+    printf("%s: %dx%d, %d pictures, %s %s range\n", filename, b.width, b.height,
+           b.nb_pics, b.matrix == YUV_RGB_BT709 ? "BT.709" : "BT.601",
+           b.full_range ? "full" : "limited");
+
+    best = yuv_rgb_select_isa(-1);
+    for (s = 0; s < 2; s++) {
+        for (d = 0; d < 2; d++) {
+            printf("%s -> %s\n", av_get_pix_fmt_name(src_formats[s]),
+                   av_get_pix_fmt_name(dst_formats[d]));
+            if (run_swscale(&b, s, d) < 0)
+                printf("  swscale  not available\n");
+            for (isa = 0; isa <= best; isa++)
+                failed |= run_kernel(&b, s, d, isa);
+        }
+    }
+    yuv_rgb_select_isa(-1);
+
+    free_pictures(&b);
+    return failed ? -1 : 0;
+}
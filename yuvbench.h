@@ -0,0 +1,17 @@
+//yuvbench.h
+//Speed and accuracy of the yuvrgb.c kernels against swscale.
+
+#ifndef YUVBENCH_H
+#define YUVBENCH_H
+
+/*
+ * Decode up to 'nb_frames' frames of the first video stream of 'filename'
+ * and convert them as YUV420P and as NV12 to RGB24 and BGRA, with
+ * swscale and with every kernel the cpu supports. Prints the time per
+ * frame and the largest difference to an exact floating point
+ * conversion. Returns 0 on success, a negative value if the file cannot
+ * be decoded or a kernel is off by more than 1.
+ */
+int yuv_bench(const char *filename, int nb_frames);
+
+#endif
@@ -0,0 +1,343 @@
+//yuvrgb.c
+//All kernels compute the same 13 bit fixed point expression, so they
+//agree bit for bit. The SIMD ones pair each term with its coefficient
+//for pmaddwd:
+//  R = (ycoef * (Y - yoff) + crv * V + round) >> 13
+//  G = (ycoef * (Y - yoff) - cgu * U - cgv * V + round) >> 13
+//  B = (ycoef * (Y - yoff) + cbu * U + round) >> 13
+//with U and V centered on 0. Row tails go through the scalar kernel.
+
+#include <libavutil/common.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "yuvrgb.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+#define SHIFT   13
+#define ROUND   (1 << (SHIFT - 1))
+
+//row flags
+#define ROW_NV12    1   //u points at interleaved UV, v is unused
+#define ROW_BGRA    2
+
+typedef struct Coeffs {
+    int yoff;
+    int ycoef, crv, cgu, cgv, cbu;
+}Coeffs;
+
+typedef void (*RowFunc)(const uint8_t *py, const uint8_t *pu, const uint8_t *pv,
+                        uint8_t *dst, int width, const Coeffs *c, int flags);
+
+static int forced_isa = -1;
+
+static void make_coeffs(Coeffs *c, int matrix, int full_range) {
+    double kr = matrix == YUV_RGB_BT709 ? 0.2126 : 0.299;
+    double kb = matrix == YUV_RGB_BT709 ? 0.0722 : 0.114;
+    double kg = 1 - kr - kb;
+    double ys = full_range ? 1.0 : 255.0 / 219;
+    double cs = (full_range ? 1.0 : 255.0 / 224) * (1 << SHIFT);
+
+    c->yoff  = full_range ? 0 : 16;
+    c->ycoef = lrint(ys * (1 << SHIFT));
+    c->crv   = lrint(2 * (1 - kr) * cs);
+    c->cbu   = lrint(2 * (1 - kb) * cs);
+    c->cgu   = lrint(2 * (1 - kb) * kb / kg * cs);
+    c->cgv   = lrint(2 * (1 - kr) * kr / kg * cs);
+}
+
+//pixels from 'x' to the end of the row
+static void row_scalar_from(const uint8_t *py, const uint8_t *pu, const uint8_t *pv,
+                            uint8_t *dst, int x, int width, const Coeffs *c, int flags) {
+    int bpp = flags & ROW_BGRA ? 4 : 3;
+
+    for (; x < width; x++) {
+        int u = (flags & ROW_NV12 ? pu[x & ~1] : pu[x >> 1]) - 128;
+        int v = (flags & ROW_NV12 ? pu[x | 1] : pv[x >> 1]) - 128;
+        int y = (py[x] - c->yoff) * c->ycoef + ROUND;
+        int r = av_clip_uint8((y + c->crv * v) >> SHIFT);
+        int g = av_clip_uint8((y - c->cgu * u - c->cgv * v) >> SHIFT);
+        int b = av_clip_uint8((y + c->cbu * u) >> SHIFT);
+        uint8_t *d = dst + x * bpp;
+
+        if (flags & ROW_BGRA) {
+            d[0] = b;
+            d[1] = g;
+            d[2] = r;
+            d[3] = 255;
+        } else {
+            d[0] = r;
+            d[1] = g;
+            d[2] = b;
+        }
+    }
+}
+
+static void row_scalar(const uint8_t *py, const uint8_t *pu, const uint8_t *pv,
+                       uint8_t *dst, int width, const Coeffs *c, int flags) {
+    row_scalar_from(py, pu, pv, dst, 0, width, c, flags);
+}
+
+#if HAVE_X86_SIMD
+
+//two int16 coefficients for one pmaddwd lane, 'lo' multiplies the first
+//element of each pair
+static uint32_t coeff_pair(int lo, int hi) {
+    return (uint16_t)lo | (uint32_t)(uint16_t)hi << 16;
+}
+
+__attribute__((target("sse2")))
+static void row_sse2(const uint8_t *py, const uint8_t *pu, const uint8_t *pv,
+                     uint8_t *dst, int width, const Coeffs *c, int flags) {
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i yoff  = _mm_set1_epi16(c->yoff);
+    const __m128i c128  = _mm_set1_epi16(128);
+    const __m128i one   = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(ROUND);
+    const __m128i k_r   = _mm_set1_epi32(coeff_pair(c->ycoef, c->crv));
+    const __m128i k_g   = _mm_set1_epi32(coeff_pair(c->ycoef, -c->cgu));
+    const __m128i k_gv  = _mm_set1_epi32(coeff_pair(-c->cgv, ROUND));
+    const __m128i k_b   = _mm_set1_epi32(coeff_pair(c->ycoef, c->cbu));
+    const __m128i lo8   = _mm_set1_epi16(0xFF);
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i y16, u16, v16, yv, yu, v1, lo, hi, r16, g16, b16, r8, g8, b8;
+
+        y16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(py + x)), zero), yoff);
+        if (flags & ROW_NV12) {
+            //4 UV words, each doubled for its two pixels
+            __m128i uv = _mm_loadl_epi64((const __m128i *)(pu + x));
+            uv  = _mm_unpacklo_epi16(uv, uv);
+            u16 = _mm_and_si128(uv, lo8);
+            v16 = _mm_srli_epi16(uv, 8);
+        } else {
+            int32_t u4, v4;
+            memcpy(&u4, pu + x / 2, 4);
+            memcpy(&v4, pv + x / 2, 4);
+            u16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero);
+            v16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+            u16 = _mm_unpacklo_epi16(u16, u16);
+            v16 = _mm_unpacklo_epi16(v16, v16);
+        }
+        u16 = _mm_sub_epi16(u16, c128);
+        v16 = _mm_sub_epi16(v16, c128);
+
+        yv  = _mm_unpacklo_epi16(y16, v16);
+        lo  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv, k_r), round), SHIFT);
+        yv  = _mm_unpackhi_epi16(y16, v16);
+        hi  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv, k_r), round), SHIFT);
+        r16 = _mm_packs_epi32(lo, hi);
+
+        yu  = _mm_unpacklo_epi16(y16, u16);
+        v1  = _mm_unpacklo_epi16(v16, one);
+        lo  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k_g), _mm_madd_epi16(v1, k_gv)), SHIFT);
+        yu  = _mm_unpackhi_epi16(y16, u16);
+        v1  = _mm_unpackhi_epi16(v16, one);
+        hi  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k_g), _mm_madd_epi16(v1, k_gv)), SHIFT);
+        g16 = _mm_packs_epi32(lo, hi);
+
+        yu  = _mm_unpacklo_epi16(y16, u16);
+        lo  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k_b), round), SHIFT);
+        yu  = _mm_unpackhi_epi16(y16, u16);
+        hi  = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, k_b), round), SHIFT);
+        b16 = _mm_packs_epi32(lo, hi);
+
+        r8 = _mm_packus_epi16(r16, r16);
+        g8 = _mm_packus_epi16(g16, g16);
+        b8 = _mm_packus_epi16(b16, b16);
+        if (flags & ROW_BGRA) {
+            __m128i bg = _mm_unpacklo_epi8(b8, g8);
+            __m128i ra = _mm_unpacklo_epi8(r8, alpha);
+            _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(bg, ra));
+            _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_unpackhi_epi16(bg, ra));
+        } else {
+            //no byte shuffle before SSSE3, drop every fourth byte by hand
+            uint8_t rgbx[32];
+            uint8_t *d = dst + 3 * x;
+            __m128i rg = _mm_unpacklo_epi8(r8, g8);
+            __m128i bx = _mm_unpacklo_epi8(b8, zero);
+            int i;
+
+            _mm_storeu_si128((__m128i *)rgbx, _mm_unpacklo_epi16(rg, bx));
+            _mm_storeu_si128((__m128i *)(rgbx + 16), _mm_unpackhi_epi16(rg, bx));
+            for (i = 0; i < 8; i++) {
+                d[3 * i]     = rgbx[4 * i];
+                d[3 * i + 1] = rgbx[4 * i + 1];
+                d[3 * i + 2] = rgbx[4 * i + 2];
+            }
+        }
+    }
+    row_scalar_from(py, pu, pv, dst, x, width, c, flags);
+}
+
+/*
+ * 16 pixels at a time. The in lane unpacks and packs cancel out: after
+ * packs_epi32 the 16 results are back in pixel order, only the final
+ * interleave needs a cross lane permute.
+ */
+__attribute__((target("avx2")))
+static void row_avx2(const uint8_t *py, const uint8_t *pu, const uint8_t *pv,
+                     uint8_t *dst, int width, const Coeffs *c, int flags) {
+    const __m256i yoff  = _mm256_set1_epi16(c->yoff);
+    const __m256i c128  = _mm256_set1_epi16(128);
+    const __m256i one   = _mm256_set1_epi16(1);
+    const __m256i round = _mm256_set1_epi32(ROUND);
+    const __m256i k_r   = _mm256_set1_epi32(coeff_pair(c->ycoef, c->crv));
+    const __m256i k_g   = _mm256_set1_epi32(coeff_pair(c->ycoef, -c->cgu));
+    const __m256i k_gv  = _mm256_set1_epi32(coeff_pair(-c->cgv, ROUND));
+    const __m256i k_b   = _mm256_set1_epi32(coeff_pair(c->ycoef, c->cbu));
+    const __m256i lo8   = _mm256_set1_epi16(0xFF);
+    const __m256i alpha = _mm256_set1_epi16(0xFF);
+    const __m256i zero  = _mm256_setzero_si256();
+    //RGBX to RGB in each lane, the last 4 bytes are zero
+    const __m256i pack3 = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    //RGB24 stores run 4 bytes past the 16 pixels, into ones written later
+    int end = flags & ROW_BGRA ? width : width - 2;
+    int x;
+
+    for (x = 0; x + 16 <= end; x += 16) {
+        __m256i y16, u16, v16, t, lo, hi, r16, g16, b16;
+        __m128i c8, cl, ch;
+
+        y16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(py + x))), yoff);
+        if (flags & ROW_NV12) {
+            c8  = _mm_loadu_si128((const __m128i *)(pu + x));
+            cl  = _mm_unpacklo_epi16(c8, c8);
+            ch  = _mm_unpackhi_epi16(c8, c8);
+            t   = _mm256_inserti128_si256(_mm256_castsi128_si256(cl), ch, 1);
+            u16 = _mm256_and_si256(t, lo8);
+            v16 = _mm256_srli_epi16(t, 8);
+        } else {
+            c8  = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(pu + x / 2)));
+            cl  = _mm_unpacklo_epi16(c8, c8);
+            ch  = _mm_unpackhi_epi16(c8, c8);
+            u16 = _mm256_inserti128_si256(_mm256_castsi128_si256(cl), ch, 1);
+            c8  = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(pv + x / 2)));
+            cl  = _mm_unpacklo_epi16(c8, c8);
+            ch  = _mm_unpackhi_epi16(c8, c8);
+            v16 = _mm256_inserti128_si256(_mm256_castsi128_si256(cl), ch, 1);
+        }
+        u16 = _mm256_sub_epi16(u16, c128);
+        v16 = _mm256_sub_epi16(v16, c128);
+
+        t   = _mm256_unpacklo_epi16(y16, v16);
+        lo  = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(t, k_r), round), SHIFT);
+        t   = _mm256_unpackhi_epi16(y16, v16);
+        hi  = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(t, k_r), round), SHIFT);
+        r16 = _mm256_packs_epi32(lo, hi);
+
+        lo  = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(y16, u16), k_g),
+                               _mm256_madd_epi16(_mm256_unpacklo_epi16(v16, one), k_gv));
+        hi  = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(y16, u16), k_g),
+                               _mm256_madd_epi16(_mm256_unpackhi_epi16(v16, one), k_gv));
+        g16 = _mm256_packs_epi32(_mm256_srai_epi32(lo, SHIFT), _mm256_srai_epi32(hi, SHIFT));
+
+        t   = _mm256_unpacklo_epi16(y16, u16);
+        lo  = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(t, k_b), round), SHIFT);
+        t   = _mm256_unpackhi_epi16(y16, u16);
+        hi  = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(t, k_b), round), SHIFT);
+        b16 = _mm256_packs_epi32(lo, hi);
+
+        if (flags & ROW_BGRA) {
+            __m256i br = _mm256_packus_epi16(b16, r16);
+            __m256i ga = _mm256_packus_epi16(g16, alpha);
+            __m256i bg = _mm256_unpacklo_epi8(br, ga);
+            __m256i ra = _mm256_unpackhi_epi8(br, ga);
+            lo = _mm256_unpacklo_epi16(bg, ra);     //pixels 0-3, 8-11
+            hi = _mm256_unpackhi_epi16(bg, ra);     //pixels 4-7, 12-15
+            _mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)(dst + 4 * x + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        } else {
+            __m256i rb = _mm256_packus_epi16(r16, b16);
+            __m256i gx = _mm256_packus_epi16(g16, zero);
+            __m256i rg = _mm256_unpacklo_epi8(rb, gx);
+            __m256i bx = _mm256_unpackhi_epi8(rb, gx);
+            uint8_t *d = dst + 3 * x;
+
+            lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, bx), pack3);
+            hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, bx), pack3);
+            _mm_storeu_si128((__m128i *)d,        _mm256_castsi256_si128(lo));
+            _mm_storeu_si128((__m128i *)(d + 12), _mm256_castsi256_si128(hi));
+            _mm_storeu_si128((__m128i *)(d + 24), _mm256_extracti128_si256(lo, 1));
+            _mm_storeu_si128((__m128i *)(d + 36), _mm256_extracti128_si256(hi, 1));
+        }
+    }
+    row_scalar_from(py, pu, pv, dst, x, width, c, flags);
+}
+
+static int best_isa(void) {
+    if (__builtin_cpu_supports("avx2"))
+        return YUV_RGB_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return YUV_RGB_SSE2;
+    return YUV_RGB_SCALAR;
+}
+
+#else
+
+static int best_isa(void) {
+    return YUV_RGB_SCALAR;
+}
+
+#endif
+
+int yuv_rgb_select_isa(int isa) {
+    forced_isa = isa;
+    return isa < 0 ? best_isa() : FFMIN(isa, best_isa());
+}
+
+const char *yuv_rgb_isa_name(int isa) {
+    static const char *names[YUV_RGB_NB_ISAS] = { "scalar", "sse2", "avx2" };
+
+    return isa >= 0 && isa < YUV_RGB_NB_ISAS ? names[isa] : "?";
+}
+
+int yuv_rgb_supported(enum AVPixelFormat srcFormat, enum AVPixelFormat dstFormat) {
+    return (srcFormat == AV_PIX_FMT_YUV420P || srcFormat == AV_PIX_FMT_YUVJ420P ||
+            srcFormat == AV_PIX_FMT_NV12) &&
+           (dstFormat == AV_PIX_FMT_RGB24 || dstFormat == AV_PIX_FMT_BGRA);
+}
+
+int yuv_rgb_convert(const uint8_t *const src[], const int srcStride[],
+                    enum AVPixelFormat srcFormat, uint8_t *dst, int dstStride,
+                    enum AVPixelFormat dstFormat, int width, int height,
+                    int matrix, int full_range) {
+    RowFunc row = row_scalar;
+    Coeffs c;
+    int flags = 0, isa, y;
+
+    if (!yuv_rgb_supported(srcFormat, dstFormat))
+        return -1;
+    if (srcFormat == AV_PIX_FMT_NV12)
+        flags |= ROW_NV12;
+    if (dstFormat == AV_PIX_FMT_BGRA)
+        flags |= ROW_BGRA;
+    //the J formats are full range whatever the stream says
+    make_coeffs(&c, matrix, full_range || srcFormat == AV_PIX_FMT_YUVJ420P);
+
+    isa = forced_isa < 0 ? best_isa() : FFMIN(forced_isa, best_isa());
+#if HAVE_X86_SIMD
+    if (isa == YUV_RGB_AVX2)
+        row = row_avx2;
+    else if (isa == YUV_RGB_SSE2)
+        row = row_sse2;
+#endif
+
+    for (y = 0; y < height; y++) {
+        row(src[0] + y * srcStride[0],
+            src[1] + (y >> 1) * srcStride[1],
+            flags & ROW_NV12 ? NULL : src[2] + (y >> 1) * srcStride[2],
+            dst + y * dstStride, width, &c, flags);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+//yuvrgb.h
+//Same size YUV 4:2:0 to RGB conversion with hand written SSE2 and AVX2
+//kernels, picked at run time. For when the picture only changes
+//colorspace and swscale's generic path is more than is needed.
+
+#ifndef YUVRGB_H
+#define YUVRGB_H
+
+#include <libavutil/pixfmt.h>
+
+#include <stdint.h>
+
+enum {
+    YUV_RGB_BT601,
+    YUV_RGB_BT709,
+};
+
+enum {
+    YUV_RGB_SCALAR,
+    YUV_RGB_SSE2,
+    YUV_RGB_AVX2,
+    YUV_RGB_NB_ISAS,
+};
+
+//whether yuv_rgb_convert() handles this pair of formats
+int yuv_rgb_supported(enum AVPixelFormat srcFormat, enum AVPixelFormat dstFormat);
+
+/*
+ * Convert a width x height picture from YUV420P (or YUVJ420P) or NV12 to
+ * RGB24 or BGRA (alpha 255), with the BT.601 or BT.709 matrix, full or
+ * limited range input. Chroma is not interpolated, every sample covers
+ * its 2x2 block like swscale's unscaled path. The result is within 1 of
+ * the exact conversion. Returns 0 on success, -1 for formats it does
+ * not handle.
+ */
+int yuv_rgb_convert(const uint8_t *const src[], const int srcStride[],
+                    enum AVPixelFormat srcFormat, uint8_t *dst, int dstStride,
+                    enum AVPixelFormat dstFormat, int width, int height,
+                    int matrix, int full_range);
+
+/*
+ * Use the kernels of 'isa' or the best one below it the cpu supports,
+ * -1 goes back to the best available. Returns the one now in use. For
+ * benchmarks and tests.
+ */
+int yuv_rgb_select_isa(int isa);
+
+const char *yuv_rgb_isa_name(int isa);
+
+#endif